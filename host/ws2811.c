@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ws2811.h"
+
+// Stands in for the driver state the real library frees in ws2811_fini, so
+// a strip used after it, or finished twice, aborts here as it would crash
+// on the badge
+struct ws2811_device {
+    int unused;
+};
+
+static struct ws2811_device device;
+
+static void check_open(const ws2811_t* ws2811, const char* call)
+{
+    if (ws2811->device != NULL)
+        return;
+
+    fprintf(stderr, "%s on a strip that isn't initialized\n", call);
+    abort();
+}
+
+ws2811_return_t ws2811_init(ws2811_t* ws2811)
+{
+    ws2811->device = &device;
+
+    for (int c = 0; c < RPI_PWM_CHANNELS; c++)
+    {
+        ws2811_channel_t* channel = &ws2811->channel[c];
+
+        channel->leds = NULL;
+        if (channel->count == 0)
+            continue;
+
+        channel->leds = calloc(channel->count, sizeof(ws2811_led_t));
+        if (channel->leds == NULL)
+        {
+            ws2811_fini(ws2811);
+            return WS2811_ERROR_OUT_OF_MEMORY;
+        }
+    }
+
+    return WS2811_SUCCESS;
+}
+
+void ws2811_fini(ws2811_t* ws2811)
+{
+    check_open(ws2811, "ws2811_fini");
+
+    for (int c = 0; c < RPI_PWM_CHANNELS; c++)
+    {
+        free(ws2811->channel[c].leds);
+        ws2811->channel[c].leds = NULL;
+    }
+
+    ws2811->device = NULL;
+}
+
+// Nothing to send the frame to, the sinks show it if asked
+ws2811_return_t ws2811_render(ws2811_t* ws2811)
+{
+    check_open(ws2811, "ws2811_render");
+    return WS2811_SUCCESS;
+}
+
+ws2811_return_t ws2811_wait(ws2811_t* ws2811)
+{
+    check_open(ws2811, "ws2811_wait");
+    return WS2811_SUCCESS;
+}
+
+const char* ws2811_get_return_t_str(const ws2811_return_t state)
+{
+    switch (state)
+    {
+        case WS2811_SUCCESS:
+            return "Success";
+        case WS2811_ERROR_OUT_OF_MEMORY:
+            return "Out of memory";
+        default:
+            return "Generic failure";
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef __WS2811_H__
+#define __WS2811_H__
+
+#include <stdint.h>
+
+// Stand-in for the rpi_ws281x library on machines without the PWM/DMA
+// hardware. Only what the badge uses, with the same names and layout, and
+// frames stay in the channel buffers where the sinks can pick them up.
+#define RPI_PWM_CHANNELS 2
+
+#define WS2811_TARGET_FREQ 800000
+#define WS2811_STRIP_RGB 0x00100800
+#define WS2811_STRIP_GRB 0x00081000
+
+typedef uint32_t ws2811_led_t;
+
+typedef enum {
+    WS2811_SUCCESS = 0,
+    WS2811_ERROR_GENERIC = -1,
+    WS2811_ERROR_OUT_OF_MEMORY = -2,
+} ws2811_return_t;
+
+typedef struct {
+    int gpionum;
+    int invert;
+    int count;
+    int strip_type;
+    ws2811_led_t* leds;
+    uint8_t brightness;
+    uint8_t wshift;
+    uint8_t rshift;
+    uint8_t gshift;
+    uint8_t bshift;
+    uint8_t* gamma;
+} ws2811_channel_t;
+
+typedef struct {
+    uint64_t render_wait_time;
+    struct ws2811_device* device;
+    const void* rpi_hw;
+    uint32_t freq;
+    int dmanum;
+    ws2811_channel_t channel[RPI_PWM_CHANNELS];
+} ws2811_t;
+
+ws2811_return_t ws2811_init(ws2811_t* ws2811);
+void ws2811_fini(ws2811_t* ws2811);
+ws2811_return_t ws2811_render(ws2811_t* ws2811);
+ws2811_return_t ws2811_wait(ws2811_t* ws2811);
+const char* ws2811_get_return_t_str(const ws2811_return_t state);
+
+#endif
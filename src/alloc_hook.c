@@ -0,0 +1,83 @@
+// Heap allocation counter for the alloc-check build. These replace the
+// malloc family for the whole process, so allocations libc makes for us
+// (strdup, fopen, stdio buffers, thread setup) are counted as well as our
+// own, and hand the work on to glibc's allocator. Compiled out otherwise.
+#ifdef ALLOC_HOOKS
+
+#include <errno.h>
+#include <stddef.h>
+
+#include "telemetry.h"
+
+// glibc's own allocator, under the names it exports for replacements
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void* __libc_valloc(size_t size);
+void* __libc_pvalloc(size_t size);
+void __libc_free(void* ptr);
+
+void* malloc(size_t size)
+{
+    telemetry_add(TELEMETRY_HEAP_ALLOCS, 1);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size)
+{
+    telemetry_add(TELEMETRY_HEAP_ALLOCS, 1);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    telemetry_add(TELEMETRY_HEAP_ALLOCS, 1);
+    return __libc_realloc(ptr, size);
+}
+
+void* memalign(size_t alignment, size_t size)
+{
+    telemetry_add(TELEMETRY_HEAP_ALLOCS, 1);
+    return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+    telemetry_add(TELEMETRY_HEAP_ALLOCS, 1);
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** out, size_t alignment, size_t size)
+{
+    if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0)
+        return EINVAL;
+
+    telemetry_add(TELEMETRY_HEAP_ALLOCS, 1);
+    void* ptr = __libc_memalign(alignment, size);
+    if (ptr == NULL)
+        return ENOMEM;
+
+    *out = ptr;
+    return 0;
+}
+
+void* valloc(size_t size)
+{
+    telemetry_add(TELEMETRY_HEAP_ALLOCS, 1);
+    return __libc_valloc(size);
+}
+
+void* pvalloc(size_t size)
+{
+    telemetry_add(TELEMETRY_HEAP_ALLOCS, 1);
+    return __libc_pvalloc(size);
+}
+
+// Not counted, but has to go back to the allocator the rest came from
+void free(void* ptr)
+{
+    __libc_free(ptr);
+}
+
+#endif
@@ -0,0 +1,36 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+// Keep every carve aligned for vector loads
+#define ARENA_ALIGN 16
+
+int arena_init(arena_t* arena, size_t size)
+{
+    arena->base = aligned_alloc(ARENA_ALIGN, (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1));
+    if (arena->base == NULL)
+    {
+        printf("Unable to allocate %zu byte arena\n", size);
+        return 1;
+    }
+
+    // Touch it all now so the first effect doesn't page fault
+    memset(arena->base, 0, size);
+
+    arena->size = size;
+    arena->used = 0;
+    return 0;
+}
+
+// Returns NULL once the arena is exhausted, it never grows
+void* arena_alloc(arena_t* arena, size_t size)
+{
+    size_t start = (arena->used + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+    if (start + size > arena->size)
+        return NULL;
+
+    arena->used = start + size;
+    return arena->base + start;
+}
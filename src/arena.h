@@ -0,0 +1,18 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+
+// Bump allocator over one block grabbed at startup. State is carved once
+// and kept for the life of the process, so the steady state never touches
+// the heap.
+typedef struct {
+    unsigned char* base;
+    size_t size;
+    size_t used;
+} arena_t;
+
+int arena_init(arena_t* arena, size_t size);
+void* arena_alloc(arena_t* arena, size_t size);
+
+#endif
@@ -0,0 +1,466 @@
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "audio.h"
+#include "shutdown.h"
+#include "telemetry.h"
+
+// The real FFT runs as a complex one of half the size
+#define AUDIO_FFT (AUDIO_BLOCK / 2)
+
+// Peaks fall back by this much a block, so the levels adapt to the volume
+#define AUDIO_PEAK_DECAY 0.995f
+// Anything quieter than this against full scale is silence
+#define AUDIO_FLOOR 1e-6f
+
+// An onset is a jump in band energies well above the recent average jump,
+// at most one every AUDIO_ONSET_GAP blocks
+#define AUDIO_FLUX_SMOOTHING 0.1f
+#define AUDIO_ONSET_RATIO 1.5f
+#define AUDIO_ONSET_MIN 1.0f
+#define AUDIO_ONSET_GAP 4
+#define AUDIO_ONSET_LEVEL 0.1f
+
+// Tables, built once by audio_init()
+static float window[AUDIO_BLOCK];
+static int bitrev[AUDIO_FFT];
+// Butterfly twiddles, the stage with half size h uses entries h to 2h - 1
+static float stage_re[AUDIO_FFT];
+static float stage_im[AUDIO_FFT];
+// Twiddles to split the half size transform back into the real one
+static float split_re[AUDIO_FFT];
+static float split_im[AUDIO_FFT];
+// First bin of each band, log spaced
+static int band_start[AUDIO_BANDS + 1];
+
+// Analysis state, owned by whichever thread feeds audio
+static float fft_re[AUDIO_FFT];
+static float fft_im[AUDIO_FFT];
+static float power[AUDIO_BINS];
+static float band_peak[AUDIO_BANDS];
+static float band_prev[AUDIO_BANDS];
+static float level_peak = AUDIO_FLOOR;
+static float flux_mean = 0;
+static int since_onset = AUDIO_ONSET_GAP;
+static uint32_t onsets = 0;
+
+static float block[AUDIO_BLOCK];
+static int block_fill = 0;
+static bool skip_next = false;
+
+// The latest levels, read by effects once a frame
+static audio_levels_t latest;
+static pthread_mutex_t latest_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int64_t monotonic_us()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+void audio_init()
+{
+    int bits = 0;
+    while ((1 << bits) < AUDIO_FFT)
+        bits++;
+
+    for (int i = 0; i < AUDIO_BLOCK; i++)
+        window[i] = 0.5f - 0.5f * cosf(2 * M_PI * i / AUDIO_BLOCK);
+
+    for (int i = 0; i < AUDIO_FFT; i++)
+    {
+        int r = 0;
+        for (int b = 0; b < bits; b++)
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        bitrev[i] = r;
+
+        split_re[i] = cosf(2 * M_PI * i / AUDIO_BLOCK);
+        split_im[i] = -sinf(2 * M_PI * i / AUDIO_BLOCK);
+    }
+
+    for (int h = 1; h < AUDIO_FFT; h <<= 1)
+    {
+        for (int k = 0; k < h; k++)
+        {
+            stage_re[h + k] = cosf(M_PI * k / h);
+            stage_im[h + k] = -sinf(M_PI * k / h);
+        }
+    }
+
+    // One octave a band from bin 1 up to the top of the spectrum
+    for (int b = 0; b <= AUDIO_BANDS; b++)
+        band_start[b] = (int) (powf(AUDIO_BINS, (float) b / AUDIO_BANDS) + 0.5f);
+
+    for (int b = 0; b < AUDIO_BANDS; b++)
+    {
+        band_peak[b] = AUDIO_FLOOR;
+        band_prev[b] = AUDIO_FLOOR;
+    }
+}
+
+// In place radix-2 transform on split real and imaginary arrays. The inner
+// loop walks contiguous data with contiguous twiddles, so it vectorises
+// where the target has SIMD and stays a tight scalar loop where it doesn't.
+static void fft(float* restrict re, float* restrict im)
+{
+    for (int i = 0; i < AUDIO_FFT; i++)
+    {
+        int j = bitrev[i];
+        if (i < j)
+        {
+            float t = re[i];
+            re[i] = re[j];
+            re[j] = t;
+            t = im[i];
+            im[i] = im[j];
+            im[j] = t;
+        }
+    }
+
+    for (int h = 1; h < AUDIO_FFT; h <<= 1)
+    {
+        const float* restrict wr = stage_re + h;
+        const float* restrict wi = stage_im + h;
+
+        for (int start = 0; start < AUDIO_FFT; start += 2 * h)
+        {
+            float* restrict ar = re + start;
+            float* restrict ai = im + start;
+            float* restrict br = re + start + h;
+            float* restrict bi = im + start + h;
+
+            for (int k = 0; k < h; k++)
+            {
+                float tr = br[k] * wr[k] - bi[k] * wi[k];
+                float ti = br[k] * wi[k] + bi[k] * wr[k];
+
+                br[k] = ar[k] - tr;
+                bi[k] = ai[k] - ti;
+                ar[k] += tr;
+                ai[k] += ti;
+            }
+        }
+    }
+}
+
+// Power spectrum of a windowed block. Even samples go in as the real part
+// and odd ones as the imaginary part of a half size transform, which is
+// then split into the spectrum of the whole block.
+static void spectrum(const float* in)
+{
+    for (int i = 0; i < AUDIO_FFT; i++)
+    {
+        fft_re[i] = in[2 * i] * window[2 * i];
+        fft_im[i] = in[2 * i + 1] * window[2 * i + 1];
+    }
+
+    fft(fft_re, fft_im);
+
+    // A full scale sine comes out close to 1
+    float scale = 16.0f / ((float) AUDIO_BLOCK * AUDIO_BLOCK);
+
+    power[0] = 0;
+    for (int k = 1; k < AUDIO_BINS; k++)
+    {
+        int m = AUDIO_FFT - k;
+
+        float even_r = (fft_re[k] + fft_re[m]) * 0.5f;
+        float even_i = (fft_im[k] - fft_im[m]) * 0.5f;
+        float odd_r = (fft_im[k] + fft_im[m]) * 0.5f;
+        float odd_i = (fft_re[m] - fft_re[k]) * 0.5f;
+
+        float xr = even_r + split_re[k] * odd_r - split_im[k] * odd_i;
+        float xi = even_i + split_re[k] * odd_i + split_im[k] * odd_r;
+
+        power[k] = (xr * xr + xi * xi) * scale;
+    }
+}
+
+void audio_analyse(const float* in, audio_levels_t* out)
+{
+    spectrum(in);
+
+    float flux = 0;
+
+    for (int b = 0; b < AUDIO_BANDS; b++)
+    {
+        float energy = 0;
+        for (int k = band_start[b]; k < band_start[b + 1]; k++)
+            energy += power[k];
+        energy = fmaxf(energy, AUDIO_FLOOR);
+
+        band_peak[b] = fmaxf(energy, band_peak[b] * AUDIO_PEAK_DECAY);
+        out->band[b] = energy / band_peak[b];
+
+        flux += fmaxf(0, logf(energy / band_prev[b]));
+        band_prev[b] = energy;
+    }
+
+    float mean_square = 0;
+    for (int i = 0; i < AUDIO_BLOCK; i++)
+        mean_square += in[i] * in[i];
+    mean_square = fmaxf(mean_square / AUDIO_BLOCK, AUDIO_FLOOR);
+
+    level_peak = fmaxf(mean_square, level_peak * AUDIO_PEAK_DECAY);
+    out->level = sqrtf(mean_square / level_peak);
+
+    since_onset++;
+    if (flux > flux_mean * AUDIO_ONSET_RATIO + AUDIO_ONSET_MIN
+        && since_onset >= AUDIO_ONSET_GAP && out->level > AUDIO_ONSET_LEVEL)
+    {
+        onsets++;
+        since_onset = 0;
+        telemetry_add(TELEMETRY_AUDIO_ONSETS, 1);
+    }
+    flux_mean += (flux - flux_mean) * AUDIO_FLUX_SMOOTHING;
+
+    out->onsets = onsets;
+    out->timestamp_us = monotonic_us();
+}
+
+// Mono samples from the mixer, analysed as soon as a block fills so the
+// levels are never more than a block behind the speakers
+void audio_feed(const int16_t* pcm, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        block[block_fill++] = pcm[i] / 32768.0f;
+
+        if (block_fill < AUDIO_BLOCK)
+            continue;
+        block_fill = 0;
+
+        if (skip_next)
+        {
+            skip_next = false;
+            telemetry_add(TELEMETRY_AUDIO_SKIPS, 1);
+            continue;
+        }
+
+        audio_levels_t levels;
+        int64_t start = monotonic_us();
+        audio_analyse(block, &levels);
+        int64_t took = monotonic_us() - start;
+
+        pthread_mutex_lock(&latest_lock);
+        latest = levels;
+        pthread_mutex_unlock(&latest_lock);
+
+        telemetry_add(TELEMETRY_AUDIO_BLOCKS, 1);
+        telemetry_max(TELEMETRY_AUDIO_WORST_US, took);
+        skip_next = took > AUDIO_BUDGET_US;
+    }
+}
+
+// Always fills in the latest levels, false if they are too old to react to
+bool audio_levels(audio_levels_t* out)
+{
+    pthread_mutex_lock(&latest_lock);
+    *out = latest;
+    pthread_mutex_unlock(&latest_lock);
+
+    return out->timestamp_us != 0 && monotonic_us() - out->timestamp_us < AUDIO_STALE_US;
+}
+
+static uint32_t get_u32(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint16_t get_u16(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+int audio_wav_open(audio_wav_t* wav, const char* path)
+{
+    memset(wav, 0, sizeof(*wav));
+
+    wav->f = fopen(path, "rb");
+    if (wav->f == NULL)
+    {
+        printf("Unable to open %s\n", path);
+        return 1;
+    }
+
+    uint8_t header[12];
+    if (fread(header, 1, sizeof(header), wav->f) != sizeof(header)
+        || memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0)
+    {
+        printf("%s is not a WAV file\n", path);
+        audio_wav_close(wav);
+        return 1;
+    }
+
+    int bits = 0;
+    uint8_t chunk[8];
+
+    while (fread(chunk, 1, sizeof(chunk), wav->f) == sizeof(chunk))
+    {
+        uint32_t size = get_u32(chunk + 4);
+
+        if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16)
+        {
+            uint8_t fmt[16];
+            if (fread(fmt, 1, sizeof(fmt), wav->f) != sizeof(fmt))
+                break;
+
+            if (get_u16(fmt) == 1)
+            {
+                wav->channels = get_u16(fmt + 2);
+                wav->rate = get_u32(fmt + 4);
+                bits = get_u16(fmt + 14);
+            }
+            size -= sizeof(fmt);
+        }
+        else if (memcmp(chunk, "data", 4) == 0)
+        {
+            wav->data = ftell(wav->f);
+            wav->size = size;
+            break;
+        }
+
+        // Chunks are padded to an even length
+        fseek(wav->f, size + (size & 1), SEEK_CUR);
+    }
+
+    if (wav->data == 0 || bits != 16 || wav->channels < 1 || wav->channels > 2 || wav->rate <= 0)
+    {
+        printf("%s: only 16 bit PCM mono or stereo WAV files are supported\n", path);
+        audio_wav_close(wav);
+        return 1;
+    }
+
+    return 0;
+}
+
+// Up to count mono samples, 0 at the end of the data
+int audio_wav_read(audio_wav_t* wav, int16_t* pcm, int count)
+{
+    uint8_t buf[AUDIO_BLOCK * 4];
+    int frame = 2 * wav->channels;
+    long left = (long) wav->size - (ftell(wav->f) - wav->data);
+
+    count = count > AUDIO_BLOCK ? AUDIO_BLOCK : count;
+    if (left < (long) count * frame)
+        count = left / frame;
+
+    int got = fread(buf, frame, count, wav->f);
+
+    for (int i = 0; i < got; i++)
+    {
+        const uint8_t* p = buf + i * frame;
+        int sample = (int16_t) get_u16(p);
+
+        if (wav->channels == 2)
+            sample = (sample + (int16_t) get_u16(p + 2)) / 2;
+
+        pcm[i] = sample;
+    }
+
+    return got;
+}
+
+void audio_wav_rewind(audio_wav_t* wav)
+{
+    fseek(wav->f, wav->data, SEEK_SET);
+}
+
+void audio_wav_close(audio_wav_t* wav)
+{
+    if (wav->f != NULL)
+        fclose(wav->f);
+    wav->f = NULL;
+}
+
+static audio_wav_t source;
+static pthread_t source_thread;
+static bool source_running = false;
+static atomic_bool source_stopping = false;
+
+static void* source_main(void* arg)
+{
+    int16_t pcm[AUDIO_BLOCK];
+    int64_t start = monotonic_us();
+    int64_t played = 0;
+    bool rewound = false;
+
+    while (!atomic_load(&source_stopping))
+    {
+        int got = audio_wav_read(&source, pcm, AUDIO_BLOCK);
+        if (got == 0)
+        {
+            // Nothing even from the start, the file is shorter than its
+            // header says and rewinding again would only spin
+            if (rewound)
+            {
+                printf("Audio source has no samples left after rewinding, stopping it\n");
+                break;
+            }
+
+            audio_wav_rewind(&source);
+            rewound = true;
+            continue;
+        }
+
+        rewound = false;
+
+        audio_feed(pcm, got);
+
+        // Keep to the file's own rate, as if it were coming off the mixer
+        played += got;
+        int64_t due = start + played * 1000000 / source.rate;
+        struct timespec ts = {
+            .tv_sec = due / 1000000,
+            .tv_nsec = (due % 1000000) * 1000,
+        };
+
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+            continue;
+    }
+
+    return arg;
+}
+
+int audio_start_wav(const char* path)
+{
+    if (audio_wav_open(&source, path) != 0)
+        return 1;
+
+    // Too short to ever fill a block, and it would spin on rewinding
+    if (source.size < (uint32_t) AUDIO_BLOCK * 2 * source.channels)
+    {
+        printf("%s is too short to analyse\n", path);
+        audio_wav_close(&source);
+        return 1;
+    }
+
+    atomic_store(&source_stopping, false);
+    source_running = pthread_create(&source_thread, NULL, source_main, NULL) == 0;
+    if (!source_running)
+    {
+        audio_wav_close(&source);
+        return 1;
+    }
+
+    return 0;
+}
+
+void audio_stop()
+{
+    if (!source_running)
+        return;
+
+    atomic_store(&source_stopping, true);
+    if (shutdown_join(source_thread, "audio") == 0)
+        audio_wav_close(&source);
+    source_running = false;
+}
@@ -0,0 +1,60 @@
+#ifndef __AUDIO_H__
+#define __AUDIO_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Analysis of whatever the speakers play, for effects that react to it.
+// PCM goes in a block at a time, each full block is windowed and run
+// through a real FFT, and the spectrum is folded into a few log spaced
+// bands with a loudness level and onset detection on top.
+#define AUDIO_BLOCK 512
+#define AUDIO_BINS (AUDIO_BLOCK / 2)
+#define AUDIO_BANDS 8
+
+// Analysis runs on the thread that feeds the audio. A block that takes
+// longer than this makes the next block get skipped, so a slow analysis
+// never eats into the time the frame loop needs.
+#define AUDIO_BUDGET_US 1000
+
+// Levels older than this are stale, effects go back to ignoring audio
+#define AUDIO_STALE_US 250000
+
+typedef struct {
+    // Each band and the overall level against their recent peaks, 0 to 1
+    float band[AUDIO_BANDS];
+    float level;
+
+    // Counts up on every onset, effects compare it with what they saw last
+    uint32_t onsets;
+    int64_t timestamp_us;
+} audio_levels_t;
+
+void audio_init();
+void audio_feed(const int16_t* pcm, int count);
+bool audio_levels(audio_levels_t* out);
+
+// Analyse one block straight away, for tools
+void audio_analyse(const float* block, audio_levels_t* out);
+
+// 16 bit PCM WAV files, mixed down to mono
+typedef struct {
+    FILE* f;
+    int channels;
+    int rate;
+    long data;
+    uint32_t size;
+} audio_wav_t;
+
+int audio_wav_open(audio_wav_t* wav, const char* path);
+int audio_wav_read(audio_wav_t* wav, int16_t* pcm, int count);
+void audio_wav_rewind(audio_wav_t* wav);
+void audio_wav_close(audio_wav_t* wav);
+
+// Stand in for the playback mixer, plays a WAV file through the analysis
+// in real time, over and over
+int audio_start_wav(const char* path);
+void audio_stop();
+
+#endif
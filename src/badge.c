@@ -1,33 +1,161 @@
+#include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
-#include <wiringPi.h>
+#include "audio.h"
 #include "dialer.h"
+#include "geometry.h"
+#include "journal.h"
+#include "power.h"
+#include "registry.h"
+#include "shutdown.h"
+#include "rt.h"
+#include "sampler.h"
+#include "sink.h"
+#include "transition.h"
+#include "zones.h"
 
-void sighandler(int sig)
+void dial_cb(int digit)
 {
-    printf("Bye!\n");
-
-    // Kill everything
-    stop_dialer();
+    printf("Dialed: %d\n", digit);
 }
 
-void dial_cb(int digit)
+void usage(const char* prog)
 {
-    printf("Dialed: %d\n", digit);
+    printf("Usage: %s [-g geometry.conf] [-e effects] [-z zones.conf] [-b mA] [-a audio.wav] [-j journal] [-i edges|sampled] [-x ms] [-r] [-s socket] [-p] [-o frames.rec]\n", prog);
+    printf("  -e  directory of compiled timeline effects\n");
+    printf("  -z  split the ring into zones that each run their own effect\n");
+    printf("  -b  most current the strip may draw in mA, 0 for no limit (default %d)\n", POWER_DEFAULT_BUDGET_MA);
+    printf("  -a  play a WAV file through the audio analysis, for audio reactive effects\n");
+    printf("  -j  keep a journal of every dial in this file (default %s)\n", JOURNAL_DEFAULT_FILE);
+    printf("  -i  read the dial from edge interrupts (default) or by sampling at %d Hz\n", SAMPLER_HZ);
+    printf("  -x  crossfade between effects for this long, 0 to cut straight over (default %d)\n", TRANSITION_DEFAULT_MS);
+    printf("  -r  real-time mode: SCHED_FIFO, locked memory and pinned threads\n");
+    printf("  -s  serve the control protocol on a UNIX socket\n");
+    printf("  -p  preview the ring on the terminal\n");
+    printf("  -o  record every frame to a file\n");
 }
 
-int main()
+int main(int argc, char** argv)
 {
-    // Setup the signal handler
-    struct sigaction sa = {
-        .sa_handler = sighandler,
-    };
-    sigaction(SIGINT, &sa, NULL);
-    sigaction(SIGTERM, &sa, NULL);
-
-    // Run the dialer
-    return run_dialer(dial_cb);
+    const char* geometry_file = NULL;
+    const char* effects_dir = REGISTRY_TIMELINE_DIR;
+    const char* zones_file = NULL;
+    const char* audio_file = NULL;
+    const char* journal_file = NULL;
+    bool realtime = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "g:e:z:b:a:j:i:x:rs:po:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'g':
+                geometry_file = optarg;
+                break;
+            case 'e':
+                effects_dir = optarg;
+                break;
+            case 'z':
+                zones_file = optarg;
+                break;
+            case 'b':
+                power_set_budget(atoi(optarg));
+                break;
+            case 'a':
+                audio_file = optarg;
+                break;
+            case 'j':
+                journal_file = optarg;
+                break;
+            case 'i':
+                if (strcmp(optarg, "sampled") == 0)
+                    dialer_set_input(DIALER_INPUT_SAMPLED);
+                else if (strcmp(optarg, "edges") != 0)
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'x':
+                transition_set_ms(atoi(optarg));
+                break;
+            case 'r':
+                realtime = true;
+                break;
+            case 's':
+                dialer_set_control_path(optarg);
+                break;
+            case 'p':
+                if (sink_add_preview(stdout) != 0)
+                    return 1;
+                break;
+            case 'o':
+                if (sink_add_recorder(optarg) != 0)
+                    return 1;
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    // Use the installed calibration if there is one, otherwise the defaults
+    // match the original 43 pixel ring
+    if (geometry_file == NULL && access(GEOMETRY_DEFAULT_FILE, R_OK) == 0)
+        geometry_file = GEOMETRY_DEFAULT_FILE;
+
+    if (geometry_load(geometry_file) != 0)
+        return 1;
+
+    registry_load_timelines(effects_dir);
+
+    // Zones name their effects, so they come after the timelines
+    if (zones_file != NULL && zones_load(zones_file) != 0)
+        return 1;
+
+    // The dialer takes SIGINT and SIGTERM through a signalfd. Block them
+    // before the audio thread and the journal syncer start, they inherit
+    // the mask, and a signal either took instead would kill the process
+    // without a shutdown.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    audio_init();
+    if (audio_file != NULL && audio_start_wav(audio_file) != 0)
+        return 1;
+
+    // A journal asked for has to open, the default one is best effort
+    if (journal_file != NULL)
+    {
+        if (journal_open(journal_file) != 0)
+        {
+            audio_stop();
+            return 1;
+        }
+    }
+    else if (journal_open(JOURNAL_DEFAULT_FILE) != 0)
+    {
+        printf("Carrying on without a journal\n");
+    }
+
+    // Carry on at normal priority if the locking fails
+    if (realtime)
+        rt_enable();
+
+    // Run the dialer, it handles SIGINT and SIGTERM itself
+    int ret = run_dialer(dial_cb);
+    audio_stop();
+    journal_close();
+    shutdown_done();
+
+    printf("Bye!\n");
+    return ret;
 }
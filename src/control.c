@@ -0,0 +1,419 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "control.h"
+#include "dialer.h"
+#include "lighting.h"
+#include "registry.h"
+#include "telemetry.h"
+
+// u16 length, opcode, status, commands applied
+#define CONTROL_ACK_SIZE 5
+
+typedef struct {
+    int fd;
+} control_client_t;
+
+// An injected digit waiting for its batch to land
+typedef struct {
+    unsigned batch;
+    int digit;
+} control_digit_t;
+
+static int listen_fd = -1;
+static char socket_path[sizeof(((struct sockaddr_un*) 0)->sun_path)];
+static control_client_t clients[CONTROL_MAX_CLIENTS];
+
+// One packet at a time, each is read and answered before the next
+static uint8_t packet[CONTROL_BUFFER];
+
+// Injected digits are dialed when their batch lands rather than when it is
+// posted, so they go in with the rest of it. The lighting thread pokes
+// landed_fd and the input loop dials them, the dialer is only touched
+// from there.
+static control_digit_t pending[LIGHTING_MAX_BATCH];
+static int pending_count = 0;
+static unsigned batches_posted = 0;
+static int landed_fd = -1;
+
+// Replies for one batch are gathered here and sent as one packet
+static uint8_t reply[CONTROL_BUFFER];
+static int reply_len;
+static bool reply_full;
+
+
+static uint16_t get_u16(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static int32_t get_i32(const uint8_t* p)
+{
+    return (int32_t) ((uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24));
+}
+
+static void put_u8(uint8_t value)
+{
+    if (reply_len < CONTROL_BUFFER)
+        reply[reply_len++] = value;
+    else
+        reply_full = true;
+}
+
+static void put_u32(uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        put_u8(value >> (8 * i));
+}
+
+static void put_u64(uint64_t value)
+{
+    for (int i = 0; i < 8; i++)
+        put_u8(value >> (8 * i));
+}
+
+// Frame header, the length is patched by end_reply
+static int begin_reply(uint8_t opcode)
+{
+    int start = reply_len;
+    put_u8(0);
+    put_u8(0);
+    put_u8(opcode);
+    return start;
+}
+
+static void end_reply(int start)
+{
+    // The header itself may not have fit, the replies are dropped anyway
+    if (reply_full)
+        return;
+
+    int length = reply_len - start - 2;
+    reply[start] = length & 0xff;
+    reply[start + 1] = length >> 8;
+}
+
+static void reply_state()
+{
+    dialer_state_t state;
+    dialer_state(&state);
+
+    int start = begin_reply(CONTROL_STATE);
+    put_u8(state.dialing);
+    put_u8(state.pulses);
+    put_u8((uint8_t) (int8_t) lighting_current());
+    put_u8(registry_count());
+    put_u32(state.digits_dialed);
+    put_u8(state.recent_count);
+    for (int i = 0; i < state.recent_count; i++)
+        put_u8(state.recent[i]);
+    end_reply(start);
+}
+
+static void reply_stats()
+{
+    int start = begin_reply(CONTROL_STATS);
+    put_u8(TELEMETRY_METRICS);
+    for (int i = 0; i < TELEMETRY_METRICS; i++)
+        put_u64(telemetry_get(i));
+    end_reply(start);
+}
+
+static void reply_ack(int status, int applied)
+{
+    int start = begin_reply(CONTROL_ACK);
+    put_u8(status);
+    put_u8(applied);
+    end_reply(start);
+}
+
+// Parse one command into the batch. Returns false if it is malformed.
+static bool parse_command(const uint8_t* cmd, int length, lighting_cmd_t* batch, int* count,
+                          int* digits, int* num_digits)
+{
+    if (length < 1)
+        return false;
+
+    uint8_t opcode = cmd[0];
+    const uint8_t* args = cmd + 1;
+    int nargs = length - 1;
+
+    switch (opcode)
+    {
+        case CONTROL_TRIGGER_EFFECT:
+            if (nargs != 3 || args[0] >= registry_count() || *count >= LIGHTING_MAX_BATCH)
+                return false;
+            batch[(*count)++] = (lighting_cmd_t) { LIGHTING_CMD_EFFECT, args[0], get_u16(args + 1) };
+            return true;
+
+        case CONTROL_INJECT_DIGITS:
+            if (nargs < 1 || nargs != 1 + args[0] || *count + args[0] > LIGHTING_MAX_BATCH)
+                return false;
+            for (int i = 0; i < args[0]; i++)
+            {
+                if (args[1 + i] > 9)
+                    return false;
+                digits[(*num_digits)++] = args[1 + i];
+                batch[(*count)++] = (lighting_cmd_t) { LIGHTING_CMD_DIGIT, args[1 + i], 0 };
+            }
+            return true;
+
+        case CONTROL_SET_PARAM:
+            if (nargs != 5 || *count >= LIGHTING_MAX_BATCH)
+                return false;
+            if (args[0] == CONTROL_PARAM_BRIGHTNESS)
+                batch[(*count)++] = (lighting_cmd_t) { LIGHTING_CMD_BRIGHTNESS, 0, get_i32(args + 1) & 0xff };
+            else if (args[0] == CONTROL_PARAM_SEED)
+                batch[(*count)++] = (lighting_cmd_t) { LIGHTING_CMD_SEED, 0, get_i32(args + 1) };
+            else if (args[0] == CONTROL_PARAM_POWER_BUDGET && get_i32(args + 1) >= 0)
+                batch[(*count)++] = (lighting_cmd_t) { LIGHTING_CMD_POWER_BUDGET, 0, get_i32(args + 1) };
+            else if (args[0] == CONTROL_PARAM_TRANSITION_MS && get_i32(args + 1) >= 0)
+                batch[(*count)++] = (lighting_cmd_t) { LIGHTING_CMD_TRANSITION, 0, get_i32(args + 1) };
+            else
+                return false;
+            return true;
+
+        case CONTROL_QUERY_STATE:
+            if (nargs != 0)
+                return false;
+            reply_state();
+            return true;
+
+        case CONTROL_QUERY_STATS:
+            if (nargs != 0)
+                return false;
+            reply_stats();
+            return true;
+    }
+
+    return false;
+}
+
+// Dial the digits whose batch has landed, in the order they were sent
+static void dial_landed()
+{
+    unsigned landed = lighting_batches_landed();
+    int done = 0;
+
+    while (done < pending_count && (int) (landed - pending[done].batch) >= 0)
+        dialer_inject(pending[done++].digit);
+
+    memmove(pending, pending + done, (pending_count - done) * sizeof(pending[0]));
+    pending_count -= done;
+}
+
+// Lighting thread, with the lighting lock held
+static void on_batch_landed()
+{
+    uint64_t one = 1;
+    if (write(landed_fd, &one, sizeof(one)) < 0)
+        return;
+}
+
+static void on_landed(int fd, void* data)
+{
+    uint64_t value;
+    if (read(fd, &value, sizeof(value)) < 0)
+        return;
+
+    dial_landed();
+}
+
+static void close_client(control_client_t* client)
+{
+    dialer_unwatch(client->fd);
+    close(client->fd);
+    client->fd = -1;
+}
+
+// The packet is one batch, a command cut off at its end makes it malformed
+static void process(control_client_t* client, int used)
+{
+    static lighting_cmd_t batch[LIGHTING_MAX_BATCH];
+    static int digits[LIGHTING_MAX_BATCH];
+    int count = 0;
+    int num_digits = 0;
+    int status = CONTROL_OK;
+    int offset = 0;
+
+    reply_len = 0;
+    reply_full = false;
+    dial_landed();
+
+    // Bigger than the buffer, the rest of it was cut off
+    if (used > CONTROL_BUFFER)
+        status = CONTROL_MALFORMED;
+
+    while (status == CONTROL_OK && offset < used)
+    {
+        if (used - offset < 2)
+        {
+            status = CONTROL_MALFORMED;
+            break;
+        }
+
+        int length = get_u16(packet + offset);
+        if (used - offset - 2 < length
+            || !parse_command(packet + offset + 2, length, batch, &count, digits, &num_digits))
+            status = CONTROL_MALFORMED;
+
+        offset += 2 + length;
+    }
+
+    // Too many queries to answer in one packet along with the ACK
+    if (reply_full || reply_len > CONTROL_BUFFER - CONTROL_ACK_SIZE)
+    {
+        status = CONTROL_MALFORMED;
+        reply_len = 0;
+        reply_full = false;
+    }
+
+    // All or nothing, a bad command drops the whole batch and one that
+    // doesn't fit waits for none of it to be applied
+    if (status == CONTROL_OK && count > 0
+        && (pending_count + num_digits > LIGHTING_MAX_BATCH || lighting_post_batch(batch, count) != 0))
+        status = CONTROL_BUSY;
+
+    if (status == CONTROL_OK && count > 0)
+    {
+        batches_posted++;
+        for (int i = 0; i < num_digits; i++)
+            pending[pending_count++] = (control_digit_t) { batches_posted, digits[i] };
+    }
+
+    reply_ack(status, status == CONTROL_OK ? count : 0);
+
+    // A packet goes out whole or not at all. A client that has stopped
+    // reading its replies gets no more, rather than missing some.
+    if (send(client->fd, reply, reply_len, MSG_DONTWAIT | MSG_NOSIGNAL) != reply_len)
+        close_client(client);
+}
+
+static void on_client(int fd, void* data)
+{
+    control_client_t* client = data;
+
+    // MSG_TRUNC gives the whole length of a packet too big for the buffer
+    ssize_t n = recv(fd, packet, CONTROL_BUFFER, MSG_TRUNC);
+    if (n <= 0)
+    {
+        if (n == 0 || (errno != EAGAIN && errno != EINTR))
+            close_client(client);
+        return;
+    }
+
+    process(client, n);
+}
+
+static void on_accept(int fd, void* data)
+{
+    int client_fd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client_fd < 0)
+        return;
+
+    for (int i = 0; i < CONTROL_MAX_CLIENTS; i++)
+    {
+        if (clients[i].fd >= 0)
+            continue;
+
+        clients[i].fd = client_fd;
+        if (dialer_watch(client_fd, on_client, &clients[i]) != 0)
+        {
+            clients[i].fd = -1;
+            break;
+        }
+
+        return;
+    }
+
+    telemetry_log("control: turning away client, no free slots");
+    close(client_fd);
+}
+
+// Must be called from inside the dialer loop setup, after the loop exists
+int control_start(const char* path)
+{
+    for (int i = 0; i < CONTROL_MAX_CLIENTS; i++)
+        clients[i].fd = -1;
+
+    struct sockaddr_un addr = {
+        .sun_family = AF_UNIX,
+    };
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        printf("Control socket path too long: %s\n", path);
+        return 1;
+    }
+    strcpy(addr.sun_path, path);
+    strcpy(socket_path, path);
+
+    landed_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (landed_fd < 0 || dialer_watch(landed_fd, on_landed, NULL) != 0)
+    {
+        printf("Unable to watch for landed batches: %s\n", strerror(errno));
+        if (landed_fd >= 0)
+            close(landed_fd);
+        landed_fd = -1;
+        return 1;
+    }
+    lighting_set_batch_hook(on_batch_landed);
+
+    listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0)
+    {
+        printf("Unable to create control socket: %s\n", strerror(errno));
+        control_stop();
+        return 1;
+    }
+
+    // A stale socket from a previous run would make bind fail
+    unlink(path);
+
+    if (bind(listen_fd, (struct sockaddr*) &addr, sizeof(addr)) != 0
+        || listen(listen_fd, CONTROL_MAX_CLIENTS) != 0
+        || dialer_watch(listen_fd, on_accept, NULL) != 0)
+    {
+        printf("Unable to listen on %s: %s\n", path, strerror(errno));
+        control_stop();
+        return 1;
+    }
+
+    return 0;
+}
+
+// Also undoes a control_start that failed part way
+void control_stop()
+{
+    if (landed_fd < 0)
+        return;
+
+    // Digits whose batch never landed are never dialed
+    lighting_set_batch_hook(NULL);
+    dialer_unwatch(landed_fd);
+    close(landed_fd);
+    landed_fd = -1;
+    pending_count = 0;
+
+    for (int i = 0; i < CONTROL_MAX_CLIENTS; i++)
+    {
+        if (clients[i].fd >= 0)
+            close_client(&clients[i]);
+    }
+
+    if (listen_fd >= 0)
+    {
+        dialer_unwatch(listen_fd);
+        close(listen_fd);
+        listen_fd = -1;
+        unlink(socket_path);
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef __CONTROL_H__
+#define __CONTROL_H__
+
+// Local control socket. Clients connect to a UNIX SOCK_SEQPACKET socket and
+// send packets of length-prefixed binary commands, all integers
+// little-endian:
+//
+//   u16 length    bytes that follow, opcode included
+//   u8  opcode
+//   ... payload
+//
+// Each packet is one batch: the changes in it are applied together at the
+// next frame boundary. A packet that doesn't end on a command boundary, or
+// is bigger than CONTROL_BUFFER, is malformed. Each batch is answered with
+// a packet holding the replies to its queries, in the order they were
+// sent, and then an ACK. A batch with more queries than that packet can
+// hold is malformed, and a client that doesn't read its replies is
+// disconnected once they no longer fit in its socket.
+#define CONTROL_MAX_CLIENTS 4
+#define CONTROL_BUFFER 4096
+
+// u8 effect index in the registry, u16 duration in milliseconds. Only
+// sweeps follow the duration, strobes and twinkles run their own length.
+#define CONTROL_TRIGGER_EFFECT 0x01
+// u8 count, then count digits, each dialed as if by hand
+#define CONTROL_INJECT_DIGITS 0x02
+// u8 parameter, i32 value
+#define CONTROL_SET_PARAM 0x03
+// no payload, answered with CONTROL_STATE
+#define CONTROL_QUERY_STATE 0x10
+// no payload, answered with CONTROL_STATS
+#define CONTROL_QUERY_STATS 0x11
+
+// u8 status, u8 commands applied
+#define CONTROL_ACK 0x80
+// u8 dialing, u8 pulses, i8 current effect (-1 idle, -2 dial), u8 effect
+// count, u32 digits dialed, u8 recent count, then recent digits oldest first
+#define CONTROL_STATE 0x81
+// u8 count, then count i64 values in telemetry order
+#define CONTROL_STATS 0x82
+
+#define CONTROL_PARAM_BRIGHTNESS 0x01
+#define CONTROL_PARAM_SEED 0x02
+// milliamps the strip may draw, 0 for no limit
+#define CONTROL_PARAM_POWER_BUDGET 0x03
+// milliseconds effects crossfade for, 0 to cut straight over
+#define CONTROL_PARAM_TRANSITION_MS 0x04
+
+#define CONTROL_OK 0
+#define CONTROL_MALFORMED 1
+#define CONTROL_BUSY 2
+
+int control_start(const char* path);
+void control_stop();
+
+#endif
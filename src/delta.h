@@ -0,0 +1,41 @@
+#ifndef __DELTA_H__
+#define __DELTA_H__
+
+#include <stdint.h>
+
+#include <ws2811.h>
+
+#include "geometry.h"
+
+// The strip pixels changed since the last frame went out, and what each of
+// them showed in that frame. Work done per pixel on every frame only has to
+// look at these when a frame comes with one, however long the strip is.
+typedef struct {
+    int count;
+    uint16_t pixel[GEOMETRY_MAX_PIXELS];
+    ws2811_led_t was[GEOMETRY_MAX_PIXELS];
+    uint8_t marked[GEOMETRY_MAX_PIXELS];
+} pixel_delta_t;
+
+// Call before the pixel changes, only the first change keeps what it was
+static inline void delta_mark(pixel_delta_t* d, int pixel, ws2811_led_t was)
+{
+    if (d->marked[pixel])
+        return;
+
+    d->marked[pixel] = 1;
+    d->pixel[d->count] = pixel;
+    d->was[d->count] = was;
+    d->count++;
+}
+
+// Once the frame has gone out
+static inline void delta_clear(pixel_delta_t* d)
+{
+    for (int i = 0; i < d->count; i++)
+        d->marked[d->pixel[i]] = 0;
+
+    d->count = 0;
+}
+
+#endif
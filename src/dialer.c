@@ -1,236 +1,585 @@
-#include <pthread.h>
+#include <errno.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
-#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 
-#include <wiringPi.h>
-#include <ws2811.h>
-
+#include "control.h"
 #include "dialer.h"
-#include "effects.h"
+#include "dialstats.h"
+#include "gpio.h"
+#include "journal.h"
+#include "lighting.h"
+#include "rt.h"
+#include "sampler.h"
+#include "shutdown.h"
+#include "telemetry.h"
 
 #define DIALER_CONTROL_PIN 2
 #define DIALER_SIGNAL_PIN 3
-#define DIALER_COUNT_LOCK 0
-#define DIALER_SWEEP_LOCK 1
-#define DIALER_DIGITS_LOCK 2
 
-#define DIAL_OFF HIGH
-#define DIAL_ON LOW
+#define DIAL_OFF 1
+#define DIAL_ON 0
+
+// Bits in the sampler, in the order the pins are read
+#define SAMPLE_CONTROL 0
+#define SAMPLE_SIGNAL 1
+
+#define DIALER_MAX_WATCHES 8
+#define DIALER_MAX_EVENTS 8
 
-#define LED_SIGNAL_PIN 21
-#define LED_DEFAULT_BRIGHTNESS 50
-#define LED_NUM_PIXELS 43
-#define LED_FREQ_HZ 1000000
+// A dial that stays off the stop this long is stuck, not being dialed
+#define DIAL_TIMEOUT_SEC 10
 
 
-// Global state
-bool running = true;
-bool dial_sweep_active = false;
+// Anything else that wants to be woken by the input loop
+typedef struct {
+    int fd;
+    dialer_fd_cb_t cb;
+    void* data;
+} dialer_watch_t;
+
+// Global state, only touched from the input loop unless noted
+static dialer_cb_t on_digit;
+static const char* control_path = NULL;
+static dialer_input_t input = DIALER_INPUT_EDGES;
 
 // State for the actual dial
-int pulse_count = 0;
-int dial_start;
-int* digits;
-int num_digits;
-int digits_idx;
+static bool dialing = false;
+static int pulse_count = 0;
+
+// Rising edges a pulse shows up as, interrupts see two but sampled input
+// is already debounced to one
+static int edges_per_pulse = 2;
+
+// Kernel timestamp of the last control pin edge taken, with interrupts
+static int64_t control_edge_ns = 0;
+
+static sampler_t sampler;
+static int digits[DIALER_MAX_DIGITS];
+static int digits_idx;
+
+// Event sources
+static int epoll_fd = -1;
+static int control_fd = -1;
+static int signal_fd = -1;
+static int inputs_fd = -1;
+static int sample_fd = -1;
+static int timeout_fd = -1;
+static int shutdown_fd = -1;
+static int wake_fd = -1;
+
+static dialer_watch_t watches[DIALER_MAX_WATCHES];
+static int num_watches = 0;
+
+#ifdef ALLOC_HOOKS
+// Heap allocations counted at the end of the last dial, or at the start of
+// the first one. The highlight runs on the lighting thread after
+// dial_end(), so a cycle is counted through to the end of the next dial.
+// Any cycle that allocates fails the check.
+static int64_t cycle_allocs = -1;
+static bool alloc_failed = false;
+#endif
+
+
+static int add_fd(int fd, void* tag)
+{
+    struct epoll_event ev = {
+        .events = EPOLLIN,
+        .data.ptr = tag,
+    };
 
-// Neopixel struct
-ws2811_t* np = NULL;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
 
-// Separate thread to run the sweep effect while we count pulses
-pthread_t lighting_thread;
+// How the dial is read, set before run_dialer
+void dialer_set_input(dialer_input_t mode)
+{
+    input = mode;
+}
 
+// Serve the control socket at this path once the loop is running
+void dialer_set_control_path(const char* path)
+{
+    control_path = path;
+}
 
-// ISR callback for the signal pin
-void on_signal_pulse()
+int dialer_watch(int fd, dialer_fd_cb_t cb, void* data)
 {
-    // FIXME: should we deactivate the dial sweep here?
-    piLock(DIALER_COUNT_LOCK);
-    pulse_count++;
-    piUnlock(DIALER_COUNT_LOCK);
+    // Reuse a free slot first, epoll holds pointers so slots never move
+    dialer_watch_t* w = NULL;
+    for (int i = 0; i < num_watches; i++)
+    {
+        if (watches[i].fd < 0)
+        {
+            w = &watches[i];
+            break;
+        }
+    }
+
+    if (w == NULL)
+    {
+        if (num_watches == DIALER_MAX_WATCHES)
+            return 1;
+        w = &watches[num_watches++];
+    }
+
+    w->fd = fd;
+    w->cb = cb;
+    w->data = data;
+
+    if (add_fd(fd, w) != 0)
+    {
+        w->fd = -1;
+        return 1;
+    }
+
+    return 0;
 }
 
-void reset_pulse_count()
+void dialer_unwatch(int fd)
 {
-    piLock(DIALER_COUNT_LOCK);
-    pulse_count = 0;
-    piUnlock(DIALER_COUNT_LOCK);
+    for (int i = 0; i < num_watches; i++)
+    {
+        if (watches[i].fd == fd)
+        {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+            watches[i].fd = -1;
+        }
+    }
 }
 
-void activate_dial_sweep()
+void store_digit(int digit)
 {
-    piLock(DIALER_SWEEP_LOCK);
-    dial_sweep_active = true;
-    piUnlock(DIALER_SWEEP_LOCK);
+    // Keep the most recent digits, oldest get overwritten
+    digits[digits_idx % DIALER_MAX_DIGITS] = digit;
+    digits_idx++;
 }
 
-void deactivate_dial_sweep()
+void reset_digits()
 {
-    piLock(DIALER_SWEEP_LOCK);
-    dial_sweep_active = false;
-    piUnlock(DIALER_SWEEP_LOCK);
+    digits_idx = 0;
 }
 
-bool is_dial_sweep_active()
+// A digit that arrived some other way than the dial, e.g. the control socket
+void dialer_inject(int digit)
 {
-    return dial_sweep_active;
+    journal_record_t record = {
+        .type = JOURNAL_INJECTED,
+        .digit = digit,
+        .effect = -1,
+    };
+
+    journal_append(&record);
+    store_digit(digit);
+    on_digit(digit);
 }
 
-int init_lighting()
+void dialer_state(dialer_state_t* state)
 {
-    np = (ws2811_t*) malloc(sizeof(ws2811_t));
-    if (np == NULL)
-        return 1;
+    state->dialing = dialing;
+    state->pulses = pulse_count / edges_per_pulse;
+    state->digits_dialed = digits_idx;
+    state->recent_count = digits_idx < DIALER_MAX_DIGITS ? digits_idx : DIALER_MAX_DIGITS;
+
+    for (int i = 0; i < state->recent_count; i++)
+        state->recent[i] = digits[(digits_idx - state->recent_count + i) % DIALER_MAX_DIGITS];
+}
 
-    // Initialize
-    np->render_wait_time = 0;
-    np->freq = LED_FREQ_HZ;
-    np->dmanum = 10;
-    np->channel[0] = (ws2811_channel_t) {
-       .gpionum = LED_SIGNAL_PIN,
-       .count = LED_NUM_PIXELS,
-       .invert = 0,
-       .brightness = LED_DEFAULT_BRIGHTNESS,
-       .strip_type = WS2811_STRIP_GRB,
+static void arm_timeout(int seconds)
+{
+    struct itimerspec spec = {
+        .it_value.tv_sec = seconds,
     };
+    timerfd_settime(timeout_fd, 0, &spec, NULL);
+}
 
-    // Initialize and clear
-    ws2811_init(np);
-    effect_clear(np);
+static void dial_begin()
+{
+    dialing = true;
+    pulse_count = 0;
+    dialstats_begin();
 
-    return 0;
+#ifdef ALLOC_HOOKS
+    if (cycle_allocs < 0)
+        cycle_allocs = telemetry_get(TELEMETRY_HEAP_ALLOCS);
+#endif
+
+    arm_timeout(DIAL_TIMEOUT_SEC);
+    lighting_dial_begin();
 }
 
-// pthread target
-void *run_dial_sweep_effect(void* ptr)
+static void dial_end(bool timed_out)
 {
-    random_sweep_effect(np, is_dial_sweep_active);
-    effect_clear(np);
-    return ptr;
+    dialing = false;
+    arm_timeout(0);
+
+    // Each real pulse shows up as two rising edges, zero is an error, and a
+    // stuck dial doesn't get to dial anything
+    int pulses = timed_out ? 0 : pulse_count / edges_per_pulse;
+
+    lighting_dial_pulses(pulses);
+    lighting_dial_end();
+
+    if (pulses > 0)
+    {
+        int digit = pulses % 10;
+
+        journal_record_t record = {
+            .type = JOURNAL_DIAL,
+            .digit = digit,
+            .pulses = pulses,
+            .effect = lighting_dial_effect(),
+        };
+
+        dialstats_dial_t stats;
+        if (dialstats_end(digit, pulses, &stats))
+        {
+            record.rate_cpps = stats.rate_milli / 10;
+            record.break_pct = stats.break_pct;
+            record.jitter_us = stats.jitter_us;
+        }
+
+        journal_append(&record);
+        lighting_dial_rate(dialstats_rate_milli());
+
+        store_digit(digit);
+        on_digit(digit);
+        printf("Ready for dial...\n");
+    }
+
+#ifdef ALLOC_HOOKS
+    int64_t allocs = telemetry_get(TELEMETRY_HEAP_ALLOCS);
+    telemetry_log("dial cycle heap allocations: %lld", (long long) (allocs - cycle_allocs));
+
+    if (allocs != cycle_allocs)
+    {
+        telemetry_log("ALLOC CHECK FAILED: the dial cycle allocated, the steady state should make none");
+        alloc_failed = true;
+    }
+
+    cycle_allocs = allocs;
+#endif
+}
+
+// When the gate is low (open), we're dialing
+static void control_edge(bool rising)
+{
+    if (!rising && !dialing)
+        dial_begin();
+    else if (rising && dialing)
+        dial_end(false);
 }
 
-void cleanup_lighting()
+// Both edges go to the statistics, only rising ones count as pulses
+static void signal_edge(int64_t timestamp, bool rising)
 {
-    effect_clear(np);
-    ws2811_fini(np);
+    if (dialing)
+        dialstats_edge(timestamp, rising);
 
-    if (np != NULL)
-        free(np);
+    if (rising)
+        pulse_count++;
 }
 
-int init_dialer()
+static void post_pulses()
 {
-    dial_start = -1;
-    digits_idx = 0;
-    num_digits = 32;
-    digits = (int *) malloc(num_digits * sizeof(int));
+    if (dialing)
+    {
+        lighting_dial_pulses(pulse_count / edges_per_pulse);
+        lighting_dial_rate(dialstats_rate_milli());
+    }
+}
 
-    wiringPiSetupGpio();
+static void on_signal_event();
 
-    pinMode(DIALER_CONTROL_PIN, INPUT);
-    pinMode(DIALER_SIGNAL_PIN, INPUT);
+static void on_control_event()
+{
+    // Count any pulses still queued before deciding the dial is done
+    on_signal_event();
 
-    // Setup the callback
-    wiringPiISR(DIALER_SIGNAL_PIN, INT_EDGE_RISING, on_signal_pulse);
+    // An edge that moves the gate is taken, anything that follows it
+    // closer than the bounce time is contact bounce, even when the bounce
+    // arrives over several wakeups
+    gpio_event_t event;
 
-    return 0;
+    while (gpio_read_event(control_fd, &event) > 0)
+    {
+        if (event.rising != dialing)
+            continue;
+        if (control_edge_ns != 0 && event.timestamp - control_edge_ns < DIALSTATS_BOUNCE_NS)
+            continue;
+
+        control_edge_ns = event.timestamp;
+        control_edge(event.rising);
+    }
 }
 
-void store_digit(int digit)
+static void on_signal_event()
+{
+    gpio_event_t event;
+
+    while (gpio_read_event(signal_fd, &event) > 0)
+        signal_edge(event.timestamp, event.rising);
+
+    post_pulses();
+}
+
+// Sampled input: one read of both pins per tick. A late tick still takes a
+// single sample, the integrator just settles a little later.
+static void on_sample()
 {
-    piLock(DIALER_DIGITS_LOCK);
+    uint64_t expirations;
+    if (read(sample_fd, &expirations, sizeof(expirations)) < 0)
+        return;
+
+    if (expirations > 1)
+        telemetry_add(TELEMETRY_INPUT_OVERRUNS, expirations - 1);
+
+    uint8_t levels[2];
+    if (gpio_get_values(inputs_fd, levels, 2) != 0)
+        return;
 
-    // Check for the need to expand
-    if (digits_idx == num_digits-1)
+    uint32_t changed = sampler_update(&sampler, levels);
+    if (changed == 0)
+        return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t timestamp = (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+
+    // Pulses before the gate, as with interrupts
+    if (changed & (1u << SAMPLE_SIGNAL))
     {
-        //num_digits *= 2;
-        //digits = (int*) realloc(num_digits * sizeof(int));
+        signal_edge(timestamp, sampler_level(&sampler, SAMPLE_SIGNAL));
+        post_pulses();
     }
 
-    digits[digits_idx] = digit;
-    digits_idx++;
+    if (changed & (1u << SAMPLE_CONTROL))
+        control_edge(sampler_level(&sampler, SAMPLE_CONTROL));
+}
 
-    piUnlock(DIALER_DIGITS_LOCK);
+static void on_timeout()
+{
+    uint64_t expirations;
+    if (read(timeout_fd, &expirations, sizeof(expirations)) < 0)
+        return;
+
+    if (dialing)
+    {
+        telemetry_log("dial timed out after %d seconds", DIAL_TIMEOUT_SEC);
+        dial_end(true);
+    }
 }
 
-void reset_digits()
+static void on_shutdown()
+{
+    struct signalfd_siginfo info;
+    if (read(shutdown_fd, &info, sizeof(info)) == sizeof(info))
+        telemetry_log("caught signal %d, shutting down", (int) info.ssi_signo);
+
+    shutdown_begin();
+}
+
+static int init_sampled(int* control_level)
+{
+    const int pins[] = { DIALER_CONTROL_PIN, DIALER_SIGNAL_PIN };
+    uint8_t levels[2];
+
+    inputs_fd = gpio_open_inputs(pins, 2);
+    if (inputs_fd < 0 || gpio_get_values(inputs_fd, levels, 2) != 0)
+        return 1;
+
+    sampler_init(&sampler, 2, levels);
+    edges_per_pulse = 1;
+    *control_level = levels[SAMPLE_CONTROL];
+
+    struct itimerspec spec = {
+        .it_interval.tv_nsec = SAMPLER_PERIOD_NS,
+        .it_value.tv_nsec = SAMPLER_PERIOD_NS,
+    };
+
+    sample_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (sample_fd < 0 || timerfd_settime(sample_fd, 0, &spec, NULL) != 0)
+    {
+        printf("Unable to start sampling the dial: %s\n", strerror(errno));
+        return 1;
+    }
+
+    add_fd(sample_fd, &sample_fd);
+    return 0;
+}
+
+static int init_dialer()
 {
-    piLock(DIALER_DIGITS_LOCK);
     digits_idx = 0;
-    //memset(digits, 0, num_digits * sizeof(int));
-    piUnlock(DIALER_DIGITS_LOCK);
+
+    // Shutdown signals reach the loop through a signalfd, main has blocked
+    // them in every thread already
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    shutdown_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    timeout_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd < 0 || shutdown_fd < 0 || timeout_fd < 0 || wake_fd < 0)
+    {
+        printf("Unable to create dialer event sources: %s\n", strerror(errno));
+        return 1;
+    }
+
+    // Tag each source with its own fd, watches carry their struct instead
+    add_fd(timeout_fd, &timeout_fd);
+    add_fd(shutdown_fd, &shutdown_fd);
+    add_fd(wake_fd, &wake_fd);
+
+    int control_level;
+    if (input == DIALER_INPUT_SAMPLED)
+    {
+        if (init_sampled(&control_level) != 0)
+            return 1;
+    }
+    else
+    {
+        control_fd = gpio_open_events(DIALER_CONTROL_PIN, GPIO_EDGE_BOTH);
+        signal_fd = gpio_open_events(DIALER_SIGNAL_PIN, GPIO_EDGE_BOTH);
+        if (control_fd < 0 || signal_fd < 0)
+            return 1;
+
+        add_fd(control_fd, &control_fd);
+        add_fd(signal_fd, &signal_fd);
+        control_level = gpio_get_value(control_fd);
+    }
+
+    // Maybe we started with the dial already off the stop
+    if (control_level == DIAL_ON)
+        dial_begin();
+
+    return 0;
+}
+
+static void cleanup_dialer()
+{
+    int* fds[] = { &control_fd, &signal_fd, &inputs_fd, &sample_fd, &timeout_fd, &shutdown_fd, &wake_fd, &epoll_fd };
+
+    for (int i = 0; i < (int) (sizeof(fds) / sizeof(fds[0])); i++)
+    {
+        if (*fds[i] >= 0)
+            close(*fds[i]);
+        *fds[i] = -1;
+    }
 }
 
 int run_dialer(dialer_cb_t dialer_cb)
 {
+    on_digit = dialer_cb;
+
     if (init_dialer() != 0)
     {
         printf("Failed to initialize dialer...\n");
+        cleanup_dialer();
         return 1;
     }
 
     // Initialize the lighting
-    if (init_lighting() != 0)
+    if (lighting_start() != 0)
     {
         printf("Failed to initialize lighting\n");
+        cleanup_dialer();
         return 1;
     }
 
-    // Need a pthread target
-    pthread_t effect_thread;
-    deactivate_dial_sweep();
+    if (control_path != NULL && control_start(control_path) != 0)
+    {
+        lighting_stop();
+        cleanup_dialer();
+        return 1;
+    }
+
+    rt_thread(RT_ROLE_INPUT);
 
     printf("Ready for dial...\n");
 
-    while (running)
+    // Everything the badge reacts to arrives here, nothing in this loop
+    // sleeps or waits on the lighting thread
+    struct epoll_event events[DIALER_MAX_EVENTS];
+    while (!shutdown_requested())
     {
-        while (digitalRead(DIALER_CONTROL_PIN) == DIAL_OFF && running)
+        int n = epoll_wait(epoll_fd, events, DIALER_MAX_EVENTS, -1);
+        if (n < 0)
         {
-            // TODO: if this is idle for a long time, run a demo!
-            delay(5);
-            continue;
-        }
+            if (errno == EINTR)
+                continue;
 
-        // Do we need to quit?
-        if (!running)
+            printf("Dialer event loop failed: %s\n", strerror(errno));
             break;
+        }
 
-        // Run the lighting thread if this is the first detection
-        activate_dial_sweep();
-        pthread_create(&effect_thread, NULL, run_dial_sweep_effect, NULL);
-
-        // When the gate is low (open), we're dialing
-        while (digitalRead(DIALER_CONTROL_PIN) == DIAL_ON)
+        for (int i = 0; i < n; i++)
         {
-            delay(1);
-            continue;
+            void* tag = events[i].data.ptr;
+
+            if (tag == &sample_fd)
+                on_sample();
+            else if (tag == &signal_fd)
+                on_signal_event();
+            else if (tag == &control_fd)
+                on_control_event();
+            else if (tag == &timeout_fd)
+                on_timeout();
+            else if (tag == &shutdown_fd)
+                on_shutdown();
+            else if (tag == &wake_fd)
+            {
+                uint64_t value;
+                if (read(wake_fd, &value, sizeof(value)) < 0)
+                    continue;
+            }
+            else
+            {
+                // Could have been unwatched earlier in this batch
+                dialer_watch_t* w = tag;
+                if (w->fd >= 0)
+                    w->cb(w->fd, w->data);
+            }
         }
+    }
 
-        // Stop the dial sweep thread (todo: pthread_timedjoin_np)
-        deactivate_dial_sweep();
-        pthread_join(effect_thread, NULL);
+    // The loop can also end on an error, the deadline starts here either way
+    shutdown_begin();
 
-        // If the pulse count was zero, treat it as an error
-        if (pulse_count > 0)
-        {
-            int digit = (pulse_count / 2) % 10;
+    if (dialing)
+        dial_end(true);
 
-            dialer_cb(digit);
-            effect_dial_digit_highlight(np, digit);
-            printf("Ready for dial...\n");
-        }
-        reset_pulse_count();
+    control_stop();
+    lighting_stop();
+    cleanup_dialer();
+
+#ifdef ALLOC_HOOKS
+    if (alloc_failed)
+    {
+        printf("A dial cycle made heap allocations, see the log\n");
+        return 1;
     }
+#endif
 
     return 0;
 }
 
+// Safe from any thread, the loop notices on its next wakeup
 void stop_dialer()
 {
-    running = false;
-    cleanup_lighting();
+    shutdown_begin();
+
+    uint64_t one = 1;
+    if (wake_fd >= 0 && write(wake_fd, &one, sizeof(one)) < 0)
+        return;
 }
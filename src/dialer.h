@@ -6,7 +6,33 @@
 // Callback function typedef for when we find a digit
 typedef void (*dialer_cb_t)(int digit);
 
+#define DIALER_MAX_DIGITS 32
+
+typedef struct {
+    bool dialing;
+    int pulses;
+    int digits_dialed;
+    int recent_count;
+    int recent[DIALER_MAX_DIGITS];
+} dialer_state_t;
+
+// How the dial pins are read: edge interrupts from the kernel, or sampled
+// at SAMPLER_HZ and debounced
+typedef enum {
+    DIALER_INPUT_EDGES,
+    DIALER_INPUT_SAMPLED,
+} dialer_input_t;
+
+// Callback for extra fds watched by the dialer event loop
+typedef void (*dialer_fd_cb_t)(int fd, void* data);
+
 int run_dialer(dialer_cb_t cb);
 void stop_dialer();
+void dialer_set_control_path(const char* path);
+void dialer_set_input(dialer_input_t mode);
+int dialer_watch(int fd, dialer_fd_cb_t cb, void* data);
+void dialer_unwatch(int fd);
+void dialer_inject(int digit);
+void dialer_state(dialer_state_t* state);
 
 #endif
@@ -0,0 +1,143 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "dialstats.h"
+#include "telemetry.h"
+
+// Welford's running mean and variance
+typedef struct {
+    int64_t n;
+    double mean;
+    double m2;
+} welford_t;
+
+typedef struct {
+    welford_t rate;
+    welford_t break_pct;
+    welford_t jitter_us;
+} digit_stats_t;
+
+static void welford_add(welford_t* w, double x)
+{
+    w->n++;
+
+    double delta = x - w->mean;
+    w->mean += delta / w->n;
+    w->m2 += delta * (x - w->mean);
+}
+
+static double welford_stddev(const welford_t* w)
+{
+    return w->n > 1 ? sqrt(w->m2 / (w->n - 1)) : 0;
+}
+
+// The dial in progress. A pulse is a break (contacts open, line high)
+// followed by a make, and each break to break cycle is one period.
+static bool broken = false;
+static int64_t last_edge = 0;
+static int64_t break_at = 0;
+static int64_t make_at = 0;
+static int64_t break_total = 0;
+static int64_t make_total = 0;
+static int breaks = 0;
+static welford_t period;
+
+// Last complete rate, pulses per 1000 seconds, 0 until there is one. The
+// rate from before the dial comes back if the dial can't be trusted.
+static int rate_milli = 0;
+static int rate_before = 0;
+
+static digit_stats_t digits[10];
+
+void dialstats_begin()
+{
+    broken = false;
+    last_edge = 0;
+    break_at = 0;
+    make_at = 0;
+    break_total = 0;
+    make_total = 0;
+    breaks = 0;
+    period = (welford_t) { 0 };
+    rate_before = rate_milli;
+}
+
+void dialstats_edge(int64_t ns, bool rising)
+{
+    if (rising == broken || (last_edge != 0 && ns - last_edge < DIALSTATS_BOUNCE_NS))
+        return;
+
+    broken = rising;
+    last_edge = ns;
+
+    if (!rising)
+    {
+        make_at = ns;
+        return;
+    }
+
+    // A break that ends a full cycle, break then make then this
+    if (break_at != 0 && make_at > break_at)
+    {
+        break_total += make_at - break_at;
+        make_total += ns - make_at;
+        welford_add(&period, ns - break_at);
+
+        rate_milli = (int) (1e12 / period.mean);
+    }
+
+    break_at = ns;
+    breaks++;
+}
+
+// Fold the dial just finished into its digit and fill in out. Digits of a
+// single pulse have no full cycle and tell us nothing, and if the breaks
+// seen don't match the pulses decoded the timings are off too. Returns
+// false for both.
+bool dialstats_end(int digit, int pulses, dialstats_dial_t* out)
+{
+    if (breaks != pulses)
+    {
+        telemetry_log("digit %d: saw %d breaks for %d pulses, timings not used", digit, breaks, pulses);
+        rate_milli = rate_before;
+        return false;
+    }
+
+    if (digit < 0 || digit > 9 || period.n == 0)
+        return false;
+
+    double rate = 1e9 / period.mean;
+    double break_pct = 100.0 * break_total / (break_total + make_total);
+    double jitter_us = welford_stddev(&period) / 1000;
+
+    digit_stats_t* d = &digits[digit];
+    welford_add(&d->rate, rate);
+    welford_add(&d->break_pct, break_pct);
+    welford_add(&d->jitter_us, jitter_us);
+
+    telemetry_set(TELEMETRY_DIAL_RATE_MPPS, (int64_t) (rate * 1000));
+    telemetry_set(TELEMETRY_DIAL_BREAK_PCT, (int64_t) lround(break_pct));
+    telemetry_set(TELEMETRY_DIAL_JITTER_US, (int64_t) lround(jitter_us));
+
+    telemetry_log("digit %d: %.2f pulses/s, %.0f%% break, %.0f us jitter, over %lld dials %.2f +/- %.2f pulses/s, "
+                  "%.0f%% break, %.0f us jitter", digit, rate, break_pct, jitter_us, (long long) d->rate.n,
+                  d->rate.mean, welford_stddev(&d->rate), d->break_pct.mean, d->jitter_us.mean);
+
+    if (rate < DIALSTATS_MIN_PPS || rate > DIALSTATS_MAX_PPS
+        || break_pct < DIALSTATS_MIN_BREAK_PCT || break_pct > DIALSTATS_MAX_BREAK_PCT)
+        telemetry_log("dial out of spec, should be %d pulses/s and %.0f-%.0f%% break, may need servicing",
+                      DIALSTATS_NOMINAL_PPS, DIALSTATS_MIN_BREAK_PCT, DIALSTATS_MAX_BREAK_PCT);
+
+    out->rate_milli = (int) (rate * 1000);
+    out->break_pct = (int) lround(break_pct);
+    out->jitter_us = (int) lround(jitter_us);
+    return true;
+}
+
+// Pulses per 1000 seconds, live while the dial returns and from the last
+// dial otherwise. 0 if no dial has been measured yet.
+int dialstats_rate_milli()
+{
+    return rate_milli;
+}
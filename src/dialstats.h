@@ -0,0 +1,35 @@
+#ifndef __DIALSTATS_H__
+#define __DIALSTATS_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// A healthy dial returns at 10 pulses per second with the contacts broken
+// for about 60% of each pulse. Dials outside these bounds get a warning.
+#define DIALSTATS_NOMINAL_PPS 10
+#define DIALSTATS_MIN_PPS 8.0
+#define DIALSTATS_MAX_PPS 12.0
+#define DIALSTATS_MIN_BREAK_PCT 55.0
+#define DIALSTATS_MAX_BREAK_PCT 70.0
+
+// Edges closer than this to the last one are contact bounce
+#define DIALSTATS_BOUNCE_NS 3000000
+
+// Timing of one dial
+typedef struct {
+    int rate_milli;
+    int break_pct;
+    int jitter_us;
+} dialstats_dial_t;
+
+// Streaming statistics from the pulse contact edges, fed by the input loop
+// with the kernel's edge timestamps. Nothing is kept per pulse, every dial
+// and every digit is a running mean and variance, logged as each dial
+// finishes.
+void dialstats_begin();
+void dialstats_edge(int64_t ns, bool rising);
+bool dialstats_end(int digit, int pulses, dialstats_dial_t* out);
+
+int dialstats_rate_milli();
+
+#endif
@@ -1,14 +1,29 @@
+#include <limits.h>
 #include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <ws2811.h>
 
+#include "arena.h"
+#include "audio.h"
+#include "delta.h"
 #include "effects.h"
+#include "geometry.h"
+#include "noise.h"
+#include "palette.h"
+#include "particles.h"
+#include "power.h"
+#include "rng.h"
+#include "sink.h"
+#include "telemetry.h"
 
 
 #define MIN(a,b) (((a) > (b)) ? (b) : (a))
@@ -21,9 +36,57 @@
 #define STROBE_TICK (1000000 / STROBE_PHASE)
 #define STROBE_MAX (STROBE_PHASE)
 #define COMET_TRAIL_FACTOR 0.5
+#define FULL_MARKER_WIDTH 3
 #define TWINKLE_SPARSE_FACTOR 1
 #define TWINKLE_TICK ((TICK) * 5)
 
+// Frames later than this count as a missed deadline. Anything later than
+// FRAME_IDLE is the gap between two effects rather than a stall.
+#define FRAME_SLACK 1000
+#define FRAME_IDLE 1000000
+#define FRAME_LOG_INTERVAL 1000000
+
+// Longer sleeps are taken in slices so a stop is noticed within one
+#define FRAME_STOP_SLICE 10000
+#define TWINKLE_DECAY 0.34f
+#define TWINKLE_DURATION 5000000
+
+// Most frames an effect steps through at once after a stall
+#define CLOCK_MAX_STEP 4.0f
+
+// Particle effects. Densities are live particles per pixel, decays are life
+// lost per TICK, speeds are pixels per TICK whatever the real frame rate
+#define FIRE_DENSITY 6
+#define FIRE_DECAY_MIN 0.02f
+#define FIRE_DECAY_MAX 0.06f
+#define FIRE_DRIFT 0.06f
+#define EMBER_DENSITY 2
+#define EMBER_DECAY_MIN 0.005f
+#define EMBER_DECAY_MAX 0.015f
+#define EMBER_DRIFT 0.02f
+#define SPARKS_PER_FRAME 4
+#define SPARK_SPEED 1.5f
+#define SPARK_DECAY_MIN 0.08f
+#define SPARK_DECAY_MAX 0.2f
+
+// Audio reactive effects never dim below this level out of 256, step the
+// hue this many degrees on an onset, and the fire drops this many flames
+// per pixel in on one
+#define AUDIO_LEVEL_MIN 64
+#define AUDIO_ONSET_HUE 40
+#define FIRE_ONSET_BURST 2
+
+// Noise effects. Cells are noise lattice cells once round the ring, the
+// rates are microseconds for the field to move on by one cell, and they
+// fade out over NOISE_FADE_US once no longer active.
+#define NOISE_FADE_US 400000
+#define NOISE_FIRE_CELLS 6
+#define NOISE_FIRE_RATE 120000
+#define PLASMA_CELLS 3
+#define PLASMA_RATE 900000
+#define AURORA_CELLS 4
+#define AURORA_RATE 1500000
+
 int rgb2int(int r, int g, int b)
 {
     return (r << 16) | (g << 8) | b;
@@ -31,6 +94,129 @@ int rgb2int(int r, int g, int b)
 
 #define WHITE rgb2int(255,255,255)
 
+// All per-effect state lives here, sized once for the strip at startup
+static arena_t arena;
+
+// Shared by all particle effects on the lighting thread, only one effect
+// runs there at a time. Zone and transition layer threads bring their own.
+static particles_t pool;
+
+// Set on zone and transition layer threads, see effects_bind_zone()
+static __thread const int* pixel_map = NULL;
+static __thread frame_sync_func frame_sync = NULL;
+static __thread particles_t* thread_pool = NULL;
+
+// Set on transition layer threads, see effects_bind_cut()
+static __thread const atomic_bool* thread_cut = NULL;
+
+// What update_pixel() has changed since the calling thread's last frame,
+// and while a frame is being handed to frame_sync, the delta it came with
+static __thread pixel_delta_t changes;
+static __thread const pixel_delta_t* handed = NULL;
+
+int effects_init(int pixels)
+{
+    if (arena_init(&arena, particles_size(pixels)) != 0)
+        return 1;
+
+    palette_init();
+    noise_init();
+
+    return particles_init(&pool, &arena, pixels);
+}
+
+// Every effect seeds its own generator from this one, so a single call to
+// effects_seed() reproduces a whole run frame for frame
+static rng_t seed_rng = { .state = 1 };
+static pthread_mutex_t seed_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void effects_seed(uint32_t seed)
+{
+    pthread_mutex_lock(&seed_lock);
+    rng_seed(&seed_rng, seed);
+    pthread_mutex_unlock(&seed_lock);
+}
+
+// Zones start effects from several threads at once
+void effect_rng(rng_t* rng)
+{
+    pthread_mutex_lock(&seed_lock);
+    rng_seed(rng, rng_next32(&seed_rng));
+    pthread_mutex_unlock(&seed_lock);
+}
+
+// Run the calling thread's effects in a zone: ring positions go through map
+// instead of the geometry, frames are handed to sync instead of the strip,
+// and particle effects use their own pool. NULLs go back to normal.
+void effects_bind_zone(const int* map, frame_sync_func sync, particles_t* zone_pool)
+{
+    pixel_map = map;
+    frame_sync = sync;
+    thread_pool = zone_pool;
+}
+
+// Effects on the calling thread run out as if stopping once *cut is set,
+// NULL goes back to normal
+void effects_bind_cut(const atomic_bool* cut)
+{
+    thread_cut = cut;
+}
+
+static particles_t* effect_pool()
+{
+    return thread_pool != NULL ? thread_pool : &pool;
+}
+
+// When set and true, sweep effects skip their wind-down animation because
+// something more important (the digit highlight) wants the strip
+static active_func preempted = NULL;
+
+void effects_set_preempt(active_func func)
+{
+    preempted = func;
+}
+
+// Once stopping, every effect runs out straight away without drawing, on
+// every thread, so the lighting and zone threads can be joined quickly. A
+// cut does the same to the effects of one thread.
+static atomic_bool stopping = false;
+
+void effects_stop()
+{
+    atomic_store(&stopping, true);
+}
+
+static bool is_stopping()
+{
+    return atomic_load_explicit(&stopping, memory_order_relaxed)
+           || (thread_cut != NULL && atomic_load_explicit(thread_cut, memory_order_relaxed));
+}
+
+// Effects loop on this rather than on active alone, so they run out when
+// stopped or cut even if whatever they follow is still going
+static bool running(active_func active)
+{
+    return !is_stopping() && active();
+}
+
+bool is_preempted()
+{
+    return is_stopping() || (preempted != NULL && preempted());
+}
+
+// Sweep speed in 1/256 of one pixel per TICK, set to follow the dial
+static count_func speed = NULL;
+
+void effects_set_speed(count_func func)
+{
+    speed = func;
+}
+
+static int sweep_speed()
+{
+    return speed != NULL ? speed() : 256;
+}
+
 int hsv2rgb(int h, double s, double v)
 {
     h = fmod(h, 360);
@@ -88,9 +274,12 @@ int num_pixels(ws2811_t* np)
     return np->channel[0].count;
 }
 
+// Effects address ring positions, the geometry tables know which strip
+// pixel actually sits there
 void set_pixel(ws2811_t* np, int index, uint32_t value)
 {
-	np->channel[0].leds[index] = value;
+	int pixel = pixel_map != NULL ? pixel_map[index] : geometry_ring_pixel(index);
+	np->channel[0].leds[pixel] = value;
 }
 
 void set_all_pixels(ws2811_t* np, uint32_t color)
@@ -99,999 +288,1347 @@ void set_all_pixels(ws2811_t* np, uint32_t color)
         set_pixel(np, i, color);
 }
 
-int get_marker_width(ws2811_t* np)
+// set_pixel() for effects that change only a few pixels a frame and leave
+// the rest as they were. The pixel is noted when it really changes, and a
+// frame drawn only this way goes out with render_update().
+void update_pixel(ws2811_t* np, int index, uint32_t value)
 {
-    return (int) ((float) num_pixels(np) * COMET_TRAIL_FACTOR);
+    int pixel = pixel_map != NULL ? pixel_map[index] : geometry_ring_pixel(index);
+    ws2811_led_t* led = &np->channel[0].leds[pixel];
+
+    if (*led == value)
+        return;
+
+    delta_mark(&changes, pixel, *led);
+    *led = value;
 }
 
-void effect_clear(ws2811_t* np)
+// When the next frame is due, in microseconds on the monotonic clock
+static int64_t frame_deadline = 0;
+static int64_t frame_last_log = 0;
+static int frame_unlogged_misses = 0;
+
+// Time spent working rather than sleeping, from waking up for a frame to
+// the frame going out. Averaged per effect run to measure its cost. Kept
+// per thread, layer and zone threads measure the effects they run
+// themselves, from getting a frame back to handing over the next one.
+static __thread int64_t frame_woke = 0;
+static __thread int64_t frame_busy_total = 0;
+static __thread int frame_busy_frames = 0;
+
+// Stands in for the monotonic clock, so effects can be run faster than
+// real time with frames handed to a frame_sync_func
+static time_func clock_source = NULL;
+
+void effects_set_clock(time_func func)
 {
-    for (int i = 0; i < num_pixels(np); i++)
+    clock_source = func;
+}
+
+static int64_t monotonic_us()
+{
+    if (clock_source != NULL)
+        return clock_source();
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void sleep_until_us(int64_t deadline)
+{
+    int64_t wake = monotonic_us();
+
+    do
     {
-        set_pixel(np, i, 0);
-        ws2811_render(np);
-        usleep(TICK_CLEANUP);
+        wake = MIN(deadline, wake + FRAME_STOP_SLICE);
+
+        struct timespec ts = {
+            .tv_sec = wake / 1000000,
+            .tv_nsec = (wake % 1000000) * 1000,
+        };
+
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0)
+            continue;
     }
+    while (wake < deadline && !is_stopping());
 }
 
-void effect_comet_dial(ws2811_t* np, active_func active)
+static void frame_missed(int64_t now, int64_t late)
 {
-    int pixels = num_pixels(np);
-    int marker_width = get_marker_width(np);
+    telemetry_add(TELEMETRY_DEADLINE_MISSES, 1);
+    telemetry_max(TELEMETRY_WORST_LATENESS_US, late);
+
+    // Don't let the logging itself make the next frame late
+    frame_unlogged_misses++;
+    if (now - frame_last_log < FRAME_LOG_INTERVAL)
+        return;
+
+    telemetry_log("frame deadline missed by %lld us (%d misses since last report)",
+                  (long long) late, frame_unlogged_misses);
+    frame_last_log = now;
+    frame_unlogged_misses = 0;
+}
 
-    int sweep = 0;
-    int pos = 0;
+// Runs on the lighting thread just before every frame goes out, the one
+// place where outside changes can land without tearing a frame
+static frame_func frame_hook = NULL;
 
-    int color = rand();
-    double fade_step = 1.0 / marker_width;
+void effects_set_frame_hook(frame_func func)
+{
+    frame_hook = func;
+}
 
-    while (active())
+static void frame_busy(int64_t now)
+{
+    if (frame_woke == 0)
+        return;
+
+    frame_busy_total += now - frame_woke;
+    frame_busy_frames++;
+}
+
+// Show the frame, then sleep until the next one is due. Sleeping to an
+// absolute deadline keeps the render time from stretching every frame. The
+// delta is what changed since the last frame, NULL if anything might have.
+// The strip itself always gets the whole frame.
+void render_delta(ws2811_t* np, const pixel_delta_t* delta, int tick)
+{
+    if (is_stopping())
+        return;
+
+    if (frame_sync != NULL)
     {
-        // Draw all off pixels except the marker
-        set_all_pixels(np, 0);
+        frame_busy(monotonic_us());
+        handed = delta;
+        frame_sync(np, tick);
+        handed = NULL;
+        frame_woke = monotonic_us();
+        return;
+    }
 
-        // Now set the marker
-        double v = 1.0;
-        for (int i = 0; i < marker_width; i++)
-        {
-            if (pos - i < 0)
-                break;
+    if (frame_hook != NULL)
+        frame_hook(np);
 
-            set_pixel(np, (pos - i) % pixels, i == 0 ? WHITE : hsv2rgb(color, 1.0, v));
-            v -= fade_step;
-        }
+    power_limit_delta(np, delta);
+    ws2811_render(np);
+    sinks_publish(np);
+    telemetry_add(TELEMETRY_FRAMES, 1);
 
-        ws2811_render(np);
-        usleep(TICK);
+    int64_t now = monotonic_us();
+    int64_t late = now - frame_deadline;
 
-        pos++;
+    frame_busy(now);
 
-        if ((pos % pixels) == 0)
-        {
-            sweep++;
-        }
-    }
+    if (frame_deadline != 0 && late > FRAME_SLACK && late < FRAME_IDLE)
+        frame_missed(now, late);
 
-    // Cleanup animation, but adjust where the last position was and bound it
-    int end = pos + (pixels - (pos % pixels));
+    // Start over rather than rushing frames out to catch up
+    if (frame_deadline == 0 || late > tick)
+        frame_deadline = now;
 
-    for (; pos < end + marker_width; pos++)
-    {
-        // Draw all off pixels except the marker
-        set_all_pixels(np, 0);
+    frame_deadline += tick;
+    sleep_until_us(frame_deadline);
+    frame_woke = monotonic_us();
+}
 
-        // Now set the marker
-        double v = 1.0;
-        for (int i = 0; i < marker_width; i++)
-        {
-            if (pos - i < 0)
-                break;
-
-            if ((pos - i) < end)
-            {
-                set_pixel(np, (pos - i) % pixels, i == 0 ? WHITE : hsv2rgb(color, 1.0, v));
-                v -= fade_step;
-            }
-        }
+void render_frame(ws2811_t* np, int tick)
+{
+    render_delta(np, NULL, tick);
+    delta_clear(&changes);
+}
 
-        ws2811_render(np);
-        usleep(TICK);
-    }
+// Show a frame drawn with update_pixel() alone since the last one
+void render_update(ws2811_t* np, int tick)
+{
+    render_delta(np, &changes, tick);
+    delta_clear(&changes);
 }
 
-void effect_comet_color_cycle_dial(ws2811_t* np, active_func active)
+// For a frame_sync_func, what changed in the frame being handed to it, or
+// NULL when that isn't known
+const pixel_delta_t* frame_delta()
 {
-    int pixels = num_pixels(np);
-    int marker_width = get_marker_width(np);
+    return handed;
+}
 
-    int sweep = 0;
-    int pos = 0;
+// Start a fresh frame schedule, for when the strip has been idle
+void frame_reset()
+{
+    frame_deadline = 0;
+    frame_woke = monotonic_us();
+}
 
-    int color = rand();
-    double fade_step = 1.0 / marker_width;
+// Hold the current frame without it counting against the next deadline
+void frame_pause(int us)
+{
+    if (is_stopping())
+        return;
 
-    while (active())
+    if (frame_sync != NULL)
     {
-        // Draw all off pixels except the marker
-        set_all_pixels(np, 0);
-
-        // Now set the marker
-        int marker_color;
-        double v = 1.0;
+        frame_sync(NULL, us);
+        frame_woke = monotonic_us();
+        return;
+    }
 
-        for (int i = 0; i < marker_width; i++)
-        {
-            if (pos - i < 0)
-                break;
+    frame_deadline += us;
+    sleep_until_us(frame_deadline);
+    frame_woke = monotonic_us();
+}
 
-            marker_color = i == 0 ? WHITE : hsv2rgb(color, 1.0, v);
-            set_pixel(np, (pos - i) % pixels, marker_color);
-            v -= fade_step;
-        }
+// Start measuring on the calling thread, from now
+void frame_cost_reset()
+{
+    frame_woke = monotonic_us();
+    frame_busy_total = 0;
+    frame_busy_frames = 0;
+}
 
-        ws2811_render(np);
-        usleep(TICK);
+// Average busy microseconds per frame on the calling thread since
+// frame_cost_reset(), 0 if no frame has gone out
+int frame_cost_us()
+{
+    if (frame_busy_frames == 0)
+        return 0;
 
-        pos++;
+    return frame_busy_total / frame_busy_frames;
+}
 
-        if ((pos % pixels) == 0)
-        {
-            sweep++;
-            color += 10;
-        }
-    }
+// Effects work out where they are from the time since they started instead
+// of counting frames, so a late or dropped frame doesn't slow them down
+typedef struct {
+    int64_t start;
+    int64_t last;
+} effect_clock_t;
 
-    // Cleanup animation, but adjust where the last position was and bound it
-    int end = pos + (pixels - (pos % pixels));
+static void clock_start(effect_clock_t* clock)
+{
+    clock->start = monotonic_us();
+    clock->last = clock->start;
+}
 
-    for (; pos < end + marker_width; pos++)
-    {
-        // Draw all off pixels except the marker
-        set_all_pixels(np, 0);
+static int64_t clock_elapsed(const effect_clock_t* clock)
+{
+    return monotonic_us() - clock->start;
+}
 
-        // Now set the marker
-        int marker_color;
-        double v = 1.0;
-        for (int i = 0; i < marker_width; i++)
-        {
-            if (pos - i < 0)
-                break;
-
-            if ((pos - i) < end)
-            {
-                marker_color = i == 0 ? WHITE : hsv2rgb(color, 1.0, v);
-                set_pixel(np, (pos - i) % pixels, marker_color);
-                v -= fade_step;
-            }
-        }
+// Frames of tick length since the last step, for effects built on per frame
+// rates. Bounded so a long stall doesn't turn into one huge jump.
+static float clock_step(effect_clock_t* clock, int tick)
+{
+    int64_t now = monotonic_us();
+    float frames = (float) (now - clock->last) / tick;
 
-        ws2811_render(np);
-        usleep(TICK);
-    }
+    clock->last = now;
+    return MIN(frames, CLOCK_MAX_STEP);
 }
 
-void effect_comet_rainbow_trail_dial(ws2811_t* np, active_func active)
+// A marker sweeping the ring at one pixel per TICK times sweep_speed(). The
+// head is unwrapped, in 1/256 pixel, and moves on by the time since the
+// last frame so a change of speed doesn't make it jump. Once the wind-down
+// starts nothing is drawn at or past end, an unwrapped pixel. shown is the
+// head pixel of the last frame, once drawn is set.
+typedef struct {
+    int pixels;
+    int head;
+    int lap;
+    int end;
+    int64_t at;
+    int64_t carry;
+    bool drawn;
+    int shown;
+} sweep_t;
+
+// What the colour functions need, not every effect uses every field
+typedef struct {
+    const palette_t* palette;
+    int seed;
+    int stride;
+    int fade_step;
+
+    // Audio reactive effects scale by level, 256 is full, and step their
+    // hue whenever the onset count moves on
+    bool audio;
+    int level;
+    uint32_t onsets;
+} effect_colors_t;
+
+// Colour of marker element i, 0 being the head, where it lands on ring
+// position idx
+typedef int (*marker_color_func)(const sweep_t*, int i, int idx, effect_colors_t* colors);
+
+static int wrap_pixel(int pos, int pixels)
 {
-    int pixels = num_pixels(np);
-    int marker_width = get_marker_width(np);
-
-    int sweep = 0;
-    int pos = 0;
-    int step = 360 / (marker_width - 1);
+    pos %= pixels;
+    return pos < 0 ? pos + pixels : pos;
+}
 
-    double seed = rand();
+// Draw width elements trailing the head one pixel apart. The head sits
+// between two pixels, so every element is split across two of them by its
+// fractional part and pixel head+1-k ends up with a share of elements k-1
+// and k. The shares add up to 256 so the channels never carry. Positions
+// the marker covers but doesn't light are blanked.
+static void draw_marker(ws2811_t* np, const sweep_t* s, int width, marker_color_func color, effect_colors_t* colors)
+{
+    int head = s->head >> 8;
+    int frac = s->head & 0xff;
+    int span = MIN(width + 1, s->pixels);
 
-    while (active())
+    for (int k = 0; k < span; k++)
     {
-        // Draw all off pixels except the marker
-        set_all_pixels(np, 0);
+        int at = head + 1 - k;
+        int idx = wrap_pixel(at, s->pixels);
+        int c = 0;
+        bool lit = false;
 
-        // Now set the marker
-        int marker_color;
-        for (int i = 0; i < marker_width; i++)
+        if (at >= 0 && at < s->end)
         {
-            if (pos - i < 0)
-                break;
+            if (k > 0)
+                c += palette_scale(color(s, k - 1, idx, colors), 256 - frac);
+            if (k < width)
+                c += palette_scale(color(s, k, idx, colors), frac);
+            lit = true;
+        }
 
-            marker_color = i == 0 ? WHITE : hsv2rgb(seed - (i * step), 1.0, 1.0);
-            set_pixel(np, (pos - i) % pixels, marker_color);
+        // A marker as long as the ring meets its own tail here
+        if (k == 0 && width == s->pixels && at - s->pixels >= 0 && at - s->pixels < s->end)
+        {
+            c += palette_scale(color(s, width - 1, idx, colors), 256 - frac);
+            lit = true;
         }
 
-        ws2811_render(np);
-        usleep(TICK);
+        update_pixel(np, idx, lit ? c : 0);
+    }
+}
 
-        pos++;
+// Blank what the marker covered last frame and doesn't now, which is only
+// the pixel or two its tail has left behind. The first frame blanks the
+// whole ring.
+static void clear_marker(ws2811_t* np, sweep_t* s, int width)
+{
+    int span = MIN(width + 1, s->pixels);
+    int head = s->head >> 8;
 
-        if ((pos % pixels) == 0)
-        {
-            sweep++;
-        }
+    if (!s->drawn)
+    {
+        for (int i = 0; i < s->pixels; i++)
+            update_pixel(np, i, 0);
     }
+    else
+    {
+        // Unwrapped ranges covered, oldest pixel first
+        int was_lo = s->shown + 2 - span;
+        int was_hi = s->shown + 1;
+        int lo = head + 2 - span;
+        int hi = head + 1;
+
+        for (int at = was_lo; at <= MIN(was_hi, lo - 1); at++)
+            update_pixel(np, wrap_pixel(at, s->pixels), 0);
+        for (int at = MAX(was_lo, hi + 1); at <= was_hi; at++)
+            update_pixel(np, wrap_pixel(at, s->pixels), 0);
+    }
+
+    s->drawn = true;
+    s->shown = head;
+}
 
-    // Cleanup animation, but adjust where the last position was and bound it
-    int end = pos + (pixels - (pos % pixels));
+// Follow the loudness and step the hue on every onset. With nothing playing
+// the effect looks the way it always has.
+static void colors_follow_audio(effect_colors_t* c)
+{
+    audio_levels_t levels;
 
-    for (; pos < end + marker_width; pos++)
+    if (!audio_levels(&levels))
     {
-        // Draw all off pixels except the marker
-        set_all_pixels(np, 0);
+        c->level = 256;
+        return;
+    }
 
-        // Now set the marker
-        int marker_color;
-        for (int i = 0; i < marker_width; i++)
-        {
-            if (pos - i < 0)
-                break;
-
-            if ((pos - i) < end)
-            {
-                marker_color = i == 0 ? WHITE : hsv2rgb(seed + (i * step), 1.0, 1.0);
-                set_pixel(np, (pos - i) % pixels, marker_color);
-            }
-        }
+    c->level = AUDIO_LEVEL_MIN + (int) (levels.level * (256 - AUDIO_LEVEL_MIN));
 
-        ws2811_render(np);
-        usleep(TICK);
+    if (levels.onsets != c->onsets)
+    {
+        c->onsets = levels.onsets;
+        c->seed += palette_hue(AUDIO_ONSET_HUE);
     }
 }
 
-void effect_comet_rainbow_reveal_dial(ws2811_t* np, active_func active)
+static void sweep_frame(ws2811_t* np, sweep_t* s, const effect_clock_t* clock, int width,
+                        marker_color_func color, effect_colors_t* colors)
 {
-    int pixels = num_pixels(np);
-    int marker_width = get_marker_width(np);
+    int64_t now = clock_elapsed(clock);
+
+    // Carry the remainder so rounding never slows the sweep down
+    s->carry += (now - s->at) * sweep_speed();
+    s->head += s->carry / TICK;
+    s->carry %= TICK;
+    s->at = now;
+
+    if (colors->audio)
+        colors_follow_audio(colors);
+
+    // Colours keyed to the lap stay put while the last one winds down
+    if (s->end == INT_MAX)
+        s->lap = s->head / (s->pixels << 8);
 
-    int sweep = 0;
-    int pos = 0;
-    int step = 360 / pixels;
+    clear_marker(np, s, width);
+    draw_marker(np, s, width, color, colors);
+    render_update(np, TICK);
+}
 
-    double seed = rand() % 360;
-    double fade_step = 1.0 / marker_width;
+// Sweep the marker round while active, then let the head finish its lap and
+// the tail follow it off the end
+static void run_sweep(ws2811_t* np, active_func active, int width, marker_color_func color, effect_colors_t* colors)
+{
+    effect_clock_t clock;
+    sweep_t s = { .pixels = num_pixels(np), .head = 0, .lap = 0, .end = INT_MAX, .at = 0, .carry = 0 };
 
-    while (active())
+    if (colors->audio)
     {
-        // Draw all off pixels except the marker
-        set_all_pixels(np, 0);
+        audio_levels_t levels;
+        audio_levels(&levels);
+        colors->onsets = levels.onsets;
+    }
 
-        // Now set the marker
-        int marker_color;
-        double v = 1.0;
-        for (int i = 0; i < marker_width; i++)
-        {
-            if (pos - i < 0)
-                break;
+    clock_start(&clock);
 
-            int idx = (pos - i) % pixels;
-            marker_color = i == 0 ? WHITE : hsv2rgb(seed + (idx * step), 1.0, v);
-            set_pixel(np, idx, marker_color);
-            v -= fade_step;
-        }
+    while (running(active))
+        sweep_frame(np, &s, &clock, width, color, colors);
 
-        ws2811_render(np);
-        usleep(TICK);
+    s.end = ((s.head >> 8) / s.pixels + 1) * s.pixels;
 
-        pos++;
+    while (s.head < (s.end + width) << 8 && !is_preempted())
+        sweep_frame(np, &s, &clock, width, color, colors);
+}
 
-        if ((pos % pixels) == 0)
-        {
-            sweep++;
-        }
-    }
+int get_marker_width(ws2811_t* np)
+{
+    return (int) ((float) num_pixels(np) * COMET_TRAIL_FACTOR);
+}
+
+// Blank the ring one pixel per tick
+static void wipe_off(ws2811_t* np, int tick)
+{
+    effect_clock_t clock;
+    int pixels = num_pixels(np);
+    int cleared = 0;
 
-    // Cleanup animation, but adjust where the last position was and bound it
-    int end = pos + (pixels - (pos % pixels));
+    clock_start(&clock);
 
-    for (; pos < end + marker_width; pos++)
+    while (cleared < pixels)
     {
-        // Draw all off pixels except the marker
-        set_all_pixels(np, 0);
+        int upto = is_stopping() ? pixels : MIN(pixels, clock_elapsed(&clock) / tick + 1);
 
-        // Now set the marker
-        int marker_color;
-        double v = 1.0;
-        for (int i = 0; i < marker_width; i++)
-        {
-            if (pos - i < 0)
-                break;
-
-            if ((pos - i) < end)
-            {
-                int idx = (pos - i) % pixels;
-                marker_color = i == 0 ? WHITE : hsv2rgb(seed + (idx * step), 1.0, v);
-                set_pixel(np, idx, marker_color);
-                v -= fade_step;
-            }
-        }
+        for (; cleared < upto; cleared++)
+            update_pixel(np, cleared, 0);
 
-        ws2811_render(np);
-        usleep(TICK);
+        render_update(np, tick);
     }
 }
 
-void effect_full_rainbow_reveal_dial(ws2811_t* np, active_func active)
+void effect_clear(ws2811_t* np)
 {
-    int pixels = num_pixels(np);
-    int marker_width = 3;
+    wipe_off(np, TICK_CLEANUP);
+}
 
-    int sweep = 0;
-    int pos = 0;
-    int step = 360 / pixels;
+static int comet_color(const sweep_t* s, int i, int idx, effect_colors_t* c)
+{
+    int level = ((256 - i * c->fade_step) * c->level) >> 8;
+    return i == 0 ? WHITE : palette_scale(palette_color(c->palette, c->seed), level);
+}
 
-    double seed = rand();
+void effect_comet_dial(ws2811_t* np, active_func active)
+{
+    rng_t rng;
+    effect_rng(&rng);
 
-    while (active())
-    {
-        // Draw the background pixels
-        for (int i = 0; i < pixels; i++)
-        {
-            if (pos - i < 0)
-                break;
+    int marker_width = get_marker_width(np);
 
-            int idx = (pos - i) % pixels;
-            set_pixel(np, idx, hsv2rgb(seed + (idx * step), 1.0, 1.0));
-        }
+    effect_colors_t colors = {
+        .palette = palette_preset(PALETTE_RAINBOW),
+        .seed = palette_hue(rng_next(&rng)),
+        .fade_step = 256 / marker_width,
+        .audio = true,
+        .level = 256,
+    };
 
-        // Now set the marker
-        for (int i = 0; i < marker_width; i++)
-        {
-            if (pos - i < 0)
-                break;
+    run_sweep(np, active, marker_width, comet_color, &colors);
+}
 
-            int idx = (pos - i) % pixels;
-            set_pixel(np, idx, WHITE);
-        }
+// Moves round the hue wheel a little every lap
+static int comet_cycle_color(const sweep_t* s, int i, int idx, effect_colors_t* c)
+{
+    int color = palette_color(c->palette, c->seed + s->lap * palette_hue(10));
 
-        ws2811_render(np);
-        usleep(TICK);
+    return i == 0 ? WHITE : palette_scale(color, 256 - i * c->fade_step);
+}
 
-        pos++;
-        // FIXME: this creates a cool counter rotation effect of the colors
-        // seed += 2;
+void effect_comet_color_cycle_dial(ws2811_t* np, active_func active)
+{
+    rng_t rng;
+    effect_rng(&rng);
 
-        if ((pos % pixels) == 0)
-        {
-            sweep++;
-        }
-    }
+    int marker_width = get_marker_width(np);
 
-    // Cleanup animation, but adjust where the last position was and bound it
-    int end = pos + (pixels - (pos % pixels));
+    effect_colors_t colors = {
+        .palette = palette_preset(PALETTE_RAINBOW),
+        .seed = palette_hue(rng_next(&rng)),
+        .fade_step = 256 / marker_width,
+    };
 
-    for (; pos < end + pixels; pos++)
-    {
-        // Draw the background pixels
-        for (int i = 0; i < pixels; i++)
-        {
-            int idx = (pos - i) % pixels;
-
-            if ((pos - i) < 0)
-                break;
-
-            if ((pos - i) >= end)
-            {
-                // If past the "end", cycle but draw black
-                set_pixel(np, idx, 0);
-            }
-            else
-            {
-                // Otherwise, color the pixel
-                set_pixel(np, idx, hsv2rgb(seed + (idx * step), 1.0, 1.0));
-            }
-        }
+    run_sweep(np, active, marker_width, comet_cycle_color, &colors);
+}
 
-        // Now set the marker
-        for (int i = 0; i < marker_width; i++)
-        {
-            if (pos - i < 0)
-                break;
-
-            if ((pos - i) < end)
-            {
-                int idx = (pos - i) % pixels;
-                set_pixel(np, idx, WHITE);
-            }
-        }
+static int comet_trail_color(const sweep_t* s, int i, int idx, effect_colors_t* c)
+{
+    return i == 0 ? WHITE : palette_at(c->palette, c->seed, -c->stride, i);
+}
 
-        ws2811_render(np);
-        usleep(TICK);
-    }
+void effect_comet_rainbow_trail_dial(ws2811_t* np, active_func active)
+{
+    rng_t rng;
+    effect_rng(&rng);
+
+    int marker_width = get_marker_width(np);
+
+    effect_colors_t colors = {
+        .palette = palette_preset(PALETTE_RAINBOW),
+        .seed = palette_hue(rng_next(&rng)),
+        .stride = palette_stride(marker_width - 1),
+    };
+
+    run_sweep(np, active, marker_width, comet_trail_color, &colors);
 }
 
-void effect_full_color_dial(ws2811_t* np, active_func active)
+// The rainbow is fixed to the ring, the comet only shows where it is
+static int comet_reveal_color(const sweep_t* s, int i, int idx, effect_colors_t* c)
 {
-    int marker_width = 3;
-    int color = hsv2rgb(rand(), 1.0, 1.0);
+    return i == 0 ? WHITE : palette_scale(palette_at(c->palette, c->seed, c->stride, idx), 256 - i * c->fade_step);
+}
+
+void effect_comet_rainbow_reveal_dial(ws2811_t* np, active_func active)
+{
+    rng_t rng;
+    effect_rng(&rng);
 
     int pixels = num_pixels(np);
+    int marker_width = get_marker_width(np);
 
-    int sweep = 0;
-    int pos = 0;
+    effect_colors_t colors = {
+        .palette = palette_preset(PALETTE_RAINBOW),
+        .seed = palette_hue(rng_next(&rng)),
+        .stride = palette_stride(pixels),
+        .fade_step = 256 / marker_width,
+    };
 
-    while (active())
-    {
-        // Draw the background pixels
-        for (int i = 0; i < pixels; i++)
-        {
-            if (pos - i < 0)
-                break;
+    run_sweep(np, active, marker_width, comet_reveal_color, &colors);
+}
 
-            set_pixel(np, i, color);
-        }
+// The full ring effects paint everything behind a short white head
+static int full_reveal_color(const sweep_t* s, int i, int idx, effect_colors_t* c)
+{
+    return i < FULL_MARKER_WIDTH ? WHITE : palette_at(c->palette, c->seed, c->stride, idx);
+}
 
-        // Now set the marker
-        for (int i = 0; i < marker_width; i++)
-        {
-            if (pos - i < 0)
-                break;
+void effect_full_rainbow_reveal_dial(ws2811_t* np, active_func active)
+{
+    rng_t rng;
+    effect_rng(&rng);
 
-            set_pixel(np, (pos - i) % pixels, WHITE);
-        }
+    int pixels = num_pixels(np);
 
-        ws2811_render(np);
-        usleep(TICK);
+    effect_colors_t colors = {
+        .palette = palette_preset(PALETTE_RAINBOW),
+        .seed = palette_hue(rng_next(&rng)),
+        .stride = palette_stride(pixels),
+    };
 
-        pos++;
+    run_sweep(np, active, pixels, full_reveal_color, &colors);
+}
 
-        if ((pos % pixels) == 0)
-        {
-            sweep++;
-        }
-    }
+static int full_color(const sweep_t* s, int i, int idx, effect_colors_t* c)
+{
+    return i < FULL_MARKER_WIDTH ? WHITE : c->seed;
+}
 
-    // Cleanup animation, but adjust where the last position was and bound it
-    int end = pos + (pixels - (pos % pixels));
+void effect_full_color_dial(ws2811_t* np, active_func active)
+{
+    rng_t rng;
+    effect_rng(&rng);
 
-    for (; pos < end + pixels; pos++)
-    {
-        // Draw the background pixels
-        for (int i = 0; i < pixels; i++)
-        {
-            int idx = (pos - i) % pixels;
-
-            if ((pos - i) < 0)
-                break;
-
-            if ((pos - i) >= end)
-            {
-                // If past the "end", cycle but draw black
-                set_pixel(np, idx, 0);
-            }
-            else
-            {
-                // Otherwise, color the pixel
-                set_pixel(np, idx, color);
-            }
-        }
+    // The seed is the colour itself here
+    effect_colors_t colors = {
+        .seed = hsv2rgb(rng_next(&rng), 1.0, 1.0),
+    };
 
-        // Now set the marker
-        for (int i = 0; i < marker_width; i++)
-        {
-            if (pos - i < 0)
-                break;
-
-            if ((pos - i) < end)
-            {
-                int idx = (pos - i) % pixels;
-                set_pixel(np, idx, WHITE);
-            }
-        }
+    run_sweep(np, active, num_pixels(np), full_color, &colors);
+}
 
-        ws2811_render(np);
-        usleep(TICK);
-    }
+// The whole ring changes colour every lap
+static int full_wipe_color(const sweep_t* s, int i, int idx, effect_colors_t* c)
+{
+    return i < FULL_MARKER_WIDTH ? WHITE : palette_color(c->palette, c->seed + palette_hue(s->lap * 5));
 }
 
 void effect_full_rainbow_wipe_dial(ws2811_t* np, active_func active)
 {
-    int marker_width = 3;
+    rng_t rng;
+    effect_rng(&rng);
+
+    effect_colors_t colors = {
+        .palette = palette_preset(PALETTE_RAINBOW),
+        .seed = palette_hue(rng_next(&rng)),
+    };
+
+    run_sweep(np, active, num_pixels(np), full_wipe_color, &colors);
+}
+
+void _effect_fire_ring(ws2811_t* np, int color_min, active_func active)
+{
+    particles_t* pool = effect_pool();
+    effect_clock_t clock;
+    rng_t rng;
+    effect_rng(&rng);
 
     int pixels = num_pixels(np);
+    int color_mod = 10;
+    int min_v = 10;
+
+    // Enough new flames each frame to hold FIRE_DENSITY per pixel
+    float spawn_rate = FIRE_DENSITY * pixels * (FIRE_DECAY_MIN + FIRE_DECAY_MAX) / 2;
+    float gain = 2.0f / FIRE_DENSITY;
+    float spawn = 0;
 
-    int sweep = 0;
-    int pos = 0;
+    audio_levels_t levels;
+    audio_levels(&levels);
+    uint32_t onsets = levels.onsets;
 
-    double seed = rand();
-    int background = hsv2rgb(seed, 1.0, 1.0);
+    particles_reset(pool);
+    clock_start(&clock);
 
-    while (active())
+    while (running(active))
     {
-        // Draw the background pixels
-        for (int i = 0; i < pixels; i++)
+        float dt = clock_step(&clock, TICK);
+        particles_step(pool, pixels, dt);
+
+        // With audio playing the bass feeds the fire and onsets flare it up
+        float feed = spawn_rate * dt;
+        if (audio_levels(&levels))
         {
-            if (pos - i < 0)
-                break;
+            feed *= 0.25f + 1.5f * (levels.band[0] + levels.band[1] + levels.band[2]) / 3;
 
-            set_pixel(np, i, background);
+            if (levels.onsets != onsets)
+                feed += FIRE_ONSET_BURST * pixels;
+            onsets = levels.onsets;
         }
 
-        // Now set the marker
-        for (int i = 0; i < marker_width; i++)
+        for (spawn += feed; spawn >= 1; spawn--)
         {
-            if (pos - i < 0)
-                break;
-
-            set_pixel(np, (pos - i) % pixels, WHITE);
+            int color = hsv2rgb(color_min + (rng_next(&rng) % color_mod), 1.0,
+                                MAX(min_v, rng_next(&rng) % 100) / 100.0);
+
+            particles_spawn(pool,
+                            rng_float(&rng) * pixels,
+                            (rng_float(&rng) - 0.5f) * FIRE_DRIFT,
+                            color,
+                            FIRE_DECAY_MIN + rng_float(&rng) * (FIRE_DECAY_MAX - FIRE_DECAY_MIN));
         }
 
-        ws2811_render(np);
-        usleep(TICK);
+        particles_render(pool, np, 0, gain);
 
-        pos++;
+        render_frame(np, TICK);
+    }
 
-        if ((pos % pixels) == 0)
-        {
-            background = hsv2rgb(seed + ((sweep + 1) * 5), 1.0, 1.0);
-            sweep++;
-        }
+    // cleanup, stop feeding the fire and let it burn out
+    while (pool->count > 0 && !is_preempted())
+    {
+        particles_step(pool, pixels, clock_step(&clock, TICK));
+        particles_render(pool, np, 0, gain);
+
+        render_frame(np, TICK);
     }
+}
 
-    // Cleanup animation, but adjust where the last position was and bound it
-    int end = pos + (pixels - (pos % pixels));
+void effect_fire_ring(ws2811_t* np, active_func active)
+{
+    _effect_fire_ring(np, 3, active);
+}
 
-    for (; pos < end + pixels; pos++)
+void effect_random_fire_ring(ws2811_t* np, active_func active)
+{
+    rng_t rng;
+    effect_rng(&rng);
+
+    _effect_fire_ring(np, rng_next(&rng) % 360, active);
+}
+
+void effect_embers(ws2811_t* np, active_func active)
+{
+    particles_t* pool = effect_pool();
+    effect_clock_t clock;
+    rng_t rng;
+    effect_rng(&rng);
+
+    int pixels = num_pixels(np);
+
+    // Few, dim, long lived and slowly drifting
+    float spawn_rate = EMBER_DENSITY * pixels * (EMBER_DECAY_MIN + EMBER_DECAY_MAX) / 2;
+    float gain = 1.0f / EMBER_DENSITY;
+    float spawn = 0;
+
+    particles_reset(pool);
+    clock_start(&clock);
+
+    while (running(active))
     {
-        // Draw the background pixels
-        for (int i = 0; i < pixels; i++)
-        {
-            int idx = (pos - i) % pixels;
-
-            if ((pos - i) < 0)
-                break;
-
-            if ((pos - i) >= end)
-            {
-                // If past the "end", cycle but draw black
-                set_pixel(np, idx, 0);
-            }
-            else
-            {
-                // Otherwise, color the pixel
-                set_pixel(np, idx, background);
-            }
-        }
+        float dt = clock_step(&clock, TICK);
+        particles_step(pool, pixels, dt);
 
-        // Now set the marker
-        for (int i = 0; i < marker_width; i++)
+        for (spawn += spawn_rate * dt; spawn >= 1; spawn--)
         {
-            if (pos - i < 0)
-                break;
-
-            if ((pos - i) < end)
-            {
-                int idx = (pos - i) % pixels;
-                set_pixel(np, idx, WHITE);
-            }
+            int color = hsv2rgb(10 + (rng_next(&rng) % 25), 1.0, 0.3 + rng_float(&rng) * 0.7);
+
+            particles_spawn(pool,
+                            rng_float(&rng) * pixels,
+                            (rng_float(&rng) - 0.5f) * EMBER_DRIFT,
+                            color,
+                            EMBER_DECAY_MIN + rng_float(&rng) * (EMBER_DECAY_MAX - EMBER_DECAY_MIN));
         }
 
-        ws2811_render(np);
-        usleep(TICK);
+        particles_render(pool, np, 0, gain);
+
+        render_frame(np, TICK);
+    }
+
+    // cleanup
+    while (pool->count > 0 && !is_preempted())
+    {
+        particles_step(pool, pixels, clock_step(&clock, TICK));
+        particles_render(pool, np, 0, gain);
+
+        render_frame(np, TICK);
     }
 }
 
-void _effect_fire_ring(ws2811_t* np, int color_min, active_func active)
+void effect_sparks(ws2811_t* np, active_func active)
 {
+    particles_t* pool = effect_pool();
+    effect_clock_t clock;
+    rng_t rng;
+    effect_rng(&rng);
+
     int pixels = num_pixels(np);
-    int colors[pixels];
-    int dirs[pixels];
-    int v[pixels];
+    int hue = rng_next(&rng) % 360;
+    float spawn = 0;
 
-    int color_max = color_min + 10;
-    int color_mod = color_max - color_min;
-    int min_v = 10;
+    particles_reset(pool);
+    clock_start(&clock);
 
-    for (int i = 0; i < pixels; i++)
+    while (running(active))
     {
-        colors[i] = color_min + (rand() % color_mod);
-        dirs[i] = colors[i] < color_max ? 1 : -1;
-        v[i] = MAX(min_v, rand() % 100);
-
-        set_pixel(np, i, hsv2rgb(colors[i], 1.0, v[i] / 100.0));
+        float dt = clock_step(&clock, TICK);
+        particles_step(pool, pixels, dt);
 
-        ws2811_render(np);
-        usleep(TICK);
-    }
+        // The head goes round at one pixel per TICK
+        float pos = (float) (clock_elapsed(&clock) % ((int64_t) pixels * TICK)) / TICK;
 
-    while (active())
-    {
-        int delta = color_max - color_min;
-        int phase_ms = 1000 * (1.0 / delta);
+        // A white head sheds sparks that fly off behind it
+        particles_spawn(pool, pos, 0, WHITE, 0.5f);
 
-        for (int p = 0; p < delta; p++)
+        for (spawn += SPARKS_PER_FRAME * dt; spawn >= 1; spawn--)
         {
-            for (int i = 0; i < pixels; i++)
-            {
-                // Should we even change?
-                if (rand() % 15 != 0) continue;
-
-                colors[i] += dirs[i] + (dirs[i] * (rand() % (color_mod / 3)));
-                v[i] += (-1 * dirs[i]) * (rand() % 25);
-
-                if (v[i] > 100)
-                    v[i] = 100;
-                else if (v[i] < min_v)
-                    v[i] = min_v;
-
-                if (colors[i] >= color_max)
-                {
-                    dirs[i] = -1;
-                    colors[i] = color_max;
-                }
-                else if (colors[i] <= color_min)
-                {
-                    dirs[i] = 1;
-                    colors[i] = color_min;
-                }
-
-                set_pixel(np, i, hsv2rgb(colors[i], 1.0, v[i] / 100.0));
-            }
-
-            ws2811_render(np);
-            usleep(phase_ms * 50);
+            int color = hsv2rgb(hue + (rng_next(&rng) % 40), 0.6, 1.0);
+
+            particles_spawn(pool,
+                            pos,
+                            -SPARK_SPEED * rng_float(&rng),
+                            color,
+                            SPARK_DECAY_MIN + rng_float(&rng) * (SPARK_DECAY_MAX - SPARK_DECAY_MIN));
         }
 
-        ws2811_render(np);
-        usleep(TICK);
+        particles_render(pool, np, 0, 1.0f);
+
+        render_frame(np, TICK);
     }
 
     // cleanup
-    for (int i = 0; i < pixels; i++)
+    while (pool->count > 0 && !is_preempted())
     {
-        set_pixel(np, i, 0);
-        ws2811_render(np);
-        usleep(TICK);
+        particles_step(pool, pixels, clock_step(&clock, TICK));
+        particles_render(pool, np, 0, 1.0f);
+
+        render_frame(np, TICK);
     }
 }
 
-void effect_fire_ring(ws2811_t* np, active_func active)
+// Colour at x round the ring, in noise cells of which there are cells, and t
+// cells into the show, both in 1/NOISE_ONE
+typedef int (*noise_color_func)(int32_t x, int32_t t, int cells, effect_colors_t* colors);
+
+static void noise_frame(ws2811_t* np, int64_t us, int cells, int rate, int level,
+                        noise_color_func color, effect_colors_t* colors)
 {
-    _effect_fire_ring(np, 3, active);
+    int pixels = num_pixels(np);
+    int32_t step = (cells << (2 * NOISE_SHIFT)) / pixels;
+    int32_t t = (int32_t) (us * NOISE_ONE / rate) + (colors->seed << NOISE_SHIFT);
+
+    for (int i = 0; i < pixels; i++)
+        set_pixel(np, i, palette_scale(color((i * step) >> NOISE_SHIFT, t, cells, colors), level));
+
+    render_frame(np, TICK);
 }
 
-void effect_random_fire_ring(ws2811_t* np, active_func active)
+// Move through the noise field while active, then fade out where it is
+static void run_noise(ws2811_t* np, active_func active, int cells, int rate,
+                      noise_color_func color, effect_colors_t* colors)
 {
-    _effect_fire_ring(np, rand() % 360, active);
+    effect_clock_t clock;
+    int64_t end;
+
+    clock_start(&clock);
+
+    while (running(active))
+        noise_frame(np, clock_elapsed(&clock), cells, rate, 256, color, colors);
+
+    end = clock_elapsed(&clock);
+
+    for (int64_t us = end; us - end < NOISE_FADE_US && !is_preempted(); us = clock_elapsed(&clock))
+        noise_frame(np, us, cells, rate, 256 - (us - end) * 256 / NOISE_FADE_US, color, colors);
+
+    set_all_pixels(np, 0);
+    render_frame(np, TICK);
 }
 
-void effect_unicorn_dial(ws2811_t* np, active_func active)
+// Heat from two octaves, the finer one moving faster, leaning hot
+static int noise_fire_color(int32_t x, int32_t t, int cells, effect_colors_t* c)
 {
-    int pixels = num_pixels(np);
+    int heat = 144 + noise2(x, t, cells) / 2 + noise2(2 * x, 2 * t, 2 * cells) / 4;
 
-    int sweep = 0;
-    int pos = 0;
-    int step = 360 / (pixels - 1);
+    return palette_color(c->palette, MAX(0, MIN(heat, PALETTE_SIZE - 1)));
+}
 
-    double seed = rand();
+void effect_noise_fire(ws2811_t* np, active_func active)
+{
+    rng_t rng;
+    effect_rng(&rng);
 
-    while (active())
-    {
-        // Draw all off pixels except the marker
-        set_all_pixels(np, 0);
+    effect_colors_t colors = {
+        .palette = palette_preset(PALETTE_FIRE),
+        .seed = rng_next(&rng) % NOISE_CELLS,
+    };
 
-        // Now set the marker
-        for (int i = 0; i < pixels; i++)
-        {
-            if (pos - i < 0)
-                break;
+    run_noise(np, active, NOISE_FIRE_CELLS, NOISE_FIRE_RATE, noise_fire_color, &colors);
+}
 
-            set_pixel(np, (pos - i) % pixels, hsv2rgb(seed + (i * step), 1.0, 1.0));
-        }
+// Hue wanders with the field, on top of a slow turn of the whole ring
+static int plasma_color(int32_t x, int32_t t, int cells, effect_colors_t* c)
+{
+    int n = noise2(x, t, cells) + noise2(2 * x, t + t / 2, 2 * cells) / 2;
 
-        ws2811_render(np);
-        usleep(TICK);
+    return palette_color(c->palette, (t >> 3) + n / 2);
+}
 
-        pos++;
+void effect_plasma(ws2811_t* np, active_func active)
+{
+    rng_t rng;
+    effect_rng(&rng);
 
-        if ((pos % pixels) == 0)
-        {
-            sweep++;
-        }
-    }
+    effect_colors_t colors = {
+        .palette = palette_preset(PALETTE_RAINBOW),
+        .seed = rng_next(&rng) % NOISE_CELLS,
+    };
 
-    // Cleanup animation, but adjust where the last position was and bound it
-    int end = pos + (pixels - (pos % pixels));
+    run_noise(np, active, PLASMA_CELLS, PLASMA_RATE, plasma_color, &colors);
+}
 
-    for (; pos < end + pixels; pos++)
-    {
-        // Draw all off pixels except the marker
-        set_all_pixels(np, 0);
+// Curtains where the field is above zero and dark between them, their
+// colour drifting separately and more slowly
+static int aurora_color(int32_t x, int32_t t, int cells, effect_colors_t* c)
+{
+    int level = noise2(x, t, cells) * 2;
+    if (level <= 0)
+        return 0;
 
-        // Now set the marker
-        for (int i = 0; i < pixels; i++)
-        {
-            if (pos - i < 0)
-                break;
+    int hue = 128 + noise2(x + (cells << NOISE_SHIFT) / 2, t / 2, cells) / 2;
 
-            if ((pos - i) < end)
-            {
-                set_pixel(np, (pos - i) % pixels, hsv2rgb(seed + (i * step), 1.0, 1.0));
-            }
-        }
+    return palette_scale(palette_color(c->palette, hue), MIN(level, 256));
+}
 
-        ws2811_render(np);
-        usleep(TICK);
-    }
+void effect_aurora(ws2811_t* np, active_func active)
+{
+    rng_t rng;
+    effect_rng(&rng);
+
+    effect_colors_t colors = {
+        .palette = palette_preset(PALETTE_AURORA),
+        .seed = rng_next(&rng) % NOISE_CELLS,
+    };
+
+    run_noise(np, active, AURORA_CELLS, AURORA_RATE, aurora_color, &colors);
 }
 
-void _effect_strobe(ws2811_t* np, int on)
+static int unicorn_color(const sweep_t* s, int i, int idx, effect_colors_t* c)
 {
-    int off = 0;
+    return palette_at(c->palette, c->seed, c->stride, i);
+}
+
+void effect_unicorn_dial(ws2811_t* np, active_func active)
+{
+    rng_t rng;
+    effect_rng(&rng);
+
     int pixels = num_pixels(np);
-    int strobes = 0;
 
-    // Clear it
-    set_all_pixels(np, off);
+    effect_colors_t colors = {
+        .palette = palette_preset(PALETTE_RAINBOW),
+        .seed = palette_hue(rng_next(&rng)),
+        .stride = palette_stride(pixels - 1),
+    };
 
-    // FIXME: configurable limit via parameter
-    while (strobes < STROBE_MAX)
-    {
-        for (int i = 0; i < pixels; i++)
-            set_pixel(np, i, on);
-        ws2811_render(np);
-        usleep(STROBE_TICK);
+    run_sweep(np, active, pixels, unicorn_color, &colors);
+}
 
-        for (int i = 0; i < pixels; i++)
-            set_pixel(np, i, off);
-        ws2811_render(np);
-        usleep(STROBE_TICK);
+// Draws the on half of strobe n
+typedef void (*strobe_func)(ws2811_t*, int n, effect_colors_t*);
 
-        strobes++;
+// Flash on and off STROBE_MAX times, a phase per STROBE_TICK. Which phase
+// to show comes from the clock so a late frame doesn't stretch the strobe.
+static void run_strobe(ws2811_t* np, strobe_func on, effect_colors_t* colors)
+{
+    effect_clock_t clock;
+    int phases = STROBE_MAX * 2;
+
+    // Clear it
+    set_all_pixels(np, 0);
+    clock_start(&clock);
+
+    for (;;)
+    {
+        // Frames land on phase boundaries, rounding keeps a little jitter
+        // either way from showing the same phase twice
+        int phase = (clock_elapsed(&clock) + STROBE_TICK / 2) / STROBE_TICK;
+        if (phase >= phases || is_stopping())
+            break;
+
+        if (phase % 2 == 0)
+            on(np, phase / 2, colors);
+        else
+            set_all_pixels(np, 0);
+
+        render_frame(np, STROBE_TICK);
     }
 
     // cleanup
-    set_all_pixels(np, off);
-    ws2811_render(np);
-    usleep(TICK);
+    set_all_pixels(np, 0);
+    render_frame(np, TICK);
+}
+
+// The seed is the colour itself here
+static void strobe_color(ws2811_t* np, int n, effect_colors_t* c)
+{
+    set_all_pixels(np, c->seed);
 }
 
 void effect_strobe(ws2811_t* np)
 {
-    _effect_strobe(np, hsv2rgb(0, 0, 1.0));
+    effect_colors_t colors = { .seed = hsv2rgb(0, 0, 1.0) };
+    run_strobe(np, strobe_color, &colors);
 }
 
 void effect_random_strobe(ws2811_t* np)
 {
-    _effect_strobe(np, hsv2rgb(rand(), 1.0, 1.0));
+    rng_t rng;
+    effect_rng(&rng);
+
+    effect_colors_t colors = { .seed = hsv2rgb(rng_next(&rng), 1.0, 1.0) };
+    run_strobe(np, strobe_color, &colors);
+}
+
+static void strobe_rainbow(ws2811_t* np, int n, effect_colors_t* c)
+{
+    set_all_pixels(np, palette_color(c->palette, c->seed + n * palette_hue(10)));
 }
 
 void effect_rainbow_strobe(ws2811_t* np)
 {
-    int off = 0;
-    int pixels = num_pixels(np);
-    int strobes = 0;
-    int seed = rand();
+    rng_t rng;
+    effect_rng(&rng);
 
-    // Clear it
-    set_all_pixels(np, off);
+    effect_colors_t colors = {
+        .palette = palette_preset(PALETTE_RAINBOW),
+        .seed = palette_hue(rng_next(&rng)),
+    };
 
-    // FIXME: configurable thing
-    while (strobes < STROBE_MAX)
-    {
-        int on = hsv2rgb(seed, 1.0, 1.0);
+    run_strobe(np, strobe_rainbow, &colors);
+}
 
-        for (int i = 0; i < pixels; i++)
-            set_pixel(np, i, on);
-        ws2811_render(np);
-        usleep(STROBE_TICK);
+static void strobe_static_rainbow(ws2811_t* np, int n, effect_colors_t* c)
+{
+    palette_fill(np, c->palette, c->seed, c->stride);
+}
 
-        for (int i = 0; i < pixels; i++)
-            set_pixel(np, i, off);
-        ws2811_render(np);
-        usleep(STROBE_TICK);
+void effect_rainbow_static_strobe(ws2811_t* np)
+{
+    rng_t rng;
+    effect_rng(&rng);
 
-        strobes++;
-        seed += 10;
-    }
+    effect_colors_t colors = {
+        .palette = palette_preset(PALETTE_RAINBOW),
+        .seed = palette_hue(rng_next(&rng)),
+        .stride = palette_stride(num_pixels(np)),
+    };
 
-    // cleanup
-    set_all_pixels(np, off);
-    ws2811_render(np);
-    usleep(TICK);
+    run_strobe(np, strobe_static_rainbow, &colors);
 }
 
-void effect_rainbow_static_strobe(ws2811_t* np)
+// Subtracting from seed makes the color look like its going clockwise
+static void strobe_dynamic_rainbow(ws2811_t* np, int n, effect_colors_t* c)
 {
-    int off = 0;
-    int pixels = num_pixels(np);
-    int strobes = 0;
-    int seed = rand();
-    int step = 360 / pixels;
+    palette_fill(np, c->palette, c->seed + n * palette_hue(25), -c->stride);
+}
 
-    // Clear it
-    set_all_pixels(np, off);
+void effect_rainbow_dynamic_strobe(ws2811_t* np)
+{
+    rng_t rng;
+    effect_rng(&rng);
 
-    // FIXME: configurable
-    while (strobes < STROBE_MAX)
-    {
-        for (int i = 0; i < pixels; i++)
-            set_pixel(np, i, hsv2rgb(seed + (i * step), 1.0, 1.0));
-        ws2811_render(np);
-        usleep(STROBE_TICK);
+    effect_colors_t colors = {
+        .palette = palette_preset(PALETTE_RAINBOW),
+        .seed = palette_hue(rng_next(&rng)),
+        .stride = palette_stride(num_pixels(np)),
+    };
 
-        for (int i = 0; i < pixels; i++)
-            set_pixel(np, i, off);
-        ws2811_render(np);
-        usleep(STROBE_TICK);
+    run_strobe(np, strobe_dynamic_rainbow, &colors);
+}
 
-        strobes++;
-    }
+// The color function gets the ring position a twinkle lands on
+typedef int (*twinkle_color_func)(rng_t*, int pos, int seed, int stride);
 
-    // cleanup
-    set_all_pixels(np, off);
-    ws2811_render(np);
-    usleep(TICK);
+int twinkle_fixed_color(rng_t* rng, int pos, int seed, int stride)
+{
+    return seed;
 }
 
-void effect_rainbow_dynamic_strobe(ws2811_t* np)
+int twinkle_random_color(rng_t* rng, int pos, int seed, int stride)
 {
-    int off = 0;
-    int pixels = num_pixels(np);
-    int strobes = 0;
-    int seed = rand();
-    int step = 360 / pixels;
-
-    // Clear it
-    set_all_pixels(np, off);
-
-    // FIXME configurable
-    while (strobes < STROBE_MAX)
-    {
-        // Subtracting from seed makes the color look like its going clockwise
-        for (int i = 0; i < pixels; i++)
-            set_pixel(np, i, hsv2rgb(seed - (i * step), 1.0, 1.0));
-        ws2811_render(np);
-        usleep(STROBE_TICK);
-
-        for (int i = 0; i < pixels; i++)
-            set_pixel(np, i, off);
-        ws2811_render(np);
-        usleep(STROBE_TICK);
-
-        strobes++;
-        seed += 25;
-    }
+    return palette_color(palette_preset(PALETTE_RAINBOW), seed + rng_next(rng));
+}
 
-    // cleanup
-    set_all_pixels(np, off);
-    ws2811_render(np);
-    usleep(TICK);
+int twinkle_position_color(rng_t* rng, int pos, int seed, int stride)
+{
+    return palette_at(palette_preset(PALETTE_RAINBOW), seed, stride, pos);
 }
 
-void _effect_twinkle(ws2811_t* np, int fg, int bg)
+void _effect_twinkle(ws2811_t* np, twinkle_color_func color, int seed, int bg)
 {
+    particles_t* pool = effect_pool();
+    effect_clock_t clock;
+    rng_t rng;
+    effect_rng(&rng);
+
     int pixels = num_pixels(np);
-    int sleep_count = 0;
+    int stride = palette_stride(pixels);
+    float spawn = 0;
+
+    particles_reset(pool);
+    clock_start(&clock);
 
     // FIXME configurable
-    while (sleep_count < 5000000)
+    while (clock_elapsed(&clock) < TWINKLE_DURATION && !is_stopping())
     {
-        for (int i = 0; i < pixels; i++)
+        // Drop a few new twinkles in, the old ones fade out over a few frames
+        float dt = clock_step(&clock, TWINKLE_TICK);
+        particles_step(pool, pixels, dt);
+
+        for (spawn += TWINKLE_SPARSE_FACTOR * dt; spawn >= 1; spawn--)
         {
-            // Set some random guys
-            if (rand() % (pixels / TWINKLE_SPARSE_FACTOR) == 0)
-                set_pixel(np, i, fg);
-            else
-                set_pixel(np, i, bg);
+            int pos = rng_next(&rng) % pixels;
+            particles_spawn(pool, pos, 0, color(&rng, pos, seed, stride), TWINKLE_DECAY);
         }
 
-        ws2811_render(np);
-        usleep(TWINKLE_TICK);
-        sleep_count += TWINKLE_TICK;
+        // Only the few pixels twinkling now or a frame ago change
+        particles_update(pool, np, bg, 1.0f);
+
+        render_update(np, TWINKLE_TICK);
     }
 
     // cleanup
-    for (int i = 0; i < pixels; i++)
-    {
-        set_pixel(np, i, 0);
-        ws2811_render(np);
-        usleep(TICK);
-    }
+    wipe_off(np, TICK);
 }
 
 void effect_twinkle(ws2811_t* np)
 {
-    int c = rand();
+    rng_t rng;
+    effect_rng(&rng);
+
+    int c = rng_next(&rng);
     int fg = hsv2rgb(c, 1.0, 1.0);
     int bg = 0;
 
-    _effect_twinkle(np, fg, bg);
+    _effect_twinkle(np, twinkle_fixed_color, fg, bg);
 }
 
 void effect_rainbow_random_twinkle(ws2811_t* np)
 {
-    int off = 0;
+    rng_t rng;
+    effect_rng(&rng);
+
+    _effect_twinkle(np, twinkle_random_color, rng_next(&rng), 0);
+}
+
+void effect_rainbow_fixed_twinkle(ws2811_t* np)
+{
+    rng_t rng;
+    effect_rng(&rng);
+
+    _effect_twinkle(np, twinkle_position_color, palette_hue(rng_next(&rng)), 0);
+}
+
+void effect_dial_digit_highlight(ws2811_t* np, int digit)
+{
     int pixels = num_pixels(np);
-    int sleep_count = 0;
-    int c = rand();
 
-    // FIXME configurable
-    while (sleep_count < 5000000)
-    {
-        // Clear first
-        set_all_pixels(np, off);
+    // Run this effect a 2x speed from most animations
+    int tick = TICK / 2;
 
-        // Set some random guys to a color
-        for (int i = 0; i < pixels; i++)
-        {
-            if (rand() % (pixels / TWINKLE_SPARSE_FACTOR) == 0)
-                set_pixel(np, i, hsv2rgb(c + rand(), 1.0, 1.0));
-        }
-        ws2811_render(np);
-        usleep(TWINKLE_TICK);
-        sleep_count += TWINKLE_TICK;
+    int active_pixels = geometry_digit_arc(digit);
+
+    // Now draw, but from the end
+    int c = rgb2int(255, 255, 255);
+    for (int i = 1; i <= active_pixels; i++)
+    {
+        set_pixel(np, pixels-i, c);
+        render_frame(np, tick);
     }
 
-    // cleanup
-    set_all_pixels(np, off);
-    ws2811_render(np);
-    usleep(TICK);
+    // pause for 500ms, then clear
+    frame_pause(500000);
+
+    for (int i = 0; i < pixels; i++)
+    {
+        set_pixel(np, i, 0);
+        render_frame(np, tick);
+    }
 }
 
-void effect_rainbow_fixed_twinkle(ws2811_t* np)
+// Grow or shrink a highlight arc by one pixel toward target, returns the new
+// number of lit pixels
+int step_digit_arc(ws2811_t* np, int lit, int target, int color)
 {
-    int off = 0;
     int pixels = num_pixels(np);
-    int sleep_count = 0;
-    int seed = rand() % 360;
-    int step = 360 / pixels;
 
-    // FIXME: configurable
-    while (sleep_count < 5000000)
+    if (lit < target)
     {
-        // Clear first
-        set_all_pixels(np, off);
-
-        // Set some random guys to a color
-        for (int i = 0; i < pixels; i++)
-        {
-            if (rand() % (pixels / TWINKLE_SPARSE_FACTOR) == 0)
-                set_pixel(np, i, hsv2rgb(seed + (i * step), 1.0, 1.0));
-        }
-        ws2811_render(np);
-        usleep(TWINKLE_TICK);
-        sleep_count += TWINKLE_TICK;
+        lit++;
+        set_pixel(np, pixels - lit, color);
+    }
+    else if (lit > target)
+    {
+        set_pixel(np, pixels - lit, 0);
+        lit--;
     }
 
-    // cleanup
-    set_all_pixels(np, off);
-    ws2811_render(np);
-    usleep(TICK);
+    return lit;
 }
 
-void effect_dial_digit_highlight(ws2811_t* np, int digit)
+bool effect_dial_digit_stream(ws2811_t* np, count_func pulses, active_func active)
 {
     int pixels = num_pixels(np);
-
-    // Run this effect a 2x speed from most animations
     int tick = TICK / 2;
+    int c = WHITE;
 
-    // About 40 degrees between the dialer stop and number 1
-    // FIXME: this works in testing, but it needs to be less hardcoded
-    int degree_start = 75;
-    int degree_step = 32;
+    // Number of pixels currently lit from the end, and where we're headed
+    int lit = 0;
+    int target = 0;
 
-    // Update for a digit index from where we start (1 == 0 idx, 2 == 1, etc)
-    // Digit 0 is special, it needs to be converted to index 9
-    int digit_idx = digit == 0 ? 9 : digit - 1;
+    // The sweep was cut short, so start from a dark ring
+    set_all_pixels(np, 0);
 
-    // Now figure out how many pixels to light up.
-    double pct_active = (degree_start + (digit_idx * degree_step)) / 360.0;
-    int active_pixels = pixels * pct_active;
+    // While the dial returns, move the arc one pixel per frame toward the
+    // digit the pulses seen so far would make
+    while (running(active))
+    {
+        int count = pulses();
+        target = count > 0 ? geometry_digit_arc(count % 10) : 0;
 
-    // Now draw, but from the end
-    int c = rgb2int(255, 255, 255);
-    for (int i = 1; i <= active_pixels; i++)
+        lit = step_digit_arc(np, lit, target, c);
+
+        render_frame(np, tick);
+    }
+
+    // The digit is final now. No pulses means it was a false start, so roll
+    // back whatever was drawn, otherwise confirm the arc for the real digit
+    int count = pulses();
+    target = count > 0 ? geometry_digit_arc(count % 10) : 0;
+
+    while (lit != target)
     {
-        set_pixel(np, pixels-i, c);
-        ws2811_render(np);
-        usleep(tick);
+        lit = step_digit_arc(np, lit, target, c);
+
+        render_frame(np, tick);
     }
 
+    if (count == 0)
+        return false;
+
     // pause for 500ms, then clear
-    usleep(500000);
+    frame_pause(500000);
 
     for (int i = 0; i < pixels; i++)
     {
         set_pixel(np, i, 0);
-        ws2811_render(np);
-        usleep(tick);
+        render_frame(np, tick);
     }
+
+    return true;
+}
+
+// Per ring position accumulators for timeline tracks
+typedef uint16_t timeline_acc_t[3][GEOMETRY_MAX_PIXELS];
+
+// Q16 easing curves over t in [0, 65536]
+static int32_t timeline_ease(int ease, int32_t t)
+{
+    switch (ease)
+    {
+        case TIMELINE_EASE_IN:
+            return ((int64_t) t * t) >> 16;
+        case TIMELINE_EASE_OUT:
+            return ((int64_t) t * (131072 - t)) >> 16;
+        case TIMELINE_EASE_IN_OUT:
+            return ((int64_t) t * t * (196608 - 2 * t)) >> 32;
+        case TIMELINE_EASE_STEP:
+            return 0;
+    }
+
+    return t;
 }
 
-void random_sweep_effect(ws2811_t* np, active_func active)
+static int32_t timeline_lerp(int32_t a, int32_t b, int32_t t)
 {
-    int n = 11;
-    void (*effects[n]) (ws2811_t*, active_func);
+    return a + (int32_t) (((int64_t) (b - a) * t) >> 16);
+}
+
+// Add one track's marker at this point in the program, in 1/256 frame so
+// motion between keys doesn't step with the frame rate. The head sits at a
+// fractional position and the tail fades out over width, both in 1/256
+// pixel.
+static void timeline_track_draw(timeline_acc_t acc, const timeline_track_t* track, int* cursor, int32_t at, int pixels)
+{
+    int frame = at >> 8;
+
+    while (*cursor + 1 < track->keys && track->key[*cursor + 1].frame <= frame)
+        (*cursor)++;
+
+    const timeline_key_t* a = &track->key[*cursor];
+    const timeline_key_t* b = *cursor + 1 < track->keys ? a + 1 : a;
+
+    int32_t t = 0;
+    if (b != a && at > a->frame << 8)
+        t = timeline_ease(a->ease, (int32_t) (((int64_t) (at - (a->frame << 8)) << 8) / (b->frame - a->frame)));
+
+    int32_t pos = timeline_lerp(a->pos, b->pos, t);
+    int32_t width = timeline_lerp(a->width, b->width, t);
+    int32_t value = timeline_lerp(a->value, b->value, t);
+    int32_t hue = timeline_lerp(a->hue, b->hue, t);
+
+    if (value <= 0)
+        return;
+
+    // Degrees to ring positions, with 8 fractional bits
+    int32_t span = pixels << 8;
+    int32_t head = (int32_t) (((int64_t) pos * span / (360 << TIMELINE_DEGREE_SHIFT)) % span);
+    head = head < 0 ? head + span : head;
+    int32_t tail = (int32_t) ((int64_t) width * span / (360 << TIMELINE_DEGREE_SHIFT));
+    tail = tail > span ? span : tail;
+
+    int color = palette_color(palette_preset(PALETTE_RAINBOW), palette_hue(hue));
+    int r = (color >> 16) & 0xff;
+    int g = (color >> 8) & 0xff;
+    int bl = color & 0xff;
+
+    // Walk from one pixel ahead of the head back to the end of the tail
+    int first = (head >> 8) + 1;
+    int count = ((tail + 255) >> 8) + 2;
+
+    for (int i = 0; i < count && i < pixels; i++)
+    {
+        int idx = first - i;
+        int32_t d = head - (idx << 8);
+        idx = idx < 0 ? idx + pixels : idx;
+        idx = idx >= pixels ? idx - pixels : idx;
+
+        int32_t level;
+        if (d < 0)
+            level = d > -256 ? 256 + d : 0;
+        else if (tail == 0)
+            level = d < 256 ? 256 - d : 0;
+        else
+            level = d < tail ? (int32_t) (((int64_t) (tail - d) << 8) / tail) : 0;
+
+        level = (level * value) >> 8;
+        if (level <= 0)
+            continue;
+
+        acc[0][idx] += (r * level) >> 8;
+        acc[1][idx] += (g * level) >> 8;
+        acc[2][idx] += (bl * level) >> 8;
+    }
+}
+
+// Draw the program as it stands us microseconds into a pass
+static void timeline_frame(ws2811_t* np, timeline_acc_t acc, const timeline_t* t, int* cursors, int64_t us)
+{
+    int pixels = num_pixels(np);
+    int32_t at = (int32_t) MIN(us * 256 / t->tick, (int64_t) (t->frames - 1) << 8);
+
+    memset(acc, 0, sizeof(timeline_acc_t));
+
+    for (int i = 0; i < t->tracks; i++)
+        timeline_track_draw(acc, &t->track[i], &cursors[i], at, pixels);
+
+    for (int i = 0; i < pixels; i++)
+    {
+        int r = MIN(acc[0][i], 255);
+        int g = MIN(acc[1][i], 255);
+        int b = MIN(acc[2][i], 255);
+
+        set_pixel(np, i, rgb2int(r, g, b));
+    }
+
+    render_frame(np, t->tick);
+}
+
+// Play a compiled timeline while active, then let the current pass run out
+// the way the hand written sweeps finish their lap
+void effect_timeline(ws2811_t* np, const timeline_t* t, active_func active)
+{
+    timeline_acc_t acc;
+    effect_clock_t clock;
+    int cursors[TIMELINE_MAX_TRACKS] = { 0 };
+    int64_t length = (int64_t) t->tick * t->frames;
+    int64_t pass = 0;
+    int64_t us;
+
+    clock_start(&clock);
+
+    while (running(active))
+    {
+        us = clock_elapsed(&clock);
+
+        if (t->loop && us / length != pass)
+        {
+            pass = us / length;
+            memset(cursors, 0, sizeof(cursors));
+        }
+
+        timeline_frame(np, acc, t, cursors, us - pass * length);
+    }
 
-    effects[0] = effect_unicorn_dial;
-    effects[1] = effect_comet_dial;
-    effects[2] = effect_comet_color_cycle_dial;
-    effects[3] = effect_comet_rainbow_trail_dial;
-    effects[4] = effect_comet_rainbow_reveal_dial;
-    effects[5] = effect_full_rainbow_reveal_dial;
-    effects[6] = effect_full_color_dial;
-    effects[7] = effect_full_rainbow_wipe_dial;
-    effects[8] = effect_fire_ring;
-    effects[9] = effect_random_fire_ring;
-    effects[10] = random_sweep_effect;
+    while ((us = clock_elapsed(&clock)) < (pass + 1) * length && !is_preempted())
+        timeline_frame(np, acc, t, cursors, us - pass * length);
 
-    effects[rand() % n](np, active);
+    set_all_pixels(np, 0);
+    render_frame(np, TICK);
 }
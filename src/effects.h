@@ -1,17 +1,52 @@
 #ifndef __EFFECTS_H__
 #define __EFFECTS_H__
 
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include <ws2811.h>
 
+#include "delta.h"
+#include "particles.h"
+#include "rng.h"
+#include "timeline.h"
+
 // Effect func typdef
 typedef void (*effect)(ws2811_t* np);
 typedef bool (*active_func)();
+typedef void (*sweep_effect)(ws2811_t* np, active_func active);
+typedef int (*count_func)();
+typedef void (*frame_func)(ws2811_t* np);
+typedef void (*frame_sync_func)(ws2811_t* np, int tick);
+typedef int64_t (*time_func)();
+
+int effects_init(int pixels);
 
 // Utilities
 int rgb2int(int r, int g, int b);
+int num_pixels(ws2811_t* np);
+void set_pixel(ws2811_t* np, int index, uint32_t value);
+void set_all_pixels(ws2811_t* np, uint32_t color);
+void update_pixel(ws2811_t* np, int index, uint32_t value);
+void render_frame(ws2811_t* np, int tick);
+void render_update(ws2811_t* np, int tick);
+void render_delta(ws2811_t* np, const pixel_delta_t* delta, int tick);
+const pixel_delta_t* frame_delta();
+void frame_pause(int us);
+void frame_reset();
+void frame_cost_reset();
+int frame_cost_us();
 int hsv2rgb(int h, double s, double v);
+void effects_seed(uint32_t seed);
+void effect_rng(rng_t* rng);
+void effects_set_preempt(active_func);
+void effects_set_speed(count_func);
+void effects_set_frame_hook(frame_func);
+void effects_stop();
+void effects_set_clock(time_func);
+void effects_bind_zone(const int* map, frame_sync_func sync, particles_t* pool);
+void effects_bind_cut(const atomic_bool* cut);
 
 // Effects
 void effect_clear(ws2811_t*);
@@ -27,7 +62,12 @@ void effect_full_color_dial(ws2811_t*, active_func);
 void effect_full_rainbow_wipe_dial(ws2811_t*, active_func);
 void effect_fire_ring(ws2811_t*, active_func);
 void effect_random_fire_ring(ws2811_t*, active_func);
-void random_sweep_effect(ws2811_t*, active_func);
+void effect_embers(ws2811_t*, active_func);
+void effect_sparks(ws2811_t*, active_func);
+void effect_noise_fire(ws2811_t*, active_func);
+void effect_plasma(ws2811_t*, active_func);
+void effect_aurora(ws2811_t*, active_func);
+void effect_timeline(ws2811_t*, const timeline_t*, active_func);
 
 // Strobe effects
 void effect_strobe(ws2811_t*);
@@ -43,5 +83,6 @@ void effect_rainbow_fixed_twinkle(ws2811_t*);
 
 // Digit hightlight effect
 void effect_dial_digit_highlight(ws2811_t*, int);
+bool effect_dial_digit_stream(ws2811_t*, count_func, active_func);
 
 #endif
@@ -0,0 +1,226 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "geometry.h"
+
+#define GEOMETRY_DEFAULT_PIXELS 43
+
+// About 40 degrees between the dialer stop and number 1, then one finger
+// hole every 32 degrees. This is what the original badge was tuned to.
+#define GEOMETRY_DEFAULT_DIGIT_START 75
+#define GEOMETRY_DEFAULT_DIGIT_STEP 32
+
+// Slack for comparing angles that were computed from a spacing
+#define GEOMETRY_EPSILON 1e-9
+
+static geometry_t geo;
+
+static double wrap_angle(double degrees)
+{
+    degrees = fmod(degrees, 360.0);
+    return degrees < 0 ? degrees + 360.0 : degrees;
+}
+
+static double angle_distance(double a, double b)
+{
+    double d = fabs(a - b);
+    return d > 180.0 ? 360.0 - d : d;
+}
+
+// Turn the per-pixel calibration into the lookup tables effects use
+static void geometry_compile(double digit_start, double digit_step)
+{
+    int n = geo.pixels;
+
+    // Ring order, insertion sort is plenty for a one-off at startup
+    for (int i = 0; i < n; i++)
+    {
+        int j = i;
+        while (j > 0 && geo.angle[geo.ring[j-1]] > geo.angle[i])
+        {
+            geo.ring[j] = geo.ring[j-1];
+            j--;
+        }
+        geo.ring[j] = i;
+    }
+
+    for (int d = 0; d < 360; d++)
+    {
+        int best = 0;
+        for (int p = 1; p < n; p++)
+        {
+            if (angle_distance(geo.angle[geo.ring[p]], d) < angle_distance(geo.angle[geo.ring[best]], d))
+                best = p;
+        }
+        geo.angle_pos[d] = best;
+    }
+
+    // A digit lights every position between its finger hole and the stop,
+    // which is always the tail end of the ring order
+    for (int digit = 0; digit < 10; digit++)
+    {
+        int digit_idx = digit == 0 ? 9 : digit - 1;
+        double arc = digit_start + (digit_idx * digit_step);
+
+        int count = 0;
+        for (int p = n - 1; p >= 0; p--)
+        {
+            if (geo.angle[geo.ring[p]] + GEOMETRY_EPSILON < 360.0 - arc)
+                break;
+            count++;
+        }
+        geo.digit_arc[digit] = count;
+    }
+}
+
+int geometry_load(const char* path)
+{
+    int pixels = GEOMETRY_DEFAULT_PIXELS;
+    double start = 0;
+    double spacing = 0;
+    double radius = 1.0;
+    double digit_start = GEOMETRY_DEFAULT_DIGIT_START;
+    double digit_step = GEOMETRY_DEFAULT_DIGIT_STEP;
+
+    // Per-pixel overrides, applied once we know the pixel count
+    static double angle_override[GEOMETRY_MAX_PIXELS];
+    static double radius_override[GEOMETRY_MAX_PIXELS];
+    static bool overridden[GEOMETRY_MAX_PIXELS];
+    memset(overridden, 0, sizeof(overridden));
+
+    if (path != NULL)
+    {
+        FILE* f = fopen(path, "r");
+        if (f == NULL)
+        {
+            printf("Unable to open geometry file %s\n", path);
+            return 1;
+        }
+
+        char line[256];
+        int lineno = 0;
+        while (fgets(line, sizeof(line), f) != NULL)
+        {
+            lineno++;
+
+            // Strip comments, skip blanks
+            char* hash = strchr(line, '#');
+            if (hash != NULL)
+                *hash = '\0';
+
+            char key[32];
+            if (sscanf(line, "%31s", key) != 1)
+                continue;
+
+            int idx;
+            double a;
+            double r = 1.0;
+            bool ok = true;
+
+            if (strcmp(key, "pixels") == 0)
+                ok = sscanf(line, "%*s %d", &pixels) == 1;
+            else if (strcmp(key, "start") == 0)
+                ok = sscanf(line, "%*s %lf", &start) == 1;
+            else if (strcmp(key, "spacing") == 0)
+                ok = sscanf(line, "%*s %lf", &spacing) == 1;
+            else if (strcmp(key, "radius") == 0)
+                ok = sscanf(line, "%*s %lf", &radius) == 1;
+            else if (strcmp(key, "digit_start") == 0)
+                ok = sscanf(line, "%*s %lf", &digit_start) == 1;
+            else if (strcmp(key, "digit_step") == 0)
+                ok = sscanf(line, "%*s %lf", &digit_step) == 1;
+            else if (strcmp(key, "pixel") == 0)
+            {
+                int found = sscanf(line, "%*s %d %lf %lf", &idx, &a, &r);
+                ok = found >= 2 && idx >= 0 && idx < GEOMETRY_MAX_PIXELS;
+                if (ok)
+                {
+                    angle_override[idx] = a;
+                    radius_override[idx] = found == 3 ? r : -1;
+                    overridden[idx] = true;
+                }
+            }
+            else
+                ok = false;
+
+            if (!ok)
+            {
+                printf("Bad geometry entry at %s:%d\n", path, lineno);
+                fclose(f);
+                return 1;
+            }
+        }
+
+        fclose(f);
+    }
+
+    if (pixels <= 0 || pixels > GEOMETRY_MAX_PIXELS)
+    {
+        printf("Geometry pixel count must be between 1 and %d\n", GEOMETRY_MAX_PIXELS);
+        return 1;
+    }
+
+    // Default to evenly spaced around the whole ring
+    if (spacing == 0)
+        spacing = 360.0 / pixels;
+
+    geo.pixels = pixels;
+    for (int i = 0; i < pixels; i++)
+    {
+        geo.angle[i] = wrap_angle(start + (i * spacing));
+        geo.radius[i] = radius;
+
+        if (overridden[i])
+        {
+            geo.angle[i] = wrap_angle(angle_override[i]);
+            if (radius_override[i] >= 0)
+                geo.radius[i] = radius_override[i];
+        }
+    }
+
+    geometry_compile(digit_start, digit_step);
+    return 0;
+}
+
+// Evenly spaced ring of any size with the default digit layout, for tools
+// that try effects on strips other than the badge's
+int geometry_uniform(int pixels)
+{
+    if (pixels <= 0 || pixels > GEOMETRY_MAX_PIXELS)
+    {
+        printf("Geometry pixel count must be between 1 and %d\n", GEOMETRY_MAX_PIXELS);
+        return 1;
+    }
+
+    geo.pixels = pixels;
+    for (int i = 0; i < pixels; i++)
+    {
+        geo.angle[i] = i * 360.0 / pixels;
+        geo.radius[i] = 1.0;
+    }
+
+    geometry_compile(GEOMETRY_DEFAULT_DIGIT_START, GEOMETRY_DEFAULT_DIGIT_STEP);
+    return 0;
+}
+
+const geometry_t* geometry()
+{
+    return &geo;
+}
+
+int geometry_ring_pixel(int pos)
+{
+    return geo.ring[pos];
+}
+
+int geometry_angle_pos(int degrees)
+{
+    return geo.angle_pos[((degrees % 360) + 360) % 360];
+}
+
+int geometry_digit_arc(int digit)
+{
+    return geo.digit_arc[digit];
+}
@@ -0,0 +1,38 @@
+#ifndef __GEOMETRY_H__
+#define __GEOMETRY_H__
+
+#define GEOMETRY_MAX_PIXELS 1024
+#define GEOMETRY_DEFAULT_FILE "/etc/badge/geometry.conf"
+
+// Physical layout of the ring, compiled into lookup tables once at startup.
+//
+// Angles are degrees measured from the finger stop in the direction the
+// sweep effects travel. Effects address the ring by position (0 is the pixel
+// nearest the stop, then increasing angle) and the tables map that onto the
+// strip, so no effect needs to know how the strip was actually wired.
+typedef struct {
+    int pixels;
+
+    // Calibration, indexed by strip pixel
+    double angle[GEOMETRY_MAX_PIXELS];
+    double radius[GEOMETRY_MAX_PIXELS];
+
+    // Ring position -> strip pixel, sorted by angle
+    int ring[GEOMETRY_MAX_PIXELS];
+
+    // Whole degree -> nearest ring position
+    int angle_pos[360];
+
+    // Digit -> number of ring positions lit, counted back from the stop
+    int digit_arc[10];
+} geometry_t;
+
+int geometry_load(const char* path);
+int geometry_uniform(int pixels);
+const geometry_t* geometry();
+
+int geometry_ring_pixel(int pos);
+int geometry_angle_pos(int degrees);
+int geometry_digit_arc(int digit);
+
+#endif
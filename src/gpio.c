@@ -0,0 +1,119 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <linux/gpio.h>
+
+#include "gpio.h"
+
+// Returns the event fd, or -1 on failure
+int gpio_open_events(int pin, int edges)
+{
+    int chip = open(GPIO_CHIP, O_RDONLY | O_CLOEXEC);
+    if (chip < 0)
+    {
+        printf("Unable to open %s: %s\n", GPIO_CHIP, strerror(errno));
+        return -1;
+    }
+
+    struct gpioevent_request req = {
+        .lineoffset = pin,
+        .handleflags = GPIOHANDLE_REQUEST_INPUT,
+        .eventflags = 0,
+    };
+    strncpy(req.consumer_label, "badge", sizeof(req.consumer_label) - 1);
+
+    if (edges & GPIO_EDGE_RISING)
+        req.eventflags |= GPIOEVENT_REQUEST_RISING_EDGE;
+    if (edges & GPIO_EDGE_FALLING)
+        req.eventflags |= GPIOEVENT_REQUEST_FALLING_EDGE;
+
+    int err = ioctl(chip, GPIO_GET_LINEEVENT_IOCTL, &req);
+    close(chip);
+
+    if (err < 0)
+    {
+        printf("Unable to request events for gpio %d: %s\n", pin, strerror(errno));
+        return -1;
+    }
+
+    fcntl(req.fd, F_SETFL, fcntl(req.fd, F_GETFL) | O_NONBLOCK);
+    return req.fd;
+}
+
+// Returns 1 with an event, 0 when the queue is drained, -1 on error
+int gpio_read_event(int fd, gpio_event_t* event)
+{
+    struct gpioevent_data data;
+
+    ssize_t n = read(fd, &data, sizeof(data));
+    if (n < 0)
+        return errno == EAGAIN || errno == EINTR ? 0 : -1;
+    if (n != sizeof(data))
+        return -1;
+
+    event->timestamp = data.timestamp;
+    event->rising = data.id == GPIOEVENT_EVENT_RISING_EDGE;
+    return 1;
+}
+
+// Returns a handle fd for reading all the pins at once, or -1 on failure
+int gpio_open_inputs(const int* pins, int count)
+{
+    if (count > GPIOHANDLES_MAX)
+        return -1;
+
+    int chip = open(GPIO_CHIP, O_RDONLY | O_CLOEXEC);
+    if (chip < 0)
+    {
+        printf("Unable to open %s: %s\n", GPIO_CHIP, strerror(errno));
+        return -1;
+    }
+
+    struct gpiohandle_request req = {
+        .flags = GPIOHANDLE_REQUEST_INPUT,
+        .lines = count,
+    };
+    strncpy(req.consumer_label, "badge", sizeof(req.consumer_label) - 1);
+
+    for (int i = 0; i < count; i++)
+        req.lineoffsets[i] = pins[i];
+
+    int err = ioctl(chip, GPIO_GET_LINEHANDLE_IOCTL, &req);
+    close(chip);
+
+    if (err < 0)
+    {
+        printf("Unable to request gpio inputs: %s\n", strerror(errno));
+        return -1;
+    }
+
+    return req.fd;
+}
+
+// Levels of every pin the handle was opened with, in the same order
+int gpio_get_values(int fd, uint8_t* values, int count)
+{
+    struct gpiohandle_data data;
+
+    if (ioctl(fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data) < 0)
+        return -1;
+
+    memcpy(values, data.values, count);
+    return 0;
+}
+
+// Current level of the line, or -1 on error
+int gpio_get_value(int fd)
+{
+    struct gpiohandle_data data;
+
+    if (ioctl(fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data) < 0)
+        return -1;
+
+    return data.values[0];
+}
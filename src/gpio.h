@@ -0,0 +1,30 @@
+#ifndef __GPIO_H__
+#define __GPIO_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define GPIO_CHIP "/dev/gpiochip0"
+
+#define GPIO_EDGE_RISING 1
+#define GPIO_EDGE_FALLING 2
+#define GPIO_EDGE_BOTH (GPIO_EDGE_RISING | GPIO_EDGE_FALLING)
+
+// Edge events from the kernel GPIO character device. Each pin gets its own
+// non-blocking fd that becomes readable when an edge is queued, so the
+// dialer can wait on them in the same epoll set as everything else.
+typedef struct {
+    // Nanoseconds, stamped by the kernel when the edge interrupt fired
+    int64_t timestamp;
+    bool rising;
+} gpio_event_t;
+
+int gpio_open_events(int pin, int edges);
+int gpio_read_event(int fd, gpio_event_t* event);
+int gpio_get_value(int fd);
+
+// Plain inputs, any number of pins read together with one call
+int gpio_open_inputs(const int* pins, int count);
+int gpio_get_values(int fd, uint8_t* values, int count);
+
+#endif
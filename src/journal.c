@@ -0,0 +1,183 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "journal.h"
+#include "shutdown.h"
+
+#define JOURNAL_SIZE (JOURNAL_HEADER_SIZE + JOURNAL_RECORDS * sizeof(journal_record_t))
+
+_Static_assert(sizeof(journal_record_t) == 32, "journal records must stay 32 bytes");
+_Static_assert(JOURNAL_HEADER_SIZE % sizeof(journal_record_t) == 0, "records must not straddle pages");
+
+static uint8_t* map = NULL;
+static journal_record_t* ring = NULL;
+static uint64_t next_seq = 1;
+
+static pthread_t syncer;
+static pthread_mutex_t sync_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sync_wake = PTHREAD_COND_INITIALIZER;
+static bool closing = false;
+static atomic_bool dirty = false;
+
+static void put_u32(uint8_t* p, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        p[i] = value >> (8 * i);
+}
+
+static uint32_t get_u32(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static void* syncer_main(void* arg)
+{
+    pthread_mutex_lock(&sync_lock);
+
+    while (!closing)
+    {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += JOURNAL_SYNC_SEC;
+
+        pthread_cond_timedwait(&sync_wake, &sync_lock, &until);
+
+        if (atomic_exchange(&dirty, false))
+            msync(map, JOURNAL_SIZE, MS_SYNC);
+    }
+
+    pthread_mutex_unlock(&sync_lock);
+    return arg;
+}
+
+// Carry on from the newest valid record
+static void journal_recover()
+{
+    uint64_t newest = 0;
+
+    for (int i = 0; i < JOURNAL_RECORDS; i++)
+    {
+        if (journal_valid(&ring[i]) && ring[i].seq > newest)
+            newest = ring[i].seq;
+    }
+
+    next_seq = newest + 1;
+}
+
+int journal_open(const char* path)
+{
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        printf("Unable to open journal %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    struct stat st;
+    bool fresh = fstat(fd, &st) == 0 && st.st_size == 0;
+
+    if (!fresh && st.st_size != (off_t) JOURNAL_SIZE)
+    {
+        printf("%s is not a dial journal\n", path);
+        close(fd);
+        return 1;
+    }
+
+    if (fresh && ftruncate(fd, JOURNAL_SIZE) != 0)
+    {
+        printf("Unable to size journal %s: %s\n", path, strerror(errno));
+        close(fd);
+        return 1;
+    }
+
+    map = mmap(NULL, JOURNAL_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+    {
+        printf("Unable to map journal %s: %s\n", path, strerror(errno));
+        map = NULL;
+        return 1;
+    }
+
+    if (fresh)
+    {
+        put_u32(map, JOURNAL_MAGIC);
+        put_u32(map + 4, JOURNAL_VERSION);
+        put_u32(map + 8, sizeof(journal_record_t));
+        put_u32(map + 12, JOURNAL_RECORDS);
+        msync(map, JOURNAL_HEADER_SIZE, MS_SYNC);
+    }
+    else if (get_u32(map) != JOURNAL_MAGIC || get_u32(map + 4) != JOURNAL_VERSION
+             || get_u32(map + 8) != sizeof(journal_record_t) || get_u32(map + 12) != JOURNAL_RECORDS)
+    {
+        printf("%s is not a dial journal this badge can write\n", path);
+        munmap(map, JOURNAL_SIZE);
+        map = NULL;
+        return 1;
+    }
+
+    ring = (journal_record_t*) (map + JOURNAL_HEADER_SIZE);
+    journal_recover();
+
+    closing = false;
+    if (pthread_create(&syncer, NULL, syncer_main, NULL) != 0)
+    {
+        munmap(map, JOURNAL_SIZE);
+        map = NULL;
+        return 1;
+    }
+
+    return 0;
+}
+
+void journal_close()
+{
+    if (map == NULL)
+        return;
+
+    pthread_mutex_lock(&sync_lock);
+    closing = true;
+    pthread_cond_signal(&sync_wake);
+    pthread_mutex_unlock(&sync_lock);
+    ring = NULL;
+
+    // The syncer may be stuck in a slow msync, then it keeps the mapping.
+    // Otherwise only start the write back, the pages outlive the process
+    // anyway and waiting on the SD card would blow the shutdown budget.
+    if (shutdown_join(syncer, "journal") == 0)
+    {
+        msync(map, JOURNAL_SIZE, MS_ASYNC);
+        munmap(map, JOURNAL_SIZE);
+    }
+
+    map = NULL;
+}
+
+// Fills in seq, timestamp and checksum. Does nothing without a journal.
+void journal_append(journal_record_t* record)
+{
+    if (ring == NULL)
+        return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    record->seq = next_seq++;
+    record->timestamp_us = (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    record->reserved = 0;
+    record->checksum = journal_checksum(record);
+
+    ring[(record->seq - 1) % JOURNAL_RECORDS] = *record;
+    atomic_store(&dirty, true);
+}
@@ -0,0 +1,73 @@
+#ifndef __JOURNAL_H__
+#define __JOURNAL_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Dial event journal, a fixed size ring of records in a memory mapped file
+// so it lasts across restarts. Appending is a handful of plain stores into
+// the mapping, the kernel writes pages back and a background thread calls
+// msync every JOURNAL_SYNC_SEC.
+//
+// The file is a JOURNAL_HEADER_SIZE byte header
+//
+//   u32 magic         JOURNAL_MAGIC
+//   u32 version       JOURNAL_VERSION
+//   u32 record size   sizeof(journal_record_t)
+//   u32 records       ring capacity
+//
+// followed by the ring of records, all little-endian, the Pi's own byte
+// order, so records are written as they are in memory. There is no head
+// pointer to tear: a record counts only if its checksum matches, and the
+// newest is the valid one with the highest seq. A crash halfway through
+// writing a record loses that record and nothing else.
+#define JOURNAL_MAGIC 0x4c4e524a
+#define JOURNAL_VERSION 1
+#define JOURNAL_HEADER_SIZE 4096
+#define JOURNAL_RECORDS 4096
+#define JOURNAL_SYNC_SEC 5
+#define JOURNAL_DEFAULT_FILE "/var/lib/badge/journal"
+
+typedef enum {
+    JOURNAL_DIAL,
+    JOURNAL_INJECTED,
+} journal_type_t;
+
+// 32 bytes, so records never straddle a page
+typedef struct {
+    uint64_t seq;              // from 1, 0 is an empty slot
+    int64_t timestamp_us;      // wall clock
+    uint8_t type;
+    uint8_t digit;
+    uint8_t pulses;
+    int8_t effect;             // registry index of the sweep, -1 for none or zones
+    uint16_t rate_cpps;        // pulses per 100 seconds, 0 if not measured
+    uint8_t break_pct;
+    uint8_t reserved;
+    uint32_t jitter_us;
+    uint32_t checksum;         // journal_checksum() of everything before it
+} journal_record_t;
+
+// FNV-1a over the record up to the checksum
+static inline uint32_t journal_checksum(const journal_record_t* r)
+{
+    const uint8_t* p = (const uint8_t*) r;
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < offsetof(journal_record_t, checksum); i++)
+        hash = (hash ^ p[i]) * 16777619u;
+
+    return hash;
+}
+
+static inline bool journal_valid(const journal_record_t* r)
+{
+    return r->seq != 0 && r->checksum == journal_checksum(r);
+}
+
+int journal_open(const char* path);
+void journal_close();
+void journal_append(journal_record_t* record);
+
+#endif
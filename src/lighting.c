@@ -0,0 +1,556 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <ws2811.h>
+
+#include "effects.h"
+#include "geometry.h"
+#include "dialstats.h"
+#include "lighting.h"
+#include "power.h"
+#include "registry.h"
+#include "rt.h"
+#include "shutdown.h"
+#include "sink.h"
+#include "transition.h"
+#include "zones.h"
+
+#define LED_SIGNAL_PIN 21
+#define LED_DEFAULT_BRIGHTNESS 50
+#define LED_FREQ_HZ 1000000
+
+#define LIGHTING_MAX_JOBS 16
+
+// Ring slots a batch can't take, so a dial begun while one is staged still
+// gets in
+#define LIGHTING_DIAL_SLOTS 1
+
+// Bounds on how far the dial can change the sweep speed, 256 is normal
+#define LIGHTING_MIN_SPEED 128
+#define LIGHTING_MAX_SPEED 512
+
+typedef enum {
+    LIGHTING_JOB_DIAL,
+    LIGHTING_JOB_EFFECT,
+    LIGHTING_JOB_DIGIT,
+} lighting_job_type_t;
+
+typedef struct {
+    lighting_job_type_t type;
+    int arg;
+    int duration_ms;
+
+    // When a triggered effect should stop, monotonic microseconds
+    int64_t until;
+} lighting_job_t;
+
+// Neopixel struct, static so the steady state never touches the heap
+static ws2811_t strip;
+static ws2811_t* np = NULL;
+
+static pthread_t worker;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static bool stopping = false;
+
+// Jobs waiting for the worker, a ring guarded by lock
+static lighting_job_t jobs[LIGHTING_MAX_JOBS];
+static int jobs_head = 0;
+static int jobs_count = 0;
+
+// Command batch waiting for the next frame boundary, guarded by lock
+static lighting_cmd_t batch[LIGHTING_MAX_BATCH];
+static int batch_count = 0;
+static atomic_bool batch_ready = false;
+
+// Ring slots kept for the jobs in the staged batch, and how many batches
+// were merged into it, guarded by lock
+static int batch_jobs = 0;
+static unsigned batches_staged = 0;
+
+// Batches applied so far, and who to tell when more are
+static atomic_uint batches_landed = 0;
+static lighting_batch_hook_t batch_hook = NULL;
+
+// Dial state posted by the input loop, read every frame
+static atomic_bool dialing = false;
+static atomic_int pulses = 0;
+
+// Registry index of the sweep the last dial ran, -1 for zones
+static atomic_int dial_effect = -1;
+
+// How fast the dial returns, pulses per 1000 seconds, 0 until measured
+static atomic_int dial_rate = 0;
+
+// What the worker is doing, for status queries
+static atomic_int current_job = LIGHTING_IDLE;
+
+// Jobs on the transition layers and the layer of the newest one, only the
+// worker touches these
+static lighting_job_t layer_jobs[TRANSITION_LAYERS];
+static int front = -1;
+
+// When the triggered effect on this thread should stop
+static __thread int64_t effect_until = 0;
+
+static int64_t now_us()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static bool is_dialing()
+{
+    return atomic_load(&dialing);
+}
+
+static int decoded_pulses()
+{
+    return atomic_load(&pulses);
+}
+
+static bool has_pulses()
+{
+    return atomic_load(&pulses) > 0;
+}
+
+// Sweeps go round faster or slower with the physical dial, in 1/256 of
+// their normal speed
+static int sweep_speed()
+{
+    int rate = atomic_load(&dial_rate);
+    if (rate == 0)
+        return 256;
+
+    int speed = (int) ((int64_t) rate * 256 / (DIALSTATS_NOMINAL_PPS * 1000));
+    return speed < LIGHTING_MIN_SPEED ? LIGHTING_MIN_SPEED : speed > LIGHTING_MAX_SPEED ? LIGHTING_MAX_SPEED : speed;
+}
+
+// The sweep only runs while the dial is being wound, as soon as it starts
+// returning the digit highlight takes over
+static bool is_dial_winding()
+{
+    return is_dialing() && !has_pulses();
+}
+
+// Triggered effects give way to the real dial
+static bool is_effect_active()
+{
+    return !is_dialing() && now_us() < effect_until;
+}
+
+// Call with lock held
+static void enqueue(lighting_job_t job)
+{
+    if (jobs_count == LIGHTING_MAX_JOBS)
+        return;
+
+    jobs[(jobs_head + jobs_count) % LIGHTING_MAX_JOBS] = job;
+    jobs_count++;
+    pthread_cond_signal(&wake);
+}
+
+// Call with lock held. Everything in the batch lands together, between two
+// frames, so a batch never shows up half applied.
+static void apply_batch()
+{
+    for (int i = 0; i < batch_count; i++)
+    {
+        lighting_cmd_t* cmd = &batch[i];
+
+        switch (cmd->type)
+        {
+            case LIGHTING_CMD_EFFECT:
+                enqueue((lighting_job_t) { LIGHTING_JOB_EFFECT, cmd->arg, cmd->value, 0 });
+                break;
+            case LIGHTING_CMD_DIGIT:
+                enqueue((lighting_job_t) { LIGHTING_JOB_DIGIT, cmd->arg, 0, 0 });
+                break;
+            case LIGHTING_CMD_BRIGHTNESS:
+                power_set_brightness(np, cmd->value);
+                break;
+            case LIGHTING_CMD_POWER_BUDGET:
+                power_set_budget(cmd->value);
+                break;
+            case LIGHTING_CMD_SEED:
+                effects_seed(cmd->value);
+                break;
+            case LIGHTING_CMD_TRANSITION:
+                transition_set_ms(cmd->value);
+                break;
+        }
+    }
+
+    batch_count = 0;
+    batch_jobs = 0;
+    atomic_store(&batch_ready, false);
+
+    atomic_fetch_add(&batches_landed, batches_staged);
+    batches_staged = 0;
+    if (batch_hook != NULL)
+        batch_hook();
+}
+
+// Frame hook, a single atomic load unless a batch is waiting
+static void on_frame(ws2811_t* frame)
+{
+    if (!atomic_load_explicit(&batch_ready, memory_order_acquire))
+        return;
+
+    pthread_mutex_lock(&lock);
+    apply_batch();
+    pthread_mutex_unlock(&lock);
+}
+
+static void run_dial(ws2811_t* target)
+{
+    if (zones_count() > 0)
+    {
+        atomic_store(&dial_effect, -1);
+        zones_run(target, is_dial_winding);
+    }
+    else
+    {
+        int index = registry_pick(EFFECT_KIND_SWEEP);
+        atomic_store(&dial_effect, index);
+        registry_run(index, target, is_dial_winding);
+    }
+
+    // Grow the digit highlight pulse by pulse while the dial returns
+    if (!effect_dial_digit_stream(target, decoded_pulses, is_dialing))
+        effect_clear(target);
+}
+
+// Runs on whichever thread draws into target
+static void run_job(lighting_job_t* job, ws2811_t* target)
+{
+    switch (job->type)
+    {
+        case LIGHTING_JOB_DIAL:
+            run_dial(target);
+            break;
+        case LIGHTING_JOB_EFFECT:
+            effect_until = job->until;
+            registry_run(job->arg, target, is_effect_active);
+            break;
+        case LIGHTING_JOB_DIGIT:
+            effect_dial_digit_highlight(target, job->arg);
+            break;
+    }
+}
+
+static void run_layer(ws2811_t* target, void* arg)
+{
+    run_job(arg, target);
+}
+
+// Whether a job still needs the strip to itself. Once it doesn't, whatever
+// it has left is a wind-down the next job can fade in over. A dial's digit
+// is confirmed, held and cleared after the dial is over, none of which is
+// a wind-down, so it keeps the strip until it returns.
+static bool job_holds(const lighting_job_t* job)
+{
+    switch (job->type)
+    {
+        case LIGHTING_JOB_EFFECT:
+            return !is_dialing() && now_us() < job->until;
+        case LIGHTING_JOB_DIAL:
+        case LIGHTING_JOB_DIGIT:
+            return true;
+    }
+
+    return false;
+}
+
+// Call with lock held
+static lighting_job_t next_job()
+{
+    lighting_job_t job = jobs[jobs_head];
+    jobs_head = (jobs_head + 1) % LIGHTING_MAX_JOBS;
+    jobs_count--;
+
+    job.until = now_us() + (int64_t) job.duration_ms * 1000;
+    atomic_store(&current_job, job.type == LIGHTING_JOB_EFFECT ? job.arg : LIGHTING_DIALING);
+
+    return job;
+}
+
+// Call with lock held. The next job can go on a layer once the one showing
+// lets go of the strip, and only one fade runs at a time.
+static bool can_start()
+{
+    if (jobs_count == 0 || transition_fading() || transition_free() < 0)
+        return false;
+
+    return front < 0 || !transition_busy(front) || !job_holds(&layer_jobs[front]);
+}
+
+// Zone shows draw straight into the strip, so with zones every job runs
+// here on its own, one after the other
+static void run_direct()
+{
+    pthread_mutex_lock(&lock);
+    while (!stopping)
+    {
+        // No frames go out while idle, so land batches here instead
+        if (atomic_load(&batch_ready))
+            apply_batch();
+
+        if (jobs_count == 0)
+        {
+            pthread_cond_wait(&wake, &lock);
+            continue;
+        }
+
+        lighting_job_t job = next_job();
+        pthread_mutex_unlock(&lock);
+
+        // The strip sat idle since the last job, that's not a missed frame
+        frame_reset();
+        run_job(&job, np);
+        atomic_store(&current_job, LIGHTING_IDLE);
+
+        pthread_mutex_lock(&lock);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+// Otherwise jobs run on the transition layers and this thread shows their
+// frames, fading from one job to the next instead of waiting for it
+static void run_layers()
+{
+    pthread_mutex_lock(&lock);
+    while (!stopping)
+    {
+        if (atomic_load(&batch_ready))
+            apply_batch();
+
+        if (can_start())
+        {
+            if (transition_running() == 0)
+                frame_reset();
+
+            front = transition_free();
+            layer_jobs[front] = next_job();
+            transition_begin(front, run_layer, &layer_jobs[front]);
+            continue;
+        }
+
+        if (transition_running() == 0)
+        {
+            atomic_store(&current_job, LIGHTING_IDLE);
+            pthread_cond_wait(&wake, &lock);
+            continue;
+        }
+
+        pthread_mutex_unlock(&lock);
+        transition_frame(np);
+        pthread_mutex_lock(&lock);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+static void* lighting_main(void* arg)
+{
+    rt_thread(RT_ROLE_FRAME);
+
+    if (zones_count() > 0)
+        run_direct();
+    else
+        run_layers();
+
+    return arg;
+}
+
+int lighting_start()
+{
+    np = &strip;
+
+    // Initialize
+    np->render_wait_time = 0;
+    np->freq = LED_FREQ_HZ;
+    np->dmanum = 10;
+    np->channel[0] = (ws2811_channel_t) {
+       .gpionum = LED_SIGNAL_PIN,
+       .count = geometry()->pixels,
+       .invert = 0,
+       .brightness = LED_DEFAULT_BRIGHTNESS,
+       .strip_type = WS2811_STRIP_GRB,
+    };
+
+    zones_configure(np);
+    power_init(np);
+
+    // Carve all effect state up front for this strip
+    if (effects_init(geometry()->pixels) != 0)
+        return 1;
+    registry_init();
+
+    // Different show on every boot
+    effects_seed(time(NULL));
+    effects_set_preempt(has_pulses);
+    effects_set_speed(sweep_speed);
+    effects_set_frame_hook(on_frame);
+
+    // Initialize and clear
+    if (ws2811_init(np) != WS2811_SUCCESS)
+    {
+        printf("Unable to initialize the strip\n");
+        return 1;
+    }
+    sinks_start();
+    effect_clear(np);
+
+    if (zones_start(np) != 0)
+    {
+        sinks_stop();
+        ws2811_fini(np);
+        return 1;
+    }
+
+    if (zones_count() == 0 && transition_start(np) != 0)
+    {
+        sinks_stop();
+        ws2811_fini(np);
+        return 1;
+    }
+
+    if (pthread_create(&worker, NULL, lighting_main, NULL) != 0)
+    {
+        transition_stop();
+        zones_stop();
+        sinks_stop();
+        ws2811_fini(np);
+        return 1;
+    }
+
+    return 0;
+}
+
+// Cut whatever is running short, then blank and release the strip. If the
+// worker doesn't stop in time it may still be inside a render, so the strip
+// is left as it is rather than freed under it.
+void lighting_stop()
+{
+    if (np == NULL)
+        return;
+
+    atomic_store(&dialing, false);
+    effects_stop();
+
+    // Queued jobs would only run out straight away, drop them
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    jobs_count = 0;
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+
+    bool stopped = transition_stop() == 0;
+    bool worker_stopped = shutdown_join(worker, "lighting") == 0;
+    stopped = zones_stop() == 0 && worker_stopped && stopped;
+
+    if (stopped)
+    {
+        // A single blank frame, there's no time for a wipe
+        set_all_pixels(np, 0);
+        ws2811_render(np);
+        ws2811_fini(np);
+    }
+
+    // A worker left behind may still publish frames to the sinks
+    if (worker_stopped)
+        sinks_stop();
+    np = NULL;
+}
+
+void lighting_dial_begin()
+{
+    atomic_store(&pulses, 0);
+    atomic_store(&dialing, true);
+
+    // The staged batch's jobs have their slots already
+    pthread_mutex_lock(&lock);
+    if (jobs_count + batch_jobs < LIGHTING_MAX_JOBS)
+        enqueue((lighting_job_t) { LIGHTING_JOB_DIAL, 0, 0, 0 });
+    pthread_mutex_unlock(&lock);
+}
+
+void lighting_dial_pulses(int decoded)
+{
+    atomic_store(&pulses, decoded);
+}
+
+// The worker reads the final pulse count when it sees this
+void lighting_dial_end()
+{
+    atomic_store(&dialing, false);
+}
+
+// Stage a batch to be applied at the next frame boundary. Fails if it
+// doesn't fit behind batches that haven't landed yet, or the jobs it
+// starts wouldn't fit in the ring, so a batch is never applied in part.
+int lighting_post_batch(const lighting_cmd_t* cmds, int count)
+{
+    int new_jobs = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (cmds[i].type == LIGHTING_CMD_EFFECT || cmds[i].type == LIGHTING_CMD_DIGIT)
+            new_jobs++;
+    }
+
+    pthread_mutex_lock(&lock);
+
+    if (batch_count + count > LIGHTING_MAX_BATCH
+        || jobs_count + batch_jobs + new_jobs > LIGHTING_MAX_JOBS - LIGHTING_DIAL_SLOTS)
+    {
+        pthread_mutex_unlock(&lock);
+        return 1;
+    }
+
+    for (int i = 0; i < count; i++)
+        batch[batch_count++] = cmds[i];
+    batch_jobs += new_jobs;
+    batches_staged++;
+
+    atomic_store_explicit(&batch_ready, true, memory_order_release);
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+
+    return 0;
+}
+
+// How many posted batches have been applied, counting from 0
+unsigned lighting_batches_landed()
+{
+    return atomic_load(&batches_landed);
+}
+
+// The hook runs on the lighting thread with the lock held, it must not
+// block or call back in here
+void lighting_set_batch_hook(lighting_batch_hook_t hook)
+{
+    pthread_mutex_lock(&lock);
+    batch_hook = hook;
+    pthread_mutex_unlock(&lock);
+}
+
+void lighting_dial_rate(int milli_pps)
+{
+    atomic_store(&dial_rate, milli_pps);
+}
+
+int lighting_dial_effect()
+{
+    return atomic_load(&dial_effect);
+}
+
+// LIGHTING_IDLE, LIGHTING_DIALING or the index of a triggered effect
+int lighting_current()
+{
+    return atomic_load(&current_job);
+}
@@ -0,0 +1,48 @@
+#ifndef __LIGHTING_H__
+#define __LIGHTING_H__
+
+#include <stdbool.h>
+
+#define LIGHTING_MAX_BATCH 64
+
+// Reported by lighting_current() when no triggered effect is running
+#define LIGHTING_IDLE -1
+#define LIGHTING_DIALING -2
+
+// Commands from outside the dial, applied together at a frame boundary
+typedef enum {
+    LIGHTING_CMD_EFFECT,
+    LIGHTING_CMD_DIGIT,
+    LIGHTING_CMD_BRIGHTNESS,
+    LIGHTING_CMD_SEED,
+    LIGHTING_CMD_POWER_BUDGET,
+    LIGHTING_CMD_TRANSITION,
+} lighting_cmd_type_t;
+
+typedef struct {
+    lighting_cmd_type_t type;
+    int arg;
+    int value;
+} lighting_cmd_t;
+
+// Told whenever posted batches have been applied
+typedef void (*lighting_batch_hook_t)();
+
+// The lighting worker owns the strip and runs effects on its own thread.
+// The input loop only ever posts state changes here, it never waits on a
+// frame.
+int lighting_start();
+void lighting_stop();
+
+void lighting_dial_begin();
+void lighting_dial_pulses(int decoded);
+void lighting_dial_end();
+void lighting_dial_rate(int milli_pps);
+int lighting_dial_effect();
+
+int lighting_post_batch(const lighting_cmd_t* cmds, int count);
+unsigned lighting_batches_landed();
+void lighting_set_batch_hook(lighting_batch_hook_t hook);
+int lighting_current();
+
+#endif
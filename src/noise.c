@@ -0,0 +1,99 @@
+#include <math.h>
+#include <stdint.h>
+
+#include "noise.h"
+#include "rng.h"
+
+// The tables come out the same on every badge
+#define NOISE_TABLE_SEED 0x2c1b3c6d
+
+// Lattice hashes, doubled so perm[perm[x] + y] never needs wrapping
+static uint8_t perm[2 * NOISE_CELLS];
+
+// Unit gradient for each hash, in 1/NOISE_ONE
+static int16_t grad_x[NOISE_CELLS];
+static int16_t grad_y[NOISE_CELLS];
+
+// 6t^5 - 15t^4 + 10t^3 for every fraction of a cell, so the noise has no
+// creases at the cell edges
+static int16_t fade[NOISE_ONE + 1];
+
+void noise_init()
+{
+    rng_t rng;
+    rng_seed(&rng, NOISE_TABLE_SEED);
+
+    for (int i = 0; i < NOISE_CELLS; i++)
+        perm[i] = i;
+
+    for (int i = NOISE_CELLS - 1; i > 0; i--)
+    {
+        int j = rng_next(&rng) % (i + 1);
+        uint8_t swap = perm[i];
+
+        perm[i] = perm[j];
+        perm[j] = swap;
+    }
+
+    for (int i = 0; i < NOISE_CELLS; i++)
+    {
+        double angle = 2 * M_PI * i / NOISE_CELLS;
+
+        perm[NOISE_CELLS + i] = perm[i];
+        grad_x[i] = (int16_t) lround(cos(angle) * NOISE_ONE);
+        grad_y[i] = (int16_t) lround(sin(angle) * NOISE_ONE);
+    }
+
+    for (int f = 0; f <= NOISE_ONE; f++)
+    {
+        double t = (double) f / NOISE_ONE;
+        fade[f] = (int16_t) lround(t * t * t * (t * (t * 6 - 15) + 10) * NOISE_ONE);
+    }
+}
+
+static inline int32_t lerp(int32_t a, int32_t b, int32_t t)
+{
+    return a + (((b - a) * t) >> NOISE_SHIFT);
+}
+
+// Along one axis, wrapping every NOISE_CELLS cells
+int noise1(int32_t x)
+{
+    int xi = (x >> NOISE_SHIFT) & (NOISE_CELLS - 1);
+    int32_t fx = x & (NOISE_ONE - 1);
+
+    int32_t a = grad_x[perm[xi]] * fx;
+    int32_t b = grad_x[perm[xi + 1]] * (fx - NOISE_ONE);
+
+    // One dimensional gradient noise stays within half a unit
+    return lerp(a, b, fade[fx]) >> (NOISE_SHIFT - 1);
+}
+
+// Over a plane that wraps every period cells along x, at most NOISE_CELLS,
+// so a ring of pixels can go round it without a seam. y wraps every
+// NOISE_CELLS cells.
+int noise2(int32_t x, int32_t y, int period)
+{
+    int32_t fx = x & (NOISE_ONE - 1);
+    int32_t fy = y & (NOISE_ONE - 1);
+
+    int x0 = (x >> NOISE_SHIFT) % period;
+    x0 = x0 < 0 ? x0 + period : x0;
+    int x1 = x0 + 1 == period ? 0 : x0 + 1;
+    int y0 = (y >> NOISE_SHIFT) & (NOISE_CELLS - 1);
+
+    int h0 = perm[x0];
+    int h1 = perm[x1];
+
+    int32_t n00 = grad_x[perm[h0 + y0]] * fx + grad_y[perm[h0 + y0]] * fy;
+    int32_t n10 = grad_x[perm[h1 + y0]] * (fx - NOISE_ONE) + grad_y[perm[h1 + y0]] * fy;
+    int32_t n01 = grad_x[perm[h0 + y0 + 1]] * fx + grad_y[perm[h0 + y0 + 1]] * (fy - NOISE_ONE);
+    int32_t n11 = grad_x[perm[h1 + y0 + 1]] * (fx - NOISE_ONE) + grad_y[perm[h1 + y0 + 1]] * (fy - NOISE_ONE);
+
+    int32_t u = fade[fx];
+    int32_t n = lerp(lerp(n00, n10, u), lerp(n01, n11, u), fade[fy]);
+
+    // Two dimensional gradient noise stays within about 0.7 of a unit,
+    // stretch that out to the full range
+    return (n * 362) >> (2 * NOISE_SHIFT);
+}
@@ -0,0 +1,21 @@
+#ifndef __NOISE_H__
+#define __NOISE_H__
+
+#include <stdint.h>
+
+// Coherent gradient noise, evaluated in integers from tables built once at
+// startup. Coordinates are in 1/NOISE_ONE of a lattice cell and the result
+// runs from about -NOISE_ONE to NOISE_ONE, changing smoothly with both.
+#define NOISE_SHIFT 8
+#define NOISE_ONE (1 << NOISE_SHIFT)
+#define NOISE_CELLS 256
+
+// Most CPU cycles a noise effect may spend on one pixel of a frame, the
+// bench holds them to it
+#define NOISE_PIXEL_CYCLES 400
+
+void noise_init();
+int noise1(int32_t x);
+int noise2(int32_t x, int32_t y, int period);
+
+#endif
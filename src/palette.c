@@ -0,0 +1,111 @@
+#include <stdint.h>
+
+#include <ws2811.h>
+
+#include "effects.h"
+#include "palette.h"
+
+static palette_t presets[PALETTE_PRESETS];
+
+static const palette_stop_t fire_stops[] = {
+    { 0,   0x000000 },
+    { 64,  0x800000 },
+    { 128, 0xff3000 },
+    { 192, 0xffa000 },
+    { 255, 0xffff80 },
+};
+
+static const palette_stop_t ocean_stops[] = {
+    { 0,   0x000030 },
+    { 96,  0x0040c0 },
+    { 160, 0x00a0ff },
+    { 224, 0x80ffff },
+    { 255, 0x000030 },
+};
+
+static const palette_stop_t forest_stops[] = {
+    { 0,   0x002000 },
+    { 80,  0x208000 },
+    { 160, 0x80c000 },
+    { 208, 0x406000 },
+    { 255, 0x002000 },
+};
+
+static const palette_stop_t aurora_stops[] = {
+    { 0,   0x00ff40 },
+    { 96,  0x00ffa0 },
+    { 160, 0x0060ff },
+    { 224, 0x8000ff },
+    { 255, 0xff0080 },
+};
+
+#define STOPS(s) (s), (int) (sizeof(s) / sizeof((s)[0]))
+
+// Build the presets, the only place palettes are made from HSV
+void palette_init()
+{
+    for (int i = 0; i < PALETTE_SIZE; i++)
+        presets[PALETTE_RAINBOW].color[i] = hsv2rgb(i * 360 / PALETTE_SIZE, 1.0, 1.0);
+
+    palette_gradient(&presets[PALETTE_FIRE], STOPS(fire_stops));
+    palette_gradient(&presets[PALETTE_OCEAN], STOPS(ocean_stops));
+    palette_gradient(&presets[PALETTE_FOREST], STOPS(forest_stops));
+    palette_gradient(&presets[PALETTE_AURORA], STOPS(aurora_stops));
+}
+
+const palette_t* palette_preset(palette_preset_t preset)
+{
+    return &presets[preset];
+}
+
+static uint32_t mix(uint32_t a, uint32_t b, int amount)
+{
+    int r = (a >> 16) & 0xff;
+    int g = (a >> 8) & 0xff;
+    int bl = a & 0xff;
+
+    r += ((((int) (b >> 16) & 0xff) - r) * amount) >> 8;
+    g += ((((int) (b >> 8) & 0xff) - g) * amount) >> 8;
+    bl += ((((int) b & 0xff) - bl) * amount) >> 8;
+
+    return rgb2int(r, g, bl);
+}
+
+// Linear gradient through stops given in index order. Indexes before the
+// first stop or after the last one take its colour.
+void palette_gradient(palette_t* p, const palette_stop_t* stops, int count)
+{
+    int s = 0;
+
+    for (int i = 0; i < PALETTE_SIZE; i++)
+    {
+        while (s + 1 < count && stops[s + 1].index <= i)
+            s++;
+
+        if (i <= stops[0].index || s + 1 == count)
+        {
+            p->color[i] = i <= stops[0].index ? stops[0].color : stops[s].color;
+            continue;
+        }
+
+        const palette_stop_t* a = &stops[s];
+        const palette_stop_t* b = &stops[s + 1];
+        p->color[i] = mix(a->color, b->color, ((i - a->index) << 8) / (b->index - a->index));
+    }
+}
+
+// Mix two palettes, 0 is all a and 256 all b. out may be either input.
+void palette_blend(palette_t* out, const palette_t* a, const palette_t* b, int amount)
+{
+    for (int i = 0; i < PALETTE_SIZE; i++)
+        out->color[i] = mix(a->color[i], b->color[i], amount);
+}
+
+// Spread the palette over the whole ring
+void palette_fill(ws2811_t* np, const palette_t* p, int offset, int stride)
+{
+    int pixels = num_pixels(np);
+
+    for (int i = 0; i < pixels; i++)
+        set_pixel(np, i, palette_at(p, offset, stride, i));
+}
@@ -0,0 +1,74 @@
+#ifndef __PALETTE_H__
+#define __PALETTE_H__
+
+#include <stdint.h>
+
+#include <ws2811.h>
+
+// 256 entry colour tables. Effects that rotate a fixed gradient keep an
+// index offset and look colours up instead of redoing HSV maths for every
+// pixel of every frame. A full turn of hue is one trip round the table.
+#define PALETTE_SIZE 256
+
+// Strides are in 1/256 of an index, so a gradient can be spread evenly over
+// any number of pixels
+#define PALETTE_STRIDE_SHIFT 8
+
+typedef struct {
+    uint32_t color[PALETTE_SIZE];
+} palette_t;
+
+// Gradient stop, the colour at one index
+typedef struct {
+    int index;
+    uint32_t color;
+} palette_stop_t;
+
+typedef enum {
+    PALETTE_RAINBOW,
+    PALETTE_FIRE,
+    PALETTE_OCEAN,
+    PALETTE_FOREST,
+    PALETTE_AURORA,
+    PALETTE_PRESETS,
+} palette_preset_t;
+
+void palette_init();
+const palette_t* palette_preset(palette_preset_t preset);
+
+void palette_gradient(palette_t* p, const palette_stop_t* stops, int count);
+void palette_blend(palette_t* out, const palette_t* a, const palette_t* b, int amount);
+void palette_fill(ws2811_t* np, const palette_t* p, int offset, int stride);
+
+// Degrees of hue to a palette index
+static inline int palette_hue(int degrees)
+{
+    return ((degrees % 360 + 360) % 360) * PALETTE_SIZE / 360;
+}
+
+static inline int palette_color(const palette_t* p, int index)
+{
+    return p->color[index & (PALETTE_SIZE - 1)];
+}
+
+// Colour for pixel i of a gradient starting at offset
+static inline int palette_at(const palette_t* p, int offset, int stride, int i)
+{
+    return palette_color(p, offset + ((i * stride) >> PALETTE_STRIDE_SHIFT));
+}
+
+// Stride that spreads one trip round the palette over this many pixels
+static inline int palette_stride(int pixels)
+{
+    return (PALETTE_SIZE << PALETTE_STRIDE_SHIFT) / pixels;
+}
+
+// Scale a colour by level, 0 is off and 256 leaves it alone
+static inline int palette_scale(int color, int level)
+{
+    uint32_t rb = (((uint32_t) color & 0xff00ff) * level >> 8) & 0xff00ff;
+    uint32_t g = (((uint32_t) color & 0x00ff00) * level >> 8) & 0x00ff00;
+    return rb | g;
+}
+
+#endif
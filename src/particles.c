@@ -0,0 +1,257 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <ws2811.h>
+
+#include "effects.h"
+#include "particles.h"
+
+// Arena bytes needed for a pool sized for this many pixels, including the
+// alignment padding between arrays
+size_t particles_size(int pixels)
+{
+    size_t capacity = (size_t) pixels * PARTICLES_PER_PIXEL;
+    return (7 * capacity + 3 * (size_t) pixels) * sizeof(float) + (size_t) pixels * (sizeof(int) + 1) + 12 * 16;
+}
+
+int particles_init(particles_t* p, arena_t* arena, int pixels)
+{
+    int capacity = pixels * PARTICLES_PER_PIXEL;
+    float** arrays[] = { &p->pos, &p->vel, &p->life, &p->decay, &p->r, &p->g, &p->b };
+
+    for (int i = 0; i < 7; i++)
+    {
+        *arrays[i] = arena_alloc(arena, capacity * sizeof(float));
+        if (*arrays[i] == NULL)
+            return 1;
+    }
+
+    p->acc_r = arena_alloc(arena, pixels * sizeof(float));
+    p->acc_g = arena_alloc(arena, pixels * sizeof(float));
+    p->acc_b = arena_alloc(arena, pixels * sizeof(float));
+    if (p->acc_r == NULL || p->acc_g == NULL || p->acc_b == NULL)
+        return 1;
+
+    p->lit = arena_alloc(arena, pixels * sizeof(int));
+    p->marked = arena_alloc(arena, pixels);
+    if (p->lit == NULL || p->marked == NULL)
+        return 1;
+
+    p->capacity = capacity;
+    particles_reset(p);
+    return 0;
+}
+
+void particles_reset(particles_t* p)
+{
+    p->count = 0;
+    p->tracking = false;
+}
+
+// Returns the slot used, or -1 if the pool is full
+int particles_spawn(particles_t* p, float pos, float vel, int color, float decay)
+{
+    if (p->count >= p->capacity)
+        return -1;
+
+    int i = p->count++;
+
+    p->pos[i] = pos;
+    p->vel[i] = vel;
+    p->life[i] = 1.0f;
+    p->decay[i] = decay;
+    p->r[i] = (color >> 16) & 0xff;
+    p->g[i] = (color >> 8) & 0xff;
+    p->b[i] = color & 0xff;
+
+    return i;
+}
+
+// Move a slot, used when compacting
+static void particles_move(particles_t* p, int to, int from)
+{
+    p->pos[to] = p->pos[from];
+    p->vel[to] = p->vel[from];
+    p->life[to] = p->life[from];
+    p->decay[to] = p->decay[from];
+    p->r[to] = p->r[from];
+    p->g[to] = p->g[from];
+    p->b[to] = p->b[from];
+}
+
+// Advance every particle by dt frames and drop the dead ones. Velocities
+// and decays are per frame, dt can be fractional.
+void particles_step(particles_t* p, int pixels, float dt)
+{
+    int n = p->count;
+    float span = pixels;
+
+    float* restrict pos = p->pos;
+    float* restrict vel = p->vel;
+    float* restrict life = p->life;
+    float* restrict decay = p->decay;
+
+    // Batched integration, one array at a time
+    for (int i = 0; i < n; i++)
+        pos[i] += vel[i] * dt;
+
+    for (int i = 0; i < n; i++)
+    {
+        float x = pos[i];
+        x = x >= span ? x - span : x;
+        x = x < 0 ? x + span : x;
+        pos[i] = x;
+    }
+
+    for (int i = 0; i < n; i++)
+        life[i] -= decay[i] * dt;
+
+    // Compact, filling holes from the end of the pool
+    int i = 0;
+    while (i < n)
+    {
+        if (life[i] > 0)
+        {
+            i++;
+            continue;
+        }
+
+        n--;
+        if (i != n)
+            particles_move(p, i, n);
+    }
+
+    p->count = n;
+}
+
+// Splat every particle onto the two ring positions it straddles, on top of
+// a background colour, then write the strip
+void particles_render(particles_t* p, ws2811_t* np, uint32_t background, float gain)
+{
+    int pixels = num_pixels(np);
+    int n = p->count;
+
+    p->tracking = false;
+
+    float bg_r = (background >> 16) & 0xff;
+    float bg_g = (background >> 8) & 0xff;
+    float bg_b = background & 0xff;
+
+    for (int i = 0; i < pixels; i++)
+    {
+        p->acc_r[i] = bg_r;
+        p->acc_g[i] = bg_g;
+        p->acc_b[i] = bg_b;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        int idx = (int) p->pos[i];
+        idx = idx < pixels ? idx : idx - pixels;
+        int next = idx + 1 < pixels ? idx + 1 : 0;
+
+        float frac = p->pos[i] - idx;
+        float w1 = p->life[i] * gain * frac;
+        float w0 = p->life[i] * gain - w1;
+
+        p->acc_r[idx] += p->r[i] * w0;
+        p->acc_g[idx] += p->g[i] * w0;
+        p->acc_b[idx] += p->b[i] * w0;
+
+        p->acc_r[next] += p->r[i] * w1;
+        p->acc_g[next] += p->g[i] * w1;
+        p->acc_b[next] += p->b[i] * w1;
+    }
+
+    for (int i = 0; i < pixels; i++)
+    {
+        int r = p->acc_r[i] > 255 ? 255 : (int) p->acc_r[i];
+        int g = p->acc_g[i] > 255 ? 255 : (int) p->acc_g[i];
+        int b = p->acc_b[i] > 255 ? 255 : (int) p->acc_b[i];
+
+        set_pixel(np, i, rgb2int(r, g, b));
+    }
+}
+
+static void splat(particles_t* p, int idx, int i, float w)
+{
+    p->acc_r[idx] += p->r[i] * w;
+    p->acc_g[idx] += p->g[i] * w;
+    p->acc_b[idx] += p->b[i] * w;
+
+    // 1 was lit last frame, 2 is lit this frame
+    if (p->marked[idx] == 0)
+        p->lit[p->lit_count++] = idx;
+    p->marked[idx] = 2;
+}
+
+// particles_render() for a few particles on a long ring: only the positions
+// particles land on this frame or did last frame are drawn, through
+// update_pixel(), so the frame can go out with render_update(). The first
+// frame after a reset or a full render draws the whole ring.
+void particles_update(particles_t* p, ws2811_t* np, uint32_t background, float gain)
+{
+    int pixels = num_pixels(np);
+    int n = p->count;
+
+    float bg_r = (background >> 16) & 0xff;
+    float bg_g = (background >> 8) & 0xff;
+    float bg_b = background & 0xff;
+
+    if (!p->tracking || background != p->background)
+    {
+        for (int i = 0; i < pixels; i++)
+        {
+            p->acc_r[i] = bg_r;
+            p->acc_g[i] = bg_g;
+            p->acc_b[i] = bg_b;
+            update_pixel(np, i, background);
+        }
+
+        memset(p->marked, 0, pixels);
+        p->lit_count = 0;
+        p->tracking = true;
+        p->background = background;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        int idx = (int) p->pos[i];
+        idx = idx < pixels ? idx : idx - pixels;
+        int next = idx + 1 < pixels ? idx + 1 : 0;
+
+        float frac = p->pos[i] - idx;
+        float w1 = p->life[i] * gain * frac;
+        float w0 = p->life[i] * gain - w1;
+
+        splat(p, idx, i, w0);
+        if (w1 > 0)
+            splat(p, next, i, w1);
+    }
+
+    // Positions only lit last frame go back to the background and drop out
+    int kept = 0;
+    for (int i = 0; i < p->lit_count; i++)
+    {
+        int idx = p->lit[i];
+        int r = p->acc_r[idx] > 255 ? 255 : (int) p->acc_r[idx];
+        int g = p->acc_g[idx] > 255 ? 255 : (int) p->acc_g[idx];
+        int b = p->acc_b[idx] > 255 ? 255 : (int) p->acc_b[idx];
+
+        update_pixel(np, idx, rgb2int(r, g, b));
+
+        p->acc_r[idx] = bg_r;
+        p->acc_g[idx] = bg_g;
+        p->acc_b[idx] = bg_b;
+
+        if (p->marked[idx] == 2)
+        {
+            p->marked[idx] = 1;
+            p->lit[kept++] = idx;
+        }
+        else
+            p->marked[idx] = 0;
+    }
+
+    p->lit_count = kept;
+}
@@ -0,0 +1,56 @@
+#ifndef __PARTICLES_H__
+#define __PARTICLES_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <ws2811.h>
+
+#include "arena.h"
+
+// Pool capacity scales with the strip
+#define PARTICLES_PER_PIXEL 32
+
+// Fixed capacity particle pool stored as structure-of-arrays, so every
+// update step is a straight loop over one or two float arrays that the
+// compiler can vectorise. Positions are fractional ring positions. All the
+// arrays are carved from an arena once at startup.
+typedef struct {
+    int count;
+    int capacity;
+
+    float* pos;
+    float* vel;
+    float* life;
+    float* decay;
+
+    // Base colour, scaled by life when splatted
+    float* r;
+    float* g;
+    float* b;
+
+    // Per ring position accumulators for splatting
+    float* acc_r;
+    float* acc_g;
+    float* acc_b;
+
+    // Ring positions particles_update() drew particles on last frame, each
+    // marked, while tracking. The accumulators hold the background
+    // everywhere else.
+    int* lit;
+    int lit_count;
+    uint8_t* marked;
+    bool tracking;
+    uint32_t background;
+} particles_t;
+
+size_t particles_size(int pixels);
+int particles_init(particles_t*, arena_t*, int pixels);
+void particles_reset(particles_t*);
+int particles_spawn(particles_t*, float pos, float vel, int color, float decay);
+void particles_step(particles_t*, int pixels, float dt);
+void particles_render(particles_t*, ws2811_t*, uint32_t background, float gain);
+void particles_update(particles_t*, ws2811_t*, uint32_t background, float gain);
+
+#endif
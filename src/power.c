@@ -0,0 +1,198 @@
+#include <stdint.h>
+
+#include <ws2811.h>
+
+#include "delta.h"
+#include "power.h"
+#include "telemetry.h"
+
+// 0 means no limit
+static int budget_ma = POWER_DEFAULT_BUDGET_MA;
+
+// Brightness each channel should have when the budget allows it
+static int wanted[RPI_PWM_CHANNELS];
+
+// Colour totals of the first channel's last frame and the buffer they were
+// counted over. Frames that come with a delta only adjust them.
+static uint32_t shown[3];
+static const ws2811_led_t* counted = NULL;
+
+// Take the starting brightness from the channels, before the first frame
+void power_init(const ws2811_t* np)
+{
+    for (int c = 0; c < RPI_PWM_CHANNELS; c++)
+        wanted[c] = np->channel[c].brightness;
+
+    counted = NULL;
+    telemetry_set(TELEMETRY_POWER_BUDGET_MA, budget_ma);
+}
+
+void power_set_budget(int ma)
+{
+    budget_ma = ma < 0 ? 0 : ma;
+    telemetry_set(TELEMETRY_POWER_BUDGET_MA, budget_ma);
+}
+
+int power_budget()
+{
+    return budget_ma;
+}
+
+void power_set_brightness(ws2811_t* np, int brightness)
+{
+    for (int c = 0; c < RPI_PWM_CHANNELS; c++)
+    {
+        wanted[c] = brightness;
+        np->channel[c].brightness = brightness;
+    }
+}
+
+// Red, green and blue totals over a channel. Separate sums per colour keep
+// the loop a plain reduction the compiler can vectorise.
+static void channel_sums(const ws2811_channel_t* channel, uint32_t* sums)
+{
+    const uint32_t* leds = channel->leds;
+    uint32_t r = 0;
+    uint32_t g = 0;
+    uint32_t b = 0;
+
+    for (int i = 0; i < channel->count; i++)
+    {
+        uint32_t c = leds[i];
+        r += (c >> 16) & 0xff;
+        g += (c >> 8) & 0xff;
+        b += c & 0xff;
+    }
+
+    sums[0] = r;
+    sums[1] = g;
+    sums[2] = b;
+}
+
+// Colour current for those totals at full brightness, microamps
+static int64_t sums_ua(const uint32_t* sums)
+{
+    return ((int64_t) sums[0] * POWER_RED_UA + (int64_t) sums[1] * POWER_GREEN_UA
+            + (int64_t) sums[2] * POWER_BLUE_UA) / 255;
+}
+
+static int64_t channel_ua(const ws2811_channel_t* channel)
+{
+    uint32_t sums[3];
+
+    channel_sums(channel, sums);
+    return sums_ua(sums);
+}
+
+// Only the pixels in the delta are looked at when there is one, the totals
+// wrap around and back for pixels that got darker
+static int64_t first_channel_ua(const ws2811_channel_t* channel, const pixel_delta_t* delta)
+{
+    if (delta == NULL || channel->leds != counted)
+    {
+        channel_sums(channel, shown);
+        counted = channel->leds;
+        return sums_ua(shown);
+    }
+
+    for (int i = 0; i < delta->count; i++)
+    {
+        uint32_t was = delta->was[i];
+        uint32_t c = channel->leds[delta->pixel[i]];
+
+        shown[0] += ((c >> 16) & 0xff) - ((was >> 16) & 0xff);
+        shown[1] += ((c >> 8) & 0xff) - ((was >> 8) & 0xff);
+        shown[2] += (c & 0xff) - (was & 0xff);
+    }
+
+    return sums_ua(shown);
+}
+
+// Brightness scales every value by (brightness + 1) / 256 on the way out,
+// the same as the strip driver does
+static int64_t colour_ua(const int64_t* full, const int* brightness)
+{
+    int64_t total = 0;
+
+    for (int c = 0; c < RPI_PWM_CHANNELS; c++)
+        total += full[c] * (brightness[c] + 1) / 256;
+
+    return total;
+}
+
+static int64_t idle_ua(const ws2811_t* np)
+{
+    int64_t total = 0;
+
+    for (int c = 0; c < RPI_PWM_CHANNELS; c++)
+        total += (int64_t) np->channel[c].count * POWER_IDLE_UA;
+
+    return total;
+}
+
+// What the strip draws showing its current frame at its current brightness
+int64_t power_estimate_ua(const ws2811_t* np)
+{
+    int64_t full[RPI_PWM_CHANNELS] = { 0 };
+    int brightness[RPI_PWM_CHANNELS];
+
+    for (int c = 0; c < RPI_PWM_CHANNELS; c++)
+    {
+        if (np->channel[c].leds != NULL)
+            full[c] = channel_ua(&np->channel[c]);
+        brightness[c] = np->channel[c].brightness;
+    }
+
+    return colour_ua(full, brightness) + idle_ua(np);
+}
+
+// Call on the frame path just before the frame goes out, with the delta
+// the frame came with or NULL
+void power_limit_delta(ws2811_t* np, const pixel_delta_t* delta)
+{
+    int64_t full[RPI_PWM_CHANNELS] = { 0 };
+
+    if (np->channel[0].leds != NULL)
+        full[0] = first_channel_ua(&np->channel[0], delta);
+
+    for (int c = 1; c < RPI_PWM_CHANNELS; c++)
+    {
+        if (np->channel[c].leds != NULL)
+            full[c] = channel_ua(&np->channel[c]);
+    }
+
+    int64_t idle = idle_ua(np);
+    int64_t colour = colour_ua(full, wanted);
+    int64_t demand = idle + colour;
+    int64_t budget = (int64_t) budget_ma * 1000;
+
+    telemetry_max(TELEMETRY_POWER_PEAK_MA, demand / 1000);
+
+    if (budget_ma == 0 || demand <= budget || colour == 0)
+    {
+        for (int c = 0; c < RPI_PWM_CHANNELS; c++)
+            np->channel[c].brightness = wanted[c];
+
+        telemetry_set(TELEMETRY_POWER_MA, demand / 1000);
+        return;
+    }
+
+    // Scale every channel by the same factor, so the frame dims evenly
+    int64_t room = budget > idle ? budget - idle : 0;
+    int limited[RPI_PWM_CHANNELS];
+
+    for (int c = 0; c < RPI_PWM_CHANNELS; c++)
+    {
+        int64_t scale = (int64_t) (wanted[c] + 1) * room / colour;
+        limited[c] = scale > 0 ? scale - 1 : 0;
+        np->channel[c].brightness = limited[c];
+    }
+
+    telemetry_add(TELEMETRY_POWER_LIMITED, 1);
+    telemetry_set(TELEMETRY_POWER_MA, (idle + colour_ua(full, limited)) / 1000);
+}
+
+void power_limit(ws2811_t* np)
+{
+    power_limit_delta(np, NULL);
+}
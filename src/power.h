@@ -0,0 +1,36 @@
+#ifndef __POWER_H__
+#define __POWER_H__
+
+#include <stdint.h>
+
+#include <ws2811.h>
+
+#include "delta.h"
+
+// Current model for one LED, microamps for a colour channel at full value
+// plus what the driver draws while dark. WS2812B parts are close to 20 mA a
+// colour.
+#define POWER_RED_UA 20000
+#define POWER_GREEN_UA 20000
+#define POWER_BLUE_UA 20000
+#define POWER_IDLE_UA 1000
+
+// A Pi Zero on a battery pack browns out not far above this with the strip
+// on the same supply
+#define POWER_DEFAULT_BUDGET_MA 1000
+
+// Estimates what every frame will draw just before it goes out, and when
+// that would go over budget dims the whole frame evenly through the channel
+// brightness. The brightness asked for is kept, the limiter only ever
+// lowers it for the frame at hand. Given the frame's delta, the estimate
+// is only brought up to date for the pixels that changed.
+void power_init(const ws2811_t* np);
+void power_set_budget(int ma);
+int power_budget();
+void power_set_brightness(ws2811_t* np, int brightness);
+
+int64_t power_estimate_ua(const ws2811_t* np);
+void power_limit(ws2811_t* np);
+void power_limit_delta(ws2811_t* np, const pixel_delta_t* delta);
+
+#endif
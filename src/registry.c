@@ -0,0 +1,322 @@
+#include <dirent.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <ws2811.h>
+
+#include "effects.h"
+#include "registry.h"
+#include "rng.h"
+#include "telemetry.h"
+#include "timeline.h"
+
+// How many recent picks to steer away from, and how many draws to spend
+// doing it before settling
+#define REGISTRY_RECENT 3
+#define REGISTRY_TRIES 8
+
+static const effect_info_t builtins[] = {
+    { "unicorn",                EFFECT_KIND_SWEEP,    1, effect_unicorn_dial, NULL, NULL },
+    { "comet",                  EFFECT_KIND_SWEEP,    1, effect_comet_dial, NULL, NULL },
+    { "comet_color_cycle",      EFFECT_KIND_SWEEP,    1, effect_comet_color_cycle_dial, NULL, NULL },
+    { "comet_rainbow_trail",    EFFECT_KIND_SWEEP,    1, effect_comet_rainbow_trail_dial, NULL, NULL },
+    { "comet_rainbow_reveal",   EFFECT_KIND_SWEEP,    1, effect_comet_rainbow_reveal_dial, NULL, NULL },
+    { "full_rainbow_reveal",    EFFECT_KIND_SWEEP,    1, effect_full_rainbow_reveal_dial, NULL, NULL },
+    { "full_color",             EFFECT_KIND_SWEEP,    1, effect_full_color_dial, NULL, NULL },
+    { "full_rainbow_wipe",      EFFECT_KIND_SWEEP,    1, effect_full_rainbow_wipe_dial, NULL, NULL },
+    { "fire",                   EFFECT_KIND_SWEEP,    1, effect_fire_ring, NULL, NULL },
+    { "random_fire",            EFFECT_KIND_SWEEP,    1, effect_random_fire_ring, NULL, NULL },
+    { "embers",                 EFFECT_KIND_SWEEP,    1, effect_embers, NULL, NULL },
+    { "sparks",                 EFFECT_KIND_SWEEP,    1, effect_sparks, NULL, NULL },
+    { "strobe",                 EFFECT_KIND_STROBE,   1, NULL, effect_strobe, NULL },
+    { "random_strobe",          EFFECT_KIND_STROBE,   1, NULL, effect_random_strobe, NULL },
+    { "rainbow_strobe",         EFFECT_KIND_STROBE,   1, NULL, effect_rainbow_strobe, NULL },
+    { "rainbow_static_strobe",  EFFECT_KIND_STROBE,   1, NULL, effect_rainbow_static_strobe, NULL },
+    { "rainbow_dynamic_strobe", EFFECT_KIND_STROBE,   1, NULL, effect_rainbow_dynamic_strobe, NULL },
+    { "twinkle",                EFFECT_KIND_TWINKLE,  1, NULL, effect_twinkle, NULL },
+    { "rainbow_random_twinkle", EFFECT_KIND_TWINKLE,  1, NULL, effect_rainbow_random_twinkle, NULL },
+    { "rainbow_fixed_twinkle",  EFFECT_KIND_TWINKLE,  1, NULL, effect_rainbow_fixed_twinkle, NULL },
+
+    // New ones go on the end, journals record effects by index
+    { "noise_fire",             EFFECT_KIND_SWEEP,    1, effect_noise_fire, NULL, NULL },
+    { "plasma",                 EFFECT_KIND_SWEEP,    1, effect_plasma, NULL, NULL },
+    { "aurora",                 EFFECT_KIND_SWEEP,    1, effect_aurora, NULL, NULL },
+};
+
+#define REGISTRY_BUILTINS ((int) (sizeof(builtins) / sizeof(builtins[0])))
+#define REGISTRY_SIZE (REGISTRY_BUILTINS + REGISTRY_MAX_TIMELINES)
+
+// Effects loaded at startup follow the built in ones
+static timeline_t timelines[REGISTRY_MAX_TIMELINES];
+static effect_info_t loaded[REGISTRY_MAX_TIMELINES];
+static int num_loaded = 0;
+
+// Walker/Vose alias table for one kind, built once so a weighted pick is one
+// draw and one comparison no matter how many effects there are
+typedef struct {
+    int count;
+    int members[REGISTRY_SIZE];
+    int alias[REGISTRY_SIZE];
+    float prob[REGISTRY_SIZE];
+} alias_table_t;
+
+static alias_table_t tables[EFFECT_KINDS];
+
+// Measured busy microseconds per frame, 0 until the effect has run. Layer
+// and zone threads run and pick effects alongside the lighting thread, so
+// these, the budget and the recent picks are guarded by stats_lock.
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static int cost_us[REGISTRY_SIZE];
+static int budget_us = REGISTRY_DEFAULT_BUDGET;
+
+static int recent[REGISTRY_RECENT];
+static int recent_idx = 0;
+
+
+static void build_table(alias_table_t* table, effect_kind_t kind)
+{
+    int small[REGISTRY_SIZE];
+    int large[REGISTRY_SIZE];
+    int num_small = 0;
+    int num_large = 0;
+    int total = 0;
+
+    table->count = 0;
+    for (int i = 0; i < registry_count(); i++)
+    {
+        const effect_info_t* info = registry_info(i);
+        if (info->kind != kind || info->weight <= 0)
+            continue;
+
+        table->members[table->count++] = i;
+        total += info->weight;
+    }
+
+    if (table->count == 0)
+        return;
+
+    // Scale so the average slot holds exactly 1, then pair each short slot
+    // with a tall one that tops it up
+    for (int i = 0; i < table->count; i++)
+    {
+        table->prob[i] = (float) registry_info(table->members[i])->weight * table->count / total;
+        table->alias[i] = i;
+
+        if (table->prob[i] < 1.0f)
+            small[num_small++] = i;
+        else
+            large[num_large++] = i;
+    }
+
+    while (num_small > 0 && num_large > 0)
+    {
+        int s = small[--num_small];
+        int l = large[--num_large];
+
+        table->alias[s] = l;
+        table->prob[l] -= 1.0f - table->prob[s];
+
+        if (table->prob[l] < 1.0f)
+            small[num_small++] = l;
+        else
+            large[num_large++] = l;
+    }
+
+    // Whatever is left is 1 up to rounding
+    while (num_large > 0)
+        table->prob[large[--num_large]] = 1.0f;
+    while (num_small > 0)
+        table->prob[small[--num_small]] = 1.0f;
+}
+
+// Load every compiled timeline in a directory as a sweep effect. Call
+// before registry_init(). A missing directory just means there are none.
+int registry_load_timelines(const char* path)
+{
+    DIR* dir = opendir(path);
+    if (dir == NULL)
+        return 0;
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        size_t length = strlen(entry->d_name);
+        if (length < 4 || strcmp(entry->d_name + length - 4, ".btl") != 0)
+            continue;
+
+        if (num_loaded == REGISTRY_MAX_TIMELINES)
+        {
+            printf("Only %d timelines are supported, skipping the rest\n", REGISTRY_MAX_TIMELINES);
+            break;
+        }
+
+        char file[512];
+        snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+
+        timeline_t* t = &timelines[num_loaded];
+        if (timeline_load(file, t) != 0)
+            continue;
+
+        loaded[num_loaded++] = (effect_info_t) {
+            .name = t->name,
+            .kind = EFFECT_KIND_SWEEP,
+            .weight = t->weight,
+            .timeline = t,
+        };
+    }
+
+    closedir(dir);
+    return 0;
+}
+
+void registry_init()
+{
+    for (int kind = 0; kind < EFFECT_KINDS; kind++)
+        build_table(&tables[kind], kind);
+
+    for (int i = 0; i < REGISTRY_RECENT; i++)
+        recent[i] = -1;
+}
+
+int registry_count()
+{
+    return REGISTRY_BUILTINS + num_loaded;
+}
+
+const effect_info_t* registry_info(int index)
+{
+    return index < REGISTRY_BUILTINS ? &builtins[index] : &loaded[index - REGISTRY_BUILTINS];
+}
+
+// -1 if there is no effect by that name
+int registry_find(const char* name)
+{
+    for (int i = 0; i < registry_count(); i++)
+    {
+        if (strcmp(registry_info(i)->name, name) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+int registry_cost(int index)
+{
+    pthread_mutex_lock(&stats_lock);
+    int cost = cost_us[index];
+    pthread_mutex_unlock(&stats_lock);
+
+    return cost;
+}
+
+// 0 turns budget checks off
+void registry_set_budget(int us)
+{
+    pthread_mutex_lock(&stats_lock);
+    budget_us = us;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+static int draw(alias_table_t* table, rng_t* rng)
+{
+    int slot = rng_next(rng) % table->count;
+    int chosen = rng_float(rng) < table->prob[slot] ? slot : table->alias[slot];
+
+    return table->members[chosen];
+}
+
+static bool is_recent(int index)
+{
+    for (int i = 0; i < REGISTRY_RECENT; i++)
+    {
+        if (recent[i] == index)
+            return true;
+    }
+
+    return false;
+}
+
+static bool over_budget(int index)
+{
+    return budget_us > 0 && cost_us[index] > budget_us;
+}
+
+// Weighted random effect of a kind, or -1 if there are none. Effects that
+// ran recently are redrawn, and ones too heavy for the frame budget are
+// skipped. If nothing fits the budget the cheapest effect is used.
+int registry_pick(effect_kind_t kind)
+{
+    alias_table_t* table = &tables[kind];
+    if (table->count == 0)
+        return -1;
+
+    rng_t rng;
+    effect_rng(&rng);
+
+    pthread_mutex_lock(&stats_lock);
+
+    int pick = -1;
+    for (int tries = 0; tries < REGISTRY_TRIES; tries++)
+    {
+        int index = draw(table, &rng);
+
+        if (over_budget(index))
+        {
+            telemetry_add(TELEMETRY_EFFECT_SKIPS, 1);
+            continue;
+        }
+
+        pick = index;
+        if (!is_recent(index))
+            break;
+    }
+
+    if (pick < 0)
+    {
+        pick = table->members[0];
+        for (int i = 1; i < table->count; i++)
+        {
+            if (cost_us[table->members[i]] < cost_us[pick])
+                pick = table->members[i];
+        }
+    }
+
+    recent[recent_idx] = pick;
+    recent_idx = (recent_idx + 1) % REGISTRY_RECENT;
+
+    pthread_mutex_unlock(&stats_lock);
+
+    return pick;
+}
+
+// Run an effect on the calling thread, safe from any thread
+void registry_call(int index, ws2811_t* np, active_func active)
+{
+    const effect_info_t* info = registry_info(index);
+
+    if (info->timeline != NULL)
+        effect_timeline(np, info->timeline, active);
+    else if (info->sweep != NULL)
+        info->sweep(np, active);
+    else
+        info->run(np);
+}
+
+// Run an effect on the calling thread, like registry_call, and fold what
+// it cost that thread into its running average
+void registry_run(int index, ws2811_t* np, active_func active)
+{
+    frame_cost_reset();
+    registry_call(index, np, active);
+
+    int measured = frame_cost_us();
+    if (measured == 0)
+        return;
+
+    pthread_mutex_lock(&stats_lock);
+    cost_us[index] = cost_us[index] == 0 ? measured : (3 * cost_us[index] + measured) / 4;
+    pthread_mutex_unlock(&stats_lock);
+}
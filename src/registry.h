@@ -0,0 +1,46 @@
+#ifndef __REGISTRY_H__
+#define __REGISTRY_H__
+
+#include <ws2811.h>
+
+#include "effects.h"
+#include "timeline.h"
+
+// Random picks skip effects measured to need more than this many
+// microseconds of work per frame, one sweep tick by default
+#define REGISTRY_DEFAULT_BUDGET 7500
+
+#define REGISTRY_MAX_TIMELINES 8
+#define REGISTRY_TIMELINE_DIR "/etc/badge/effects"
+
+typedef enum {
+    EFFECT_KIND_SWEEP,
+    EFFECT_KIND_STROBE,
+    EFFECT_KIND_TWINKLE,
+    EFFECT_KINDS,
+} effect_kind_t;
+
+// Every effect the badge can show. Sweeps and timelines follow an
+// active_func, the rest run for a fixed number of frames.
+typedef struct {
+    const char* name;
+    effect_kind_t kind;
+    int weight;
+    sweep_effect sweep;
+    effect run;
+    const timeline_t* timeline;
+} effect_info_t;
+
+int registry_load_timelines(const char* path);
+void registry_init();
+int registry_count();
+const effect_info_t* registry_info(int index);
+int registry_find(const char* name);
+int registry_cost(int index);
+void registry_set_budget(int us);
+
+int registry_pick(effect_kind_t kind);
+void registry_run(int index, ws2811_t* np, active_func active);
+void registry_call(int index, ws2811_t* np, active_func active);
+
+#endif
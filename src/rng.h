@@ -0,0 +1,43 @@
+#ifndef __RNG_H__
+#define __RNG_H__
+
+#include <stdint.h>
+
+// Small xorshift32 generator. Effects keep one of these in their own state
+// instead of calling rand(), so a run is reproducible from its seed and the
+// lighting thread never contends on the libc lock
+typedef struct {
+    uint32_t state;
+} rng_t;
+
+static inline void rng_seed(rng_t* rng, uint32_t seed)
+{
+    // xorshift never leaves zero, so nudge it to something useful
+    rng->state = seed != 0 ? seed : 0x9e3779b9;
+}
+
+static inline uint32_t rng_next32(rng_t* rng)
+{
+    uint32_t x = rng->state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    rng->state = x;
+    return x;
+}
+
+// Non-negative int, a drop in for rand()
+static inline int rng_next(rng_t* rng)
+{
+    return (int) (rng_next32(rng) >> 1);
+}
+
+// Uniform in [0, 1)
+static inline float rng_float(rng_t* rng)
+{
+    return (rng_next32(rng) >> 8) * (1.0f / 16777216.0f);
+}
+
+#endif
@@ -0,0 +1,88 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "rt.h"
+#include "telemetry.h"
+
+// Touched up front so the first deep call chain doesn't page fault
+#define RT_STACK_PREFAULT (64 * 1024)
+
+typedef struct {
+    const char* name;
+    int priority;
+    // CPU to pin to when there is more than one, -1 to leave it floating
+    int cpu;
+} rt_policy_t;
+
+// Pulses are the only thing we can't get back if we miss them, so the input
+// loop outranks the frame loop. On multi-core boards they each get a core.
+// Zone threads float so they can spread over whatever cores are left.
+static const rt_policy_t policies[] = {
+    [RT_ROLE_INPUT] = { "input", 80, 0 },
+    [RT_ROLE_FRAME] = { "frame", 60, 1 },
+    [RT_ROLE_ZONE] = { "zone", 60, -1 },
+};
+
+static bool enabled = false;
+
+static void prefault_stack()
+{
+    volatile unsigned char stack[RT_STACK_PREFAULT];
+    memset((unsigned char*) stack, 0, sizeof(stack));
+}
+
+int rt_enable()
+{
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+    {
+        printf("Unable to lock memory, real-time mode disabled\n");
+        return 1;
+    }
+
+    enabled = true;
+    prefault_stack();
+    return 0;
+}
+
+bool rt_enabled()
+{
+    return enabled;
+}
+
+// Apply the policy for a role to the calling thread, a no-op unless
+// real-time mode was enabled
+void rt_thread(rt_role_t role)
+{
+    if (!enabled)
+        return;
+
+    const rt_policy_t* policy = &policies[role];
+
+    struct sched_param param = {
+        .sched_priority = policy->priority,
+    };
+    int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (err != 0)
+        telemetry_log("rt: unable to set %s priority: %s", policy->name, strerror(err));
+
+    long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpu_count > 1 && policy->cpu >= 0 && policy->cpu < cpu_count)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(policy->cpu, &cpus);
+
+        err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if (err != 0)
+            telemetry_log("rt: unable to pin %s thread: %s", policy->name, strerror(err));
+    }
+
+    prefault_stack();
+}
@@ -0,0 +1,17 @@
+#ifndef __RT_H__
+#define __RT_H__
+
+#include <stdbool.h>
+
+// Thread roles for the opt-in real-time mode, highest priority first
+typedef enum {
+    RT_ROLE_INPUT,
+    RT_ROLE_FRAME,
+    RT_ROLE_ZONE,
+} rt_role_t;
+
+int rt_enable();
+bool rt_enabled();
+void rt_thread(rt_role_t role);
+
+#endif
@@ -0,0 +1,40 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "sampler.h"
+
+// Start out settled at the levels the pins read now
+void sampler_init(sampler_t* s, int pins, const uint8_t* levels)
+{
+    s->pins = pins;
+    memset(s->count, 0, sizeof(s->count));
+
+    for (int i = 0; i < pins; i++)
+        s->level[i] = levels[i] != 0;
+}
+
+// Feed one sample of every pin, returns a mask of the pins whose debounced
+// level flipped with it
+uint32_t sampler_update(sampler_t* s, const uint8_t* levels)
+{
+    uint32_t changed = 0;
+
+    for (int i = 0; i < s->pins; i++)
+    {
+        if ((levels[i] != 0) == s->level[i])
+        {
+            if (s->count[i] > 0)
+                s->count[i]--;
+            continue;
+        }
+
+        if (++s->count[i] < SAMPLER_INTEGRATOR)
+            continue;
+
+        s->level[i] = !s->level[i];
+        s->count[i] = 0;
+        changed |= 1u << i;
+    }
+
+    return changed;
+}
@@ -0,0 +1,35 @@
+#ifndef __SAMPLER_H__
+#define __SAMPLER_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Sampled input, the alternative to waiting on edge interrupts. The pins
+// are read together at a fixed rate and each goes through an integrator: a
+// sample at the other level counts toward switching, one at the current
+// level counts back, and the debounced level only flips once the count
+// reaches the limit. Contact bounce never gets that far, so what comes out
+// is one clean edge per real transition.
+#define SAMPLER_HZ 2000
+#define SAMPLER_PERIOD_NS (1000000000 / SAMPLER_HZ)
+
+// Samples to accept a new level, 2 ms at SAMPLER_HZ
+#define SAMPLER_INTEGRATOR 4
+
+#define SAMPLER_MAX_PINS 8
+
+typedef struct {
+    int pins;
+    uint8_t count[SAMPLER_MAX_PINS];
+    uint8_t level[SAMPLER_MAX_PINS];
+} sampler_t;
+
+void sampler_init(sampler_t* s, int pins, const uint8_t* levels);
+uint32_t sampler_update(sampler_t* s, const uint8_t* levels);
+
+static inline int sampler_level(const sampler_t* s, int pin)
+{
+    return s->level[pin];
+}
+
+#endif
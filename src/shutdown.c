@@ -0,0 +1,92 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "shutdown.h"
+#include "telemetry.h"
+
+static atomic_bool requested = false;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+// Set once by whoever asks first
+static int64_t started_us = 0;
+static struct timespec deadline;
+static atomic_int abandoned = 0;
+
+static int64_t monotonic_us()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// One budget from now. pthread_timedjoin_np only takes the wall clock.
+static void budget_from_now(struct timespec* ts)
+{
+    clock_gettime(CLOCK_REALTIME, ts);
+    ts->tv_nsec += (long) SHUTDOWN_BUDGET_MS * 1000000;
+    ts->tv_sec += ts->tv_nsec / 1000000000;
+    ts->tv_nsec %= 1000000000;
+}
+
+static void start_clock()
+{
+    started_us = monotonic_us();
+    budget_from_now(&deadline);
+    atomic_store(&requested, true);
+}
+
+// Start the clock, only from the signal and exit paths. Only the first call
+// counts, so it is safe from any thread and from every exit path.
+void shutdown_begin()
+{
+    pthread_once(&once, start_clock);
+}
+
+bool shutdown_requested()
+{
+    return atomic_load(&requested);
+}
+
+// Join a thread that has been told to stop, giving up at deadline, a
+// CLOCK_REALTIME time. Returns 0 if it finished, 1 if it was left running.
+int join_with_deadline(pthread_t thread, const char* name, const struct timespec* deadline)
+{
+    if (pthread_timedjoin_np(thread, NULL, deadline) == 0)
+        return 0;
+
+    telemetry_log("shutdown: %s thread still running at its deadline, leaving it", name);
+    atomic_fetch_add(&abandoned, 1);
+    return 1;
+}
+
+// Once shutdown has begun every join shares its deadline. A subsystem
+// stopped before that, or cleaning up after a failed start, gets a budget
+// of its own and leaves the process running.
+int shutdown_join(pthread_t thread, const char* name)
+{
+    if (shutdown_requested())
+        return join_with_deadline(thread, name, &deadline);
+
+    struct timespec own;
+    budget_from_now(&own);
+    return join_with_deadline(thread, name, &own);
+}
+
+// Threads left running so far
+int shutdown_abandoned()
+{
+    return atomic_load(&abandoned);
+}
+
+void shutdown_done()
+{
+    if (!shutdown_requested())
+        return;
+
+    telemetry_log("shutdown took %lld us, %d threads left running",
+                  (long long) (monotonic_us() - started_us), atomic_load(&abandoned));
+}
@@ -0,0 +1,23 @@
+#ifndef __SHUTDOWN_H__
+#define __SHUTDOWN_H__
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <time.h>
+
+// Shutdown has a fixed budget from the moment it is asked for. Every
+// subsystem is told to stop, then its threads are joined in order against
+// the one deadline. A thread still running at the deadline is left behind
+// and whatever it uses is not freed, the process is about to exit anyway.
+// Joining a thread doesn't start a shutdown, only the signal and exit
+// paths do that.
+#define SHUTDOWN_BUDGET_MS 100
+
+void shutdown_begin();
+bool shutdown_requested();
+int join_with_deadline(pthread_t thread, const char* name, const struct timespec* deadline);
+int shutdown_join(pthread_t thread, const char* name);
+int shutdown_abandoned();
+void shutdown_done();
+
+#endif
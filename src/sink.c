@@ -0,0 +1,257 @@
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <ws2811.h>
+
+#include "geometry.h"
+#include "shutdown.h"
+#include "sink.h"
+#include "telemetry.h"
+
+// Set in a slot index when the middle buffer holds a frame nobody has read
+#define SINK_FRESH 4
+
+// Triple buffered slot. The frame path only ever writes its back buffer and
+// swaps it into the middle, the sink thread only ever swaps the middle out
+// into its front buffer, so neither side waits on the other.
+typedef struct {
+    const char* name;
+    sink_write_func write;
+    sink_close_func close;
+    void* ctx;
+
+    sink_frame_t buffers[3];
+    int back;
+    int front;
+    atomic_int middle;
+
+    sem_t ready;
+    pthread_t thread;
+    bool running;
+
+    atomic_uint_fast64_t written;
+    atomic_uint_fast64_t dropped;
+} sink_t;
+
+static sink_t sinks[SINK_MAX];
+static int num_sinks = 0;
+static atomic_bool stopping = false;
+static uint64_t seq = 0;
+
+int sink_register(const char* name, sink_write_func write, sink_close_func close, void* ctx)
+{
+    if (num_sinks == SINK_MAX)
+    {
+        printf("Only %d output sinks are supported\n", SINK_MAX);
+        return 1;
+    }
+
+    sink_t* sink = &sinks[num_sinks++];
+    sink->name = name;
+    sink->write = write;
+    sink->close = close;
+    sink->ctx = ctx;
+    sink->back = 0;
+    atomic_init(&sink->middle, 1);
+    sink->front = 2;
+
+    return 0;
+}
+
+static void* sink_main(void* arg)
+{
+    sink_t* sink = arg;
+
+    while (true)
+    {
+        while (sem_wait(&sink->ready) != 0 && errno == EINTR)
+            continue;
+
+        if (atomic_load(&sink->middle) & SINK_FRESH)
+        {
+            sink->front = atomic_exchange(&sink->middle, sink->front) & ~SINK_FRESH;
+            sink->write(&sink->buffers[sink->front], sink->ctx);
+            atomic_fetch_add(&sink->written, 1);
+        }
+
+        if (atomic_load(&stopping))
+            break;
+    }
+
+    return NULL;
+}
+
+int sinks_start()
+{
+    atomic_store(&stopping, false);
+
+    for (int i = 0; i < num_sinks; i++)
+    {
+        sink_t* sink = &sinks[i];
+
+        sem_init(&sink->ready, 0, 0);
+        sink->running = pthread_create(&sink->thread, NULL, sink_main, sink) == 0;
+        if (!sink->running)
+            printf("Unable to start the %s sink\n", sink->name);
+    }
+
+    return 0;
+}
+
+// Lets each sink finish the frame it has, then reports what it missed
+void sinks_stop()
+{
+    atomic_store(&stopping, true);
+
+    for (int i = 0; i < num_sinks; i++)
+    {
+        sink_t* sink = &sinks[i];
+        if (!sink->running)
+            continue;
+
+        // One stuck in a slow write keeps its semaphore and its output,
+        // closing it under the write could free what the write is using
+        sem_post(&sink->ready);
+        bool joined = shutdown_join(sink->thread, sink->name) == 0;
+        sink->running = false;
+
+        telemetry_log("sink %s: %llu frames written, %llu dropped", sink->name,
+                      (unsigned long long) atomic_load(&sink->written),
+                      (unsigned long long) atomic_load(&sink->dropped));
+
+        if (!joined)
+            continue;
+
+        sem_destroy(&sink->ready);
+        if (sink->close != NULL)
+            sink->close(sink->ctx);
+    }
+}
+
+// Called on the frame path right after the strip renders
+void sinks_publish(const ws2811_t* np)
+{
+    if (num_sinks == 0)
+        return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t timestamp = (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+
+    const ws2811_channel_t* channel = &np->channel[0];
+    int pixels = channel->count;
+    seq++;
+
+    for (int i = 0; i < num_sinks; i++)
+    {
+        sink_t* sink = &sinks[i];
+        if (!sink->running)
+            continue;
+
+        sink_frame_t* frame = &sink->buffers[sink->back];
+        frame->seq = seq;
+        frame->timestamp_us = timestamp;
+        frame->pixels = pixels;
+        frame->brightness = channel->brightness;
+        for (int p = 0; p < pixels; p++)
+            frame->leds[p] = channel->leds[geometry_ring_pixel(p)];
+
+        int previous = atomic_exchange(&sink->middle, sink->back | SINK_FRESH);
+        sink->back = previous & ~SINK_FRESH;
+
+        // The sink never got to the last one, only wake it for a new frame
+        if (previous & SINK_FRESH)
+        {
+            atomic_fetch_add(&sink->dropped, 1);
+            telemetry_add(TELEMETRY_SINK_DROPS, 1);
+        }
+        else
+            sem_post(&sink->ready);
+    }
+}
+
+uint64_t sink_drops(int index)
+{
+    return atomic_load(&sinks[index].dropped);
+}
+
+// Terminal preview, one line of coloured blocks redrawn in place
+static void preview_write(const sink_frame_t* frame, void* ctx)
+{
+    FILE* out = ctx;
+    char line[64 * 40 + 32];
+    int n = 0;
+
+    n += snprintf(line + n, sizeof(line) - n, "\r");
+    for (int p = 0; p < frame->pixels && n < (int) sizeof(line) - 40; p++)
+    {
+        uint32_t c = frame->leds[p];
+        n += snprintf(line + n, sizeof(line) - n, "\x1b[38;2;%d;%d;%dm█",
+                      (c >> 16) & 0xff, (c >> 8) & 0xff, c & 0xff);
+    }
+    n += snprintf(line + n, sizeof(line) - n, "\x1b[0m");
+
+    fwrite(line, 1, n, out);
+    fflush(out);
+}
+
+static void preview_close(void* ctx)
+{
+    fputs("\n", ctx);
+}
+
+int sink_add_preview(FILE* out)
+{
+    return sink_register("preview", preview_write, preview_close, out);
+}
+
+static void put_le(uint8_t* p, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        p[i] = value >> (8 * i);
+}
+
+static void recorder_write(const sink_frame_t* frame, void* ctx)
+{
+    static uint8_t record[20 + GEOMETRY_MAX_PIXELS * 4];
+
+    put_le(record, frame->seq, 8);
+    put_le(record + 8, frame->timestamp_us, 8);
+    put_le(record + 16, frame->pixels, 2);
+    record[18] = frame->brightness;
+    record[19] = 0;
+    for (int p = 0; p < frame->pixels; p++)
+        put_le(record + 20 + p * 4, frame->leds[p], 4);
+
+    fwrite(record, 1, 20 + frame->pixels * 4, ctx);
+}
+
+static void recorder_close(void* ctx)
+{
+    fclose(ctx);
+}
+
+int sink_add_recorder(const char* path)
+{
+    FILE* f = fopen(path, "wb");
+    if (f == NULL)
+    {
+        printf("Unable to open %s for recording: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    if (sink_register("recorder", recorder_write, recorder_close, f) != 0)
+    {
+        fclose(f);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,45 @@
+#ifndef __SINK_H__
+#define __SINK_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <ws2811.h>
+
+#include "geometry.h"
+
+#define SINK_MAX 4
+
+// One finished frame as the ring shows it, position 0 nearest the stop
+typedef struct {
+    uint64_t seq;
+    int64_t timestamp_us;
+    int pixels;
+    int brightness;
+    uint32_t leds[GEOMETRY_MAX_PIXELS];
+} sink_frame_t;
+
+typedef void (*sink_write_func)(const sink_frame_t* frame, void* ctx);
+typedef void (*sink_close_func)(void* ctx);
+
+// Extra consumers of the frames that go to the strip. The strip itself is
+// still rendered synchronously on the frame path, every other sink gets a
+// copy through its own lock-free slot and runs on its own thread. A sink
+// that can't keep up misses frames, it never holds up the strip.
+int sink_register(const char* name, sink_write_func write, sink_close_func close, void* ctx);
+int sinks_start();
+void sinks_stop();
+void sinks_publish(const ws2811_t* np);
+
+uint64_t sink_drops(int index);
+
+// ANSI true colour preview of the ring on a terminal
+int sink_add_preview(FILE* out);
+
+// Every frame to a file, each record is
+//
+//   u64 seq, i64 timestamp_us, u16 pixels, u8 brightness, u8 reserved,
+//   then pixels u32 0x00RRGGBB values, all little-endian
+int sink_add_recorder(const char* path);
+
+#endif
@@ -0,0 +1,82 @@
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "telemetry.h"
+
+static _Atomic int64_t metrics[TELEMETRY_METRICS];
+
+static const char* names[TELEMETRY_METRICS] = {
+    [TELEMETRY_FRAMES] = "frames",
+    [TELEMETRY_DEADLINE_MISSES] = "deadline_misses",
+    [TELEMETRY_WORST_LATENESS_US] = "worst_lateness_us",
+    [TELEMETRY_HEAP_ALLOCS] = "heap_allocs",
+    [TELEMETRY_EFFECT_SKIPS] = "effect_skips",
+    [TELEMETRY_SINK_DROPS] = "sink_drops",
+    [TELEMETRY_POWER_MA] = "power_ma",
+    [TELEMETRY_POWER_PEAK_MA] = "power_peak_ma",
+    [TELEMETRY_POWER_BUDGET_MA] = "power_budget_ma",
+    [TELEMETRY_POWER_LIMITED] = "power_limited_frames",
+    [TELEMETRY_AUDIO_BLOCKS] = "audio_blocks",
+    [TELEMETRY_AUDIO_ONSETS] = "audio_onsets",
+    [TELEMETRY_AUDIO_WORST_US] = "audio_worst_us",
+    [TELEMETRY_AUDIO_SKIPS] = "audio_skips",
+    [TELEMETRY_DIAL_RATE_MPPS] = "dial_rate_mpps",
+    [TELEMETRY_DIAL_BREAK_PCT] = "dial_break_pct",
+    [TELEMETRY_DIAL_JITTER_US] = "dial_jitter_us",
+    [TELEMETRY_INPUT_OVERRUNS] = "input_overruns",
+};
+
+void telemetry_add(telemetry_metric_t metric, int64_t value)
+{
+    atomic_fetch_add_explicit(&metrics[metric], value, memory_order_relaxed);
+}
+
+void telemetry_set(telemetry_metric_t metric, int64_t value)
+{
+    atomic_store_explicit(&metrics[metric], value, memory_order_relaxed);
+}
+
+void telemetry_max(telemetry_metric_t metric, int64_t value)
+{
+    int64_t current = atomic_load_explicit(&metrics[metric], memory_order_relaxed);
+    while (value > current)
+    {
+        if (atomic_compare_exchange_weak_explicit(&metrics[metric], &current, value,
+                                                  memory_order_relaxed, memory_order_relaxed))
+            break;
+    }
+}
+
+int64_t telemetry_get(telemetry_metric_t metric)
+{
+    return atomic_load_explicit(&metrics[metric], memory_order_relaxed);
+}
+
+const char* telemetry_name(telemetry_metric_t metric)
+{
+    return names[metric];
+}
+
+// Timestamped log line, monotonic seconds since boot
+void telemetry_log(const char* fmt, ...)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    char line[256];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+
+    printf("[%5ld.%03ld] %s\n", (long) now.tv_sec, now.tv_nsec / 1000000, line);
+}
+
+void telemetry_dump(FILE* out)
+{
+    for (int i = 0; i < TELEMETRY_METRICS; i++)
+        fprintf(out, "%s %lld\n", names[i], (long long) telemetry_get(i));
+}
@@ -0,0 +1,40 @@
+#ifndef __TELEMETRY_H__
+#define __TELEMETRY_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Counters and gauges shared by every subsystem. All updates are atomic so
+// they are safe from any thread, including the input and frame loops.
+typedef enum {
+    TELEMETRY_FRAMES,
+    TELEMETRY_DEADLINE_MISSES,
+    TELEMETRY_WORST_LATENESS_US,
+    TELEMETRY_HEAP_ALLOCS,
+    TELEMETRY_EFFECT_SKIPS,
+    TELEMETRY_SINK_DROPS,
+    TELEMETRY_POWER_MA,
+    TELEMETRY_POWER_PEAK_MA,
+    TELEMETRY_POWER_BUDGET_MA,
+    TELEMETRY_POWER_LIMITED,
+    TELEMETRY_AUDIO_BLOCKS,
+    TELEMETRY_AUDIO_ONSETS,
+    TELEMETRY_AUDIO_WORST_US,
+    TELEMETRY_AUDIO_SKIPS,
+    TELEMETRY_DIAL_RATE_MPPS,
+    TELEMETRY_DIAL_BREAK_PCT,
+    TELEMETRY_DIAL_JITTER_US,
+    TELEMETRY_INPUT_OVERRUNS,
+    TELEMETRY_METRICS,
+} telemetry_metric_t;
+
+void telemetry_add(telemetry_metric_t metric, int64_t value);
+void telemetry_set(telemetry_metric_t metric, int64_t value);
+void telemetry_max(telemetry_metric_t metric, int64_t value);
+int64_t telemetry_get(telemetry_metric_t metric);
+const char* telemetry_name(telemetry_metric_t metric);
+
+void telemetry_log(const char* fmt, ...);
+void telemetry_dump(FILE* out);
+
+#endif
@@ -0,0 +1,238 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "timeline.h"
+
+static const char* ease_names[TIMELINE_EASES] = {
+    [TIMELINE_EASE_LINEAR] = "linear",
+    [TIMELINE_EASE_IN] = "in",
+    [TIMELINE_EASE_OUT] = "out",
+    [TIMELINE_EASE_IN_OUT] = "in_out",
+    [TIMELINE_EASE_STEP] = "step",
+};
+
+const char* timeline_ease_name(int ease)
+{
+    return ease >= 0 && ease < TIMELINE_EASES ? ease_names[ease] : "?";
+}
+
+// -1 if there is no such easing
+int timeline_ease_find(const char* name)
+{
+    for (int i = 0; i < TIMELINE_EASES; i++)
+    {
+        if (strcmp(name, ease_names[i]) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+// Checks everything the player relies on, so a program that decodes can be
+// played without any further checks
+int timeline_validate(const timeline_t* t, char* err, size_t err_size)
+{
+    if (t->tracks < 1 || t->tracks > TIMELINE_MAX_TRACKS)
+    {
+        snprintf(err, err_size, "needs between 1 and %d tracks", TIMELINE_MAX_TRACKS);
+        return 1;
+    }
+
+    if (t->frames < 1 || t->frames > UINT16_MAX)
+    {
+        snprintf(err, err_size, "frames must be between 1 and %d", UINT16_MAX);
+        return 1;
+    }
+
+    if (t->tick < 1000 || t->tick > 1000000)
+    {
+        snprintf(err, err_size, "tick must be between 1000 and 1000000 us");
+        return 1;
+    }
+
+    if (t->weight < 0 || t->weight > UINT8_MAX)
+    {
+        snprintf(err, err_size, "weight must be between 0 and %d", UINT8_MAX);
+        return 1;
+    }
+
+    for (int i = 0; i < t->tracks; i++)
+    {
+        const timeline_track_t* track = &t->track[i];
+
+        if (track->keys < 1 || track->keys > TIMELINE_MAX_KEYS)
+        {
+            snprintf(err, err_size, "track %d needs between 1 and %d keys", i, TIMELINE_MAX_KEYS);
+            return 1;
+        }
+
+        for (int k = 0; k < track->keys; k++)
+        {
+            const timeline_key_t* key = &track->key[k];
+
+            if (key->frame < 0 || key->frame >= t->frames
+                || (k > 0 && key->frame <= track->key[k-1].frame))
+            {
+                snprintf(err, err_size, "track %d key %d: frames must increase and stay below %d",
+                         i, k, t->frames);
+                return 1;
+            }
+
+            if (key->ease < 0 || key->ease >= TIMELINE_EASES
+                || key->value < 0 || key->value > UINT8_MAX
+                || key->hue < 0 || key->hue > UINT16_MAX
+                || key->width < 0 || key->width > UINT16_MAX)
+            {
+                snprintf(err, err_size, "track %d key %d: value out of range", i, k);
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static uint8_t* put_u16(uint8_t* p, uint16_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    return p + 2;
+}
+
+static uint8_t* put_u32(uint8_t* p, uint32_t value)
+{
+    p = put_u16(p, value);
+    return put_u16(p, value >> 16);
+}
+
+static uint16_t get_u16(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t* p)
+{
+    return get_u16(p) | ((uint32_t) get_u16(p + 2) << 16);
+}
+
+// Returns the encoded size, or 0 if it doesn't fit
+size_t timeline_encode(const timeline_t* t, uint8_t* buf, size_t size)
+{
+    size_t needed = TIMELINE_HEADER_SIZE;
+    for (int i = 0; i < t->tracks; i++)
+        needed += TIMELINE_TRACK_SIZE + t->track[i].keys * TIMELINE_KEY_SIZE;
+
+    if (needed > size)
+        return 0;
+
+    memset(buf, 0, needed);
+
+    uint8_t* p = put_u32(buf, TIMELINE_MAGIC);
+    *p++ = TIMELINE_VERSION;
+    *p++ = t->tracks;
+    *p++ = t->weight;
+    *p++ = t->loop ? TIMELINE_LOOP : 0;
+    p = put_u32(p, t->tick);
+    p = put_u16(p, t->frames);
+    p += 2;
+    // Already zeroed, so the name stays terminated
+    memcpy(p, t->name, strnlen(t->name, TIMELINE_NAME_LENGTH - 1));
+    p += TIMELINE_NAME_LENGTH;
+
+    for (int i = 0; i < t->tracks; i++)
+    {
+        const timeline_track_t* track = &t->track[i];
+
+        *p = track->keys;
+        p += TIMELINE_TRACK_SIZE;
+
+        for (int k = 0; k < track->keys; k++)
+        {
+            const timeline_key_t* key = &track->key[k];
+
+            p = put_u16(p, key->frame);
+            *p++ = key->ease;
+            *p++ = key->value;
+            p = put_u32(p, key->pos);
+            p = put_u16(p, key->hue);
+            p = put_u16(p, key->width);
+        }
+    }
+
+    return needed;
+}
+
+int timeline_decode(const uint8_t* buf, size_t size, timeline_t* t)
+{
+    if (size < TIMELINE_HEADER_SIZE || get_u32(buf) != TIMELINE_MAGIC || buf[4] != TIMELINE_VERSION)
+        return 1;
+
+    memset(t, 0, sizeof(*t));
+    t->tracks = buf[5];
+    t->weight = buf[6];
+    t->loop = (buf[7] & TIMELINE_LOOP) != 0;
+    t->tick = get_u32(buf + 8);
+    t->frames = get_u16(buf + 12);
+    memcpy(t->name, buf + 16, TIMELINE_NAME_LENGTH - 1);
+
+    if (t->tracks < 1 || t->tracks > TIMELINE_MAX_TRACKS)
+        return 1;
+
+    size_t offset = TIMELINE_HEADER_SIZE;
+    for (int i = 0; i < t->tracks; i++)
+    {
+        timeline_track_t* track = &t->track[i];
+
+        if (offset + TIMELINE_TRACK_SIZE > size)
+            return 1;
+
+        track->keys = buf[offset];
+        offset += TIMELINE_TRACK_SIZE;
+
+        if (track->keys > TIMELINE_MAX_KEYS || offset + track->keys * TIMELINE_KEY_SIZE > size)
+            return 1;
+
+        for (int k = 0; k < track->keys; k++)
+        {
+            const uint8_t* p = buf + offset;
+            timeline_key_t* key = &track->key[k];
+
+            key->frame = get_u16(p);
+            key->ease = p[2];
+            key->value = p[3];
+            key->pos = (int32_t) get_u32(p + 4);
+            key->hue = get_u16(p + 8);
+            key->width = get_u16(p + 10);
+
+            offset += TIMELINE_KEY_SIZE;
+        }
+    }
+
+    char err[128];
+    return offset == size && timeline_validate(t, err, sizeof(err)) == 0 ? 0 : 1;
+}
+
+int timeline_load(const char* path, timeline_t* t)
+{
+    static uint8_t buf[TIMELINE_MAX_SIZE + 1];
+
+    FILE* f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        printf("Unable to open timeline %s\n", path);
+        return 1;
+    }
+
+    size_t size = fread(buf, 1, sizeof(buf), f);
+    fclose(f);
+
+    if (timeline_decode(buf, size, t) != 0)
+    {
+        printf("Bad timeline program %s\n", path);
+        return 1;
+    }
+
+    return 0;
+}
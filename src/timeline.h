@@ -0,0 +1,91 @@
+#ifndef __TIMELINE_H__
+#define __TIMELINE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Keyframed effect programs. Authors write a text timeline (see
+// conf/effects/comet.tl), tools/tlc compiles it to the binary form below,
+// and the badge loads and plays it without being rebuilt.
+//
+// Binary layout, all integers little-endian:
+//
+//   u32 magic         TIMELINE_MAGIC
+//   u8  version       TIMELINE_VERSION
+//   u8  tracks
+//   u8  weight        selection weight, 0 never picks it at random
+//   u8  flags         TIMELINE_LOOP
+//   u32 tick          microseconds per frame
+//   u16 frames        length of the program
+//   u16 reserved
+//   char name[24]     nul padded
+//
+// then for each track a u8 key count and three reserved bytes, followed
+// by the keys, each 12 bytes:
+//
+//   u16 frame         keys in a track are in frame order
+//   u8  ease          how to get from this key to the next one
+//   u8  value         brightness, 0-255
+//   i32 pos           head of the marker, 1/16 degree, not wrapped
+//   u16 hue           degrees, not wrapped
+//   u16 width         marker length behind the head, 1/16 degree
+#define TIMELINE_MAGIC 0x314c5442
+#define TIMELINE_VERSION 1
+
+#define TIMELINE_HEADER_SIZE 40
+#define TIMELINE_TRACK_SIZE 4
+#define TIMELINE_KEY_SIZE 12
+
+#define TIMELINE_MAX_TRACKS 4
+#define TIMELINE_MAX_KEYS 32
+#define TIMELINE_MAX_SIZE (TIMELINE_HEADER_SIZE + TIMELINE_MAX_TRACKS * (TIMELINE_TRACK_SIZE + TIMELINE_MAX_KEYS * TIMELINE_KEY_SIZE))
+#define TIMELINE_NAME_LENGTH 24
+
+// Positions and widths carry this many fractional bits of a degree
+#define TIMELINE_DEGREE_SHIFT 4
+
+#define TIMELINE_LOOP 0x01
+
+typedef enum {
+    TIMELINE_EASE_LINEAR,
+    TIMELINE_EASE_IN,
+    TIMELINE_EASE_OUT,
+    TIMELINE_EASE_IN_OUT,
+    TIMELINE_EASE_STEP,
+    TIMELINE_EASES,
+} timeline_ease_t;
+
+typedef struct {
+    int frame;
+    int ease;
+    int value;
+    int pos;
+    int hue;
+    int width;
+} timeline_key_t;
+
+typedef struct {
+    int keys;
+    timeline_key_t key[TIMELINE_MAX_KEYS];
+} timeline_track_t;
+
+typedef struct {
+    char name[TIMELINE_NAME_LENGTH];
+    int weight;
+    bool loop;
+    int tick;
+    int frames;
+    int tracks;
+    timeline_track_t track[TIMELINE_MAX_TRACKS];
+} timeline_t;
+
+const char* timeline_ease_name(int ease);
+int timeline_ease_find(const char* name);
+
+int timeline_validate(const timeline_t* t, char* err, size_t err_size);
+size_t timeline_encode(const timeline_t* t, uint8_t* buf, size_t size);
+int timeline_decode(const uint8_t* buf, size_t size, timeline_t* t);
+int timeline_load(const char* path, timeline_t* t);
+
+#endif
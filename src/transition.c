@@ -0,0 +1,451 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <ws2811.h>
+
+#include "arena.h"
+#include "delta.h"
+#include "effects.h"
+#include "geometry.h"
+#include "particles.h"
+#include "rt.h"
+#include "shutdown.h"
+#include "transition.h"
+
+typedef struct {
+    // The view is the strip with its pixels in leds instead
+    ws2811_t view;
+    ws2811_led_t leds[GEOMETRY_MAX_PIXELS];
+    particles_t pool;
+    pthread_t thread;
+    bool started;
+
+    // Set when the layer has faded out, its effect runs out without drawing
+    atomic_bool cut;
+
+    // Guarded by lock
+    layer_func run;
+    void* arg;
+    bool pending;
+    bool busy;
+    bool parked;
+    bool drawn;
+    int64_t due;
+
+    // Pixels drawn since the strip last showed the layer, only the pixels
+    // are used. whole means the frames didn't say.
+    pixel_delta_t changed;
+    bool whole;
+} layer_t;
+
+static layer_t layers[TRANSITION_LAYERS];
+static int pixels = 0;
+
+static arena_t arena;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t start_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t release_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t coord_cond = PTHREAD_COND_INITIALIZER;
+static bool stopping = false;
+
+static atomic_int fade_ms = TRANSITION_DEFAULT_MS;
+
+// The fade in progress and the newest layer, guarded by lock. from is -1
+// when nothing is fading.
+static int from = -1;
+static int front = -1;
+static int64_t fade_start = 0;
+static int fade_length = 0;
+
+// Where the lighting thread has got to on the frame schedule. Layers are
+// due at some point on it, the way render_frame() keeps its deadlines.
+static int64_t at = 0;
+
+static __thread layer_t* self = NULL;
+
+// The layer the strip holds a plain copy of, so only what changed on it
+// has to be copied over, or -1. Lighting thread only.
+static int copied = -1;
+static pixel_delta_t strip_changes;
+
+static int64_t now_us()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+void transition_set_ms(int ms)
+{
+    atomic_store(&fade_ms, ms < 0 ? 0 : ms > TRANSITION_MAX_MS ? TRANSITION_MAX_MS : ms);
+}
+
+int transition_ms()
+{
+    return atomic_load(&fade_ms);
+}
+
+// out = from + (to - from) * amount / 256 for every byte of every pixel. One
+// flat loop with no branches, the compiler turns it into vector code.
+void transition_blend(ws2811_led_t* out, const ws2811_led_t* from, const ws2811_led_t* to, int count, int amount)
+{
+    uint8_t* restrict o = (uint8_t*) out;
+    const uint8_t* restrict a = (const uint8_t*) from;
+    const uint8_t* restrict b = (const uint8_t*) to;
+    int keep = 256 - amount;
+
+    for (int i = 0; i < count * (int) sizeof(ws2811_led_t); i++)
+        o[i] = (a[i] * keep + b[i] * amount) >> 8;
+}
+
+// Call with lock held. A parked layer is let go so it sees the cut.
+static void cut(int layer)
+{
+    layer_t* l = &layers[layer];
+
+    atomic_store(&l->cut, true);
+    l->parked = false;
+    pthread_cond_broadcast(&release_cond);
+}
+
+// Call with lock held, out of 256
+static int fade_amount()
+{
+    if (fade_length == 0)
+        return 256;
+
+    int64_t amount = (now_us() - fade_start) * 256 / (fade_length * 1000);
+    return amount > 256 ? 256 : (int) amount;
+}
+
+// Every layer with a job has drawn and is waiting for its next frame. Cut
+// layers are waited out, they finish within a few calls.
+static bool all_parked()
+{
+    for (int i = 0; i < TRANSITION_LAYERS; i++)
+    {
+        if (layers[i].busy && (!layers[i].parked || atomic_load(&layers[i].cut)))
+            return false;
+    }
+
+    return true;
+}
+
+// Stands in for render_frame on layer threads: note when the layer wants
+// its next frame and what it changed, then park until the lighting thread
+// gets there
+static void layer_sync(ws2811_t* np, int tick)
+{
+    const pixel_delta_t* delta = frame_delta();
+
+    pthread_mutex_lock(&lock);
+
+    if (np != NULL && delta == NULL)
+        self->whole = true;
+    else if (np != NULL)
+    {
+        for (int i = 0; i < delta->count; i++)
+            delta_mark(&self->changed, delta->pixel[i], 0);
+    }
+
+    self->due += tick;
+    self->drawn = self->drawn || np != NULL;
+    self->parked = true;
+    pthread_cond_signal(&coord_cond);
+
+    while (self->parked && !stopping)
+        pthread_cond_wait(&release_cond, &lock);
+
+    pthread_mutex_unlock(&lock);
+}
+
+static void* layer_main(void* arg)
+{
+    layer_t* l = arg;
+
+    rt_thread(RT_ROLE_ZONE);
+    self = l;
+    effects_bind_zone(NULL, layer_sync, &l->pool);
+    effects_bind_cut(&l->cut);
+
+    pthread_mutex_lock(&lock);
+    while (!stopping)
+    {
+        if (!l->pending)
+        {
+            pthread_cond_wait(&start_cond, &lock);
+            continue;
+        }
+
+        l->pending = false;
+        pthread_mutex_unlock(&lock);
+
+        l->run(&l->view, l->arg);
+
+        pthread_mutex_lock(&lock);
+        l->busy = false;
+        l->parked = false;
+        pthread_cond_signal(&coord_cond);
+    }
+    pthread_mutex_unlock(&lock);
+
+    return NULL;
+}
+
+// Build the views and pools and start a thread per layer. Only the first
+// channel is layered, zones draw straight into the strip instead.
+int transition_start(ws2811_t* np)
+{
+    pixels = np->channel[0].count;
+    copied = -1;
+
+    if (arena_init(&arena, TRANSITION_LAYERS * particles_size(pixels)) != 0)
+        return 1;
+
+    for (int i = 0; i < TRANSITION_LAYERS; i++)
+    {
+        layer_t* l = &layers[i];
+
+        l->view = *np;
+        l->view.channel[0].leds = l->leds;
+
+        if (particles_init(&l->pool, &arena, pixels) != 0)
+            return 1;
+    }
+
+    stopping = false;
+    for (int i = 0; i < TRANSITION_LAYERS; i++)
+    {
+        layer_t* l = &layers[i];
+
+        l->started = pthread_create(&l->thread, NULL, layer_main, l) == 0;
+        if (!l->started)
+        {
+            printf("Unable to start transition layer %d\n", i);
+            transition_stop();
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Returns 1 if a layer thread is still running at the shutdown deadline
+int transition_stop()
+{
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_broadcast(&start_cond);
+    pthread_cond_broadcast(&release_cond);
+    pthread_cond_broadcast(&coord_cond);
+    pthread_mutex_unlock(&lock);
+
+    int ret = 0;
+    for (int i = 0; i < TRANSITION_LAYERS; i++)
+    {
+        if (layers[i].started && shutdown_join(layers[i].thread, "layer") != 0)
+            ret = 1;
+        layers[i].started = false;
+    }
+
+    return ret;
+}
+
+// A layer with nothing on it, or -1
+int transition_free()
+{
+    int free = -1;
+
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < TRANSITION_LAYERS && free < 0; i++)
+    {
+        if (!layers[i].busy)
+            free = i;
+    }
+    pthread_mutex_unlock(&lock);
+
+    return free;
+}
+
+bool transition_busy(int layer)
+{
+    pthread_mutex_lock(&lock);
+    bool busy = layers[layer].busy;
+    pthread_mutex_unlock(&lock);
+
+    return busy;
+}
+
+// Layers with a job, including any still running out after a cut
+int transition_running()
+{
+    int running = 0;
+
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < TRANSITION_LAYERS; i++)
+        running += layers[i].busy;
+    pthread_mutex_unlock(&lock);
+
+    return running;
+}
+
+bool transition_fading()
+{
+    pthread_mutex_lock(&lock);
+    bool fading = from >= 0 && layers[front].busy;
+    pthread_mutex_unlock(&lock);
+
+    return fading;
+}
+
+// Start run on a free layer. If another layer is showing, fade over to the
+// new one from here, it starts on a dark ring of its own.
+void transition_begin(int layer, layer_func run, void* arg)
+{
+    pthread_mutex_lock(&lock);
+
+    layer_t* l = &layers[layer];
+    bool showing = front >= 0 && layers[front].busy && !atomic_load(&layers[front].cut);
+
+    // Nothing on the strip, start the schedule over
+    if (!showing)
+        at = now_us();
+
+    memset(l->leds, 0, sizeof(l->leds));
+    atomic_store(&l->cut, false);
+    l->run = run;
+    l->arg = arg;
+    l->pending = true;
+    l->busy = true;
+    l->parked = false;
+    l->drawn = false;
+    l->due = at;
+    l->whole = true;
+
+    from = -1;
+    if (showing)
+    {
+        fade_length = atomic_load(&fade_ms);
+
+        if (fade_length == 0)
+            cut(front);
+        else
+        {
+            from = front;
+            fade_start = now_us();
+        }
+    }
+
+    front = layer;
+    pthread_cond_broadcast(&start_cond);
+    pthread_mutex_unlock(&lock);
+}
+
+// Bring the strip up to date with a layer it already shows, pixel by pixel,
+// and pass on what changed with the frame
+static void copy_changes(ws2811_t* np, const layer_t* l, int tick)
+{
+    ws2811_led_t* leds = np->channel[0].leds;
+
+    for (int i = 0; i < l->changed.count; i++)
+    {
+        int pixel = l->changed.pixel[i];
+
+        delta_mark(&strip_changes, pixel, leds[pixel]);
+        leds[pixel] = l->leds[pixel];
+    }
+
+    render_delta(np, &strip_changes, tick);
+    delta_clear(&strip_changes);
+}
+
+// One frame on the lighting thread: once every layer has drawn, blend them
+// into the strip and show it, then let go of the layers due next. Returns
+// false without showing anything once no layer has a job.
+bool transition_frame(ws2811_t* np)
+{
+    pthread_mutex_lock(&lock);
+
+    int amount = 256;
+    if (from >= 0)
+    {
+        amount = fade_amount();
+        if (amount == 256 || !layers[front].busy)
+        {
+            if (layers[from].busy)
+                cut(from);
+            from = -1;
+        }
+    }
+
+    while (!all_parked() && !stopping)
+        pthread_cond_wait(&coord_cond, &lock);
+
+    int64_t next = INT64_MAX;
+    bool drawn = from >= 0;
+
+    for (int i = 0; i < TRANSITION_LAYERS; i++)
+    {
+        if (layers[i].busy && layers[i].due < next)
+            next = layers[i].due;
+        drawn = drawn || (layers[i].busy && layers[i].drawn);
+    }
+
+    if (next == INT64_MAX || stopping)
+    {
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+
+    // Nothing moves while the layers are parked, so the buffers can be read
+    // without the lock
+    int fading = from;
+    int showing = front;
+    int tick = (int) (next - at);
+    at = next;
+    pthread_mutex_unlock(&lock);
+
+    if (!drawn)
+        frame_pause(tick);
+    else if (fading >= 0)
+    {
+        transition_blend(np->channel[0].leds, layers[fading].leds, layers[showing].leds, pixels, amount);
+        render_frame(np, tick);
+        copied = -1;
+    }
+    else if (copied == showing && !layers[showing].whole)
+        copy_changes(np, &layers[showing], tick);
+    else
+    {
+        memcpy(np->channel[0].leds, layers[showing].leds, pixels * sizeof(ws2811_led_t));
+        render_frame(np, tick);
+        copied = showing;
+    }
+
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < TRANSITION_LAYERS; i++)
+    {
+        layer_t* l = &layers[i];
+
+        l->drawn = false;
+        l->whole = false;
+        delta_clear(&l->changed);
+
+        if (l->busy && l->parked && l->due <= at)
+        {
+            l->due = at;
+            l->parked = false;
+        }
+    }
+
+    pthread_cond_broadcast(&release_cond);
+    pthread_mutex_unlock(&lock);
+
+    return true;
+}
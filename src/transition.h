@@ -0,0 +1,35 @@
+#ifndef __TRANSITION_H__
+#define __TRANSITION_H__
+
+#include <stdbool.h>
+
+#include <ws2811.h>
+
+// One layer for the effect on its way out, one for the effect coming in
+#define TRANSITION_LAYERS 2
+
+// How long the two are shown crossfading, 0 cuts straight over
+#define TRANSITION_DEFAULT_MS 200
+#define TRANSITION_MAX_MS 2000
+
+typedef void (*layer_func)(ws2811_t* np, void* arg);
+
+// Effects run on layer threads and draw into buffers of their own, the
+// lighting thread blends those into the strip and shows them. Starting an
+// effect while another is showing fades from one to the other over
+// transition_ms(), then the old one is cut short wherever it had got to.
+int transition_start(ws2811_t* np);
+int transition_stop();
+void transition_set_ms(int ms);
+int transition_ms();
+
+int transition_free();
+bool transition_busy(int layer);
+int transition_running();
+bool transition_fading();
+void transition_begin(int layer, layer_func run, void* arg);
+bool transition_frame(ws2811_t* np);
+
+void transition_blend(ws2811_led_t* out, const ws2811_led_t* from, const ws2811_led_t* to, int count, int amount);
+
+#endif
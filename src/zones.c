@@ -0,0 +1,356 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <ws2811.h>
+
+#include "arena.h"
+#include "effects.h"
+#include "geometry.h"
+#include "particles.h"
+#include "registry.h"
+#include "rt.h"
+#include "shutdown.h"
+#include "zones.h"
+
+#define ZONES_RANDOM -1
+#define ZONES_DEFAULT_BRIGHTNESS 50
+
+typedef struct {
+    int channel;
+    int first;
+    int count;
+    int effect;
+
+    // Strip pixel for each position in the zone
+    int* map;
+    ws2811_t view;
+    particles_t pool;
+    pthread_t thread;
+    bool started;
+
+    // Show state, guarded by lock
+    int pick;
+    bool done;
+    bool waiting;
+    uint64_t target;
+} zone_t;
+
+static zone_t zones[ZONES_MAX];
+static int num_zones = 0;
+
+// Second strip on PWM channel 1, off unless configured
+static int channel1_gpio = 0;
+static int channel1_pixels = 0;
+
+static arena_t arena;
+static int maps[2 * GEOMETRY_MAX_PIXELS];
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t start_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t frame_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t coord_cond = PTHREAD_COND_INITIALIZER;
+static bool stopping = false;
+
+// Bumped once per show and once per frame
+static uint64_t show = 0;
+static uint64_t generation = 0;
+static active_func show_active = NULL;
+
+static __thread zone_t* self = NULL;
+
+
+int zones_load(const char* path)
+{
+    FILE* f = fopen(path, "r");
+    if (f == NULL)
+    {
+        printf("Unable to open zones file %s\n", path);
+        return 1;
+    }
+
+    num_zones = 0;
+    channel1_pixels = 0;
+
+    char line[256];
+    int lineno = 0;
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        lineno++;
+
+        // Strip comments, skip blanks
+        char* hash = strchr(line, '#');
+        if (hash != NULL)
+            *hash = '\0';
+
+        char key[32];
+        if (sscanf(line, "%31s", key) != 1)
+            continue;
+
+        bool ok = true;
+
+        if (strcmp(key, "channel") == 0)
+            ok = sscanf(line, "%*s %d %d", &channel1_gpio, &channel1_pixels) == 2
+                 && channel1_pixels > 0 && channel1_pixels <= GEOMETRY_MAX_PIXELS;
+        else if (strcmp(key, "zone") == 0 && num_zones < ZONES_MAX)
+        {
+            zone_t* z = &zones[num_zones];
+            char name[64] = "random";
+
+            ok = sscanf(line, "%*s %d %d %d %63s", &z->channel, &z->first, &z->count, name) >= 3
+                 && (z->channel == 0 || z->channel == 1) && z->first >= 0 && z->count > 0;
+
+            z->effect = strcmp(name, "random") == 0 ? ZONES_RANDOM : registry_find(name);
+            if (ok && z->effect == -1 && strcmp(name, "random") != 0)
+            {
+                printf("Unknown effect %s at %s:%d\n", name, path, lineno);
+                fclose(f);
+                num_zones = 0;
+                return 1;
+            }
+
+            if (ok)
+                num_zones++;
+        }
+        else
+            ok = false;
+
+        if (!ok)
+        {
+            printf("Bad zone entry at %s:%d\n", path, lineno);
+            fclose(f);
+            num_zones = 0;
+            return 1;
+        }
+    }
+
+    fclose(f);
+
+    // Zones can't run off the end of their strip or share pixels
+    for (int i = 0; i < num_zones; i++)
+    {
+        zone_t* z = &zones[i];
+        int pixels = z->channel == 0 ? geometry()->pixels : channel1_pixels;
+
+        bool ok = z->first + z->count <= pixels;
+        for (int j = 0; j < i && ok; j++)
+        {
+            zone_t* o = &zones[j];
+            ok = o->channel != z->channel || o->first + o->count <= z->first || z->first + z->count <= o->first;
+        }
+
+        if (!ok)
+        {
+            printf("Zone %d in %s overlaps another zone or runs off its strip\n", i, path);
+            num_zones = 0;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int zones_count()
+{
+    return num_zones;
+}
+
+// Fill in the second channel, before the strip is initialised
+void zones_configure(ws2811_t* np)
+{
+    if (channel1_pixels == 0)
+        return;
+
+    np->channel[1] = (ws2811_channel_t) {
+        .gpionum = channel1_gpio,
+        .count = channel1_pixels,
+        .invert = 0,
+        .brightness = ZONES_DEFAULT_BRIGHTNESS,
+        .strip_type = WS2811_STRIP_GRB,
+    };
+}
+
+// Every zone is either finished or parked waiting for a later frame
+static bool all_ready()
+{
+    for (int i = 0; i < num_zones; i++)
+    {
+        if (!zones[i].done && !(zones[i].waiting && zones[i].target > generation))
+            return false;
+    }
+
+    return true;
+}
+
+static bool all_done()
+{
+    for (int i = 0; i < num_zones; i++)
+    {
+        if (!zones[i].done)
+            return false;
+    }
+
+    return true;
+}
+
+// Stands in for render_frame on zone threads: park until enough frames have
+// gone out to cover the tick
+static void zone_sync(ws2811_t* np, int tick)
+{
+    int frames = tick <= ZONES_TICK ? 1 : (tick + ZONES_TICK / 2) / ZONES_TICK;
+
+    pthread_mutex_lock(&lock);
+    self->target = generation + frames;
+    self->waiting = true;
+    pthread_cond_signal(&coord_cond);
+
+    while (generation < self->target && !stopping)
+        pthread_cond_wait(&frame_cond, &lock);
+
+    self->waiting = false;
+    pthread_mutex_unlock(&lock);
+}
+
+static void* zone_main(void* arg)
+{
+    zone_t* z = arg;
+    uint64_t seen = 0;
+
+    rt_thread(RT_ROLE_ZONE);
+    self = z;
+    effects_bind_zone(z->map, zone_sync, &z->pool);
+
+    pthread_mutex_lock(&lock);
+    while (!stopping)
+    {
+        if (show == seen)
+        {
+            pthread_cond_wait(&start_cond, &lock);
+            continue;
+        }
+
+        seen = show;
+        pthread_mutex_unlock(&lock);
+
+        registry_call(z->pick, &z->view, show_active);
+
+        pthread_mutex_lock(&lock);
+        z->done = true;
+        pthread_cond_signal(&coord_cond);
+    }
+    pthread_mutex_unlock(&lock);
+
+    return NULL;
+}
+
+// Build the views and pools and start a thread per zone. The strip must be
+// initialised, the views point into its buffers.
+int zones_start(ws2811_t* np)
+{
+    if (num_zones == 0)
+        return 0;
+
+    size_t size = 0;
+    for (int i = 0; i < num_zones; i++)
+        size += particles_size(zones[i].count);
+
+    if (arena_init(&arena, size) != 0)
+        return 1;
+
+    int* next_map = maps;
+    for (int i = 0; i < num_zones; i++)
+    {
+        zone_t* z = &zones[i];
+
+        z->map = next_map;
+        next_map += z->count;
+        for (int p = 0; p < z->count; p++)
+            z->map[p] = z->channel == 0 ? geometry_ring_pixel(z->first + p) : z->first + p;
+
+        // The view sees the zone as a strip of its own, set_pixel goes
+        // through the map into the real channel buffer
+        z->view = *np;
+        z->view.channel[0] = np->channel[z->channel];
+        z->view.channel[0].count = z->count;
+
+        if (particles_init(&z->pool, &arena, z->count) != 0)
+            return 1;
+    }
+
+    stopping = false;
+    for (int i = 0; i < num_zones; i++)
+    {
+        zone_t* z = &zones[i];
+
+        z->done = true;
+        z->started = pthread_create(&z->thread, NULL, zone_main, z) == 0;
+        if (!z->started)
+        {
+            printf("Unable to start zone %d\n", i);
+            zones_stop();
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Returns 1 if a zone thread is still running at the shutdown deadline
+int zones_stop()
+{
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_broadcast(&start_cond);
+    pthread_cond_broadcast(&frame_cond);
+    pthread_mutex_unlock(&lock);
+
+    int ret = 0;
+    for (int i = 0; i < num_zones; i++)
+    {
+        if (zones[i].started && shutdown_join(zones[i].thread, "zone") != 0)
+            ret = 1;
+        zones[i].started = false;
+    }
+
+    return ret;
+}
+
+// One show on the lighting thread: every zone runs an effect while active,
+// and a frame goes out each time they have all drawn their slice
+void zones_run(ws2811_t* np, active_func active)
+{
+    pthread_mutex_lock(&lock);
+
+    for (int i = 0; i < num_zones; i++)
+    {
+        zone_t* z = &zones[i];
+
+        z->pick = z->effect == ZONES_RANDOM ? registry_pick(EFFECT_KIND_SWEEP) : z->effect;
+        z->done = false;
+        z->waiting = false;
+    }
+
+    show_active = active;
+    show++;
+    pthread_cond_broadcast(&start_cond);
+
+    while (true)
+    {
+        while (!all_ready())
+            pthread_cond_wait(&coord_cond, &lock);
+
+        if (all_done())
+            break;
+
+        pthread_mutex_unlock(&lock);
+        render_frame(np, ZONES_TICK);
+        pthread_mutex_lock(&lock);
+
+        generation++;
+        pthread_cond_broadcast(&frame_cond);
+    }
+
+    pthread_mutex_unlock(&lock);
+}
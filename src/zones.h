@@ -0,0 +1,25 @@
+#ifndef __ZONES_H__
+#define __ZONES_H__
+
+#include <ws2811.h>
+
+#include "effects.h"
+
+#define ZONES_MAX 8
+
+// Zones share one frame clock, effects with a slower tick hold their slice
+// for as many whole frames as it covers. This is the sweep tick.
+#define ZONES_TICK 7500
+
+// Splits the strips into zones that each run their own effect, one thread
+// per zone, all meeting at a barrier before every frame goes out. Zones on
+// channel 0 are ranges of ring positions, zones on channel 1 are plain
+// ranges of strip pixels. See conf/zones.conf for the format.
+int zones_load(const char* path);
+int zones_count();
+void zones_configure(ws2811_t* np);
+int zones_start(ws2811_t* np);
+int zones_stop();
+void zones_run(ws2811_t* np, active_func active);
+
+#endif
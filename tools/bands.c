@@ -0,0 +1,76 @@
+// Runs a WAV file through the badge's audio analysis and prints what the
+// effects would see, one line per block, then the cost per block.
+//
+//   bands music.wav
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "audio.h"
+
+static int64_t monotonic_us()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static char bar(float value)
+{
+    static const char bars[] = " .:-=+*#%@";
+    int i = (int) (value * 9 + 0.5f);
+    return bars[i < 0 ? 0 : i > 9 ? 9 : i];
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 2)
+    {
+        printf("Usage: %s input.wav\n", argv[0]);
+        return 1;
+    }
+
+    audio_wav_t wav;
+    if (audio_wav_open(&wav, argv[1]) != 0)
+        return 1;
+
+    audio_init();
+
+    int16_t pcm[AUDIO_BLOCK];
+    float block[AUDIO_BLOCK];
+    audio_levels_t levels;
+    uint32_t onsets = 0;
+    int blocks = 0;
+    int64_t busy = 0;
+    int64_t worst = 0;
+
+    while (audio_wav_read(&wav, pcm, AUDIO_BLOCK) == AUDIO_BLOCK)
+    {
+        for (int i = 0; i < AUDIO_BLOCK; i++)
+            block[i] = pcm[i] / 32768.0f;
+
+        int64_t start = monotonic_us();
+        audio_analyse(block, &levels);
+        int64_t took = monotonic_us() - start;
+
+        busy += took;
+        worst = took > worst ? took : worst;
+
+        printf("%8.3f  %4.2f  ", (double) blocks * AUDIO_BLOCK / wav.rate, levels.level);
+        for (int b = 0; b < AUDIO_BANDS; b++)
+            putchar(bar(levels.band[b]));
+        printf("%s\n", levels.onsets != onsets ? "  onset" : "");
+
+        onsets = levels.onsets;
+        blocks++;
+    }
+
+    audio_wav_close(&wav);
+
+    if (blocks > 0)
+        printf("%d blocks, %u onsets, %.1f us per block, worst %lld us, block is %d us\n",
+               blocks, onsets, (double) busy / blocks, (long long) worst,
+               (int) ((int64_t) AUDIO_BLOCK * 1000000 / wav.rate));
+
+    return 0;
+}
@@ -0,0 +1,634 @@
+// Runs effects flat out against an in-memory strip and reports what each
+// frame cost. Frames are handed straight back instead of going to a strip,
+// and the effects see a clock that moves on by one tick per frame, so every
+// effect runs exactly the frames it would on the badge in a fraction of
+// the time.
+//
+//   bench [-e effects] [-f frames] [-s sizes] [-j journal] [-J] [name...]
+//
+// Every registered effect is run over and over until it has drawn at least
+// -f frames, then so are the helpers effects lean on: hsv2rgb for every
+// pixel, set_all_pixels, a fire's worth of particles stepped and drawn, and
+// one crossfade blend pass.
+// -s takes a comma separated list of strip sizes to repeat all of that at,
+// evenly spaced rings, by default the badge's own 43 pixels. Naming effects
+// or helpers runs only those.
+//
+// With -j the dials recorded in a journal are replayed in order instead,
+// each running the effect it ran on the badge, which is how the PGO build
+// is trained.
+//
+// Each line is name, pixels, frames, then mean ns per frame and per pixel
+// and the worst frame in ns. -J prints the same as JSON, along with
+// instructions, cycles and cache misses per frame where perf_event_open is
+// allowed, so runs from two builds can be diffed.
+//
+// Effects with a per pixel budget in CPU cycles also get their cycles per
+// pixel, and the bench exits with 1 if any of them goes over. Cycles come
+// from the counters, or without them from the time at the speed a chain of
+// dependent adds runs at.
+#include <linux/perf_event.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <ws2811.h>
+
+#include "effects.h"
+#include "geometry.h"
+#include "journal.h"
+#include "noise.h"
+#include "particles.h"
+#include "power.h"
+#include "registry.h"
+#include "transition.h"
+
+// How long a sweep is wound for each time it runs
+#define BENCH_WIND_US 1500000
+
+// A dial takes about as long to wind as it does to return
+#define BENCH_PULSE_US 100000
+
+#define BENCH_DEFAULT_FRAMES 1000
+#define BENCH_DEFAULT_PIXELS 43
+#define BENCH_MAX_SIZES 8
+
+// Flames per pixel and how fast they burn out, close to the fire ring's
+#define BENCH_FIRE_DENSITY 6
+#define BENCH_FIRE_DECAY 0.04f
+
+// Dependent adds timed to find the clock speed without counters
+#define BENCH_CALIBRATE_ADDS 200000000
+
+// Hardware counters, read as one group
+typedef enum {
+    BENCH_INSTRUCTIONS,
+    BENCH_CYCLES,
+    BENCH_CACHE_MISSES,
+    BENCH_COUNTERS,
+} bench_counter_t;
+
+typedef struct {
+    int64_t frames;
+    int64_t busy_ns;
+    int64_t worst_ns;
+    uint64_t counters[BENCH_COUNTERS];
+} bench_stats_t;
+
+typedef void (*helper_func)(ws2811_t* np, int frame);
+
+typedef struct {
+    const char* name;
+    helper_func run;
+} bench_helper_t;
+
+typedef struct {
+    const char* name;
+    int cycles;
+} bench_budget_t;
+
+// Per pixel budgets, in CPU cycles per frame
+static const bench_budget_t budgets[] = {
+    { "noise_fire", NOISE_PIXEL_CYCLES },
+    { "plasma",     NOISE_PIXEL_CYCLES },
+    { "aurora",     NOISE_PIXEL_CYCLES },
+    { "noise2",     NOISE_PIXEL_CYCLES / 4 },
+};
+
+#define BENCH_BUDGETS ((int) (sizeof(budgets) / sizeof(budgets[0])))
+
+static ws2811_t strip;
+static ws2811_led_t leds[GEOMETRY_MAX_PIXELS];
+static particles_t fire;
+
+// Two made up frames for the crossfade to blend
+static ws2811_led_t fade_from[GEOMETRY_MAX_PIXELS];
+static ws2811_led_t fade_to[GEOMETRY_MAX_PIXELS];
+
+static bench_stats_t stats;
+
+// The clock the effects see, and when the active part of a run ends on it
+static int64_t virtual_us = 0;
+static int64_t active_until = 0;
+
+// Real time the work for the current frame started
+static int64_t frame_start = 0;
+
+// perf_event_open group leader, -1 where counters aren't allowed
+static int perf_fd = -1;
+static bool json = false;
+static bool first_result = true;
+
+// Clock speed for budgets when there are no counters, 0 until measured
+static double cycles_per_ns = 0;
+static bool over_budget = false;
+
+static int64_t monotonic_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static int perf_open(uint64_t config, int group)
+{
+    struct perf_event_attr attr = {
+        .type = PERF_TYPE_HARDWARE,
+        .size = sizeof(struct perf_event_attr),
+        .config = config,
+        .disabled = 1,
+        .exclude_kernel = 1,
+        .exclude_hv = 1,
+        .read_format = PERF_FORMAT_GROUP,
+    };
+
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+// Counters are optional, plenty of kernels and containers don't allow them
+static void perf_init()
+{
+    perf_fd = perf_open(PERF_COUNT_HW_INSTRUCTIONS, -1);
+    if (perf_fd < 0)
+        return;
+
+    if (perf_open(PERF_COUNT_HW_CPU_CYCLES, perf_fd) < 0 || perf_open(PERF_COUNT_HW_CACHE_MISSES, perf_fd) < 0)
+    {
+        close(perf_fd);
+        perf_fd = -1;
+    }
+}
+
+// Each add waits on the one before, so the chain runs at one add a cycle
+static void calibrate()
+{
+    uint32_t x = 0;
+    int64_t start = monotonic_ns();
+
+    for (int i = 0; i < BENCH_CALIBRATE_ADDS; i++)
+    {
+        x += i;
+        __asm__ volatile("" : "+r"(x));
+    }
+
+    cycles_per_ns = BENCH_CALIBRATE_ADDS / (double) (monotonic_ns() - start);
+}
+
+static void stats_reset()
+{
+    memset(&stats, 0, sizeof(stats));
+
+    if (perf_fd >= 0)
+        ioctl(perf_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+}
+
+static void frame_begin()
+{
+    if (perf_fd >= 0)
+        ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+    frame_start = monotonic_ns();
+}
+
+static void frame_end()
+{
+    int64_t took = monotonic_ns() - frame_start;
+
+    if (perf_fd >= 0)
+        ioctl(perf_fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+    stats.frames++;
+    stats.busy_ns += took;
+    stats.worst_ns = took > stats.worst_ns ? took : stats.worst_ns;
+}
+
+static void stats_read()
+{
+    if (perf_fd < 0)
+        return;
+
+    // Number of counters, then each value
+    uint64_t values[1 + BENCH_COUNTERS];
+    if (read(perf_fd, values, sizeof(values)) != sizeof(values))
+        return;
+
+    for (int i = 0; i < BENCH_COUNTERS; i++)
+        stats.counters[i] = values[1 + i];
+}
+
+static int64_t virtual_clock()
+{
+    return virtual_us;
+}
+
+static bool is_active()
+{
+    return virtual_us < active_until;
+}
+
+// Stands in for the strip: charge the frame's work, limiter included, then
+// skip ahead by the tick. A NULL strip is a pause.
+static void bench_sync(ws2811_t* np, int tick)
+{
+    if (np != NULL)
+    {
+        power_limit_delta(np, frame_delta());
+        frame_end();
+    }
+
+    virtual_us += tick;
+    frame_begin();
+}
+
+static void run_effect(int index, int64_t wind_us)
+{
+    active_until = virtual_us + wind_us;
+    frame_begin();
+
+    registry_call(index, &strip, is_active);
+
+    // Whatever ran after the last frame isn't a frame
+    if (perf_fd >= 0)
+        ioctl(perf_fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+}
+
+static void helper_hsv2rgb(ws2811_t* np, int frame)
+{
+    int pixels = num_pixels(np);
+
+    for (int i = 0; i < pixels; i++)
+        np->channel[0].leds[i] = hsv2rgb((frame + i * 360 / pixels) % 360, 1.0, 1.0);
+}
+
+static void helper_set_all_pixels(ws2811_t* np, int frame)
+{
+    set_all_pixels(np, frame & 1 ? 0xff8000 : 0x0080ff);
+}
+
+// Keep the pool topped up to fire density, then one step and one splat
+static void helper_fire(ws2811_t* np, int frame)
+{
+    int pixels = num_pixels(np);
+
+    if (frame == 0)
+        particles_reset(&fire);
+
+    for (int i = fire.count; i < pixels * BENCH_FIRE_DENSITY; i++)
+        particles_spawn(&fire, (i * 7919) % pixels, 0.01f * (i % 7 - 3), 0xff4000, BENCH_FIRE_DECAY);
+
+    particles_step(&fire, pixels, 1.0f);
+    particles_render(&fire, np, 0, 2.0f / BENCH_FIRE_DENSITY);
+}
+
+// One blend pass at a different point in the fade every frame
+static void helper_crossfade(ws2811_t* np, int frame)
+{
+    int pixels = num_pixels(np);
+
+    if (frame == 0)
+    {
+        for (int i = 0; i < pixels; i++)
+        {
+            fade_from[i] = hsv2rgb(i * 360 / pixels, 1.0, 1.0);
+            fade_to[i] = hsv2rgb(180 + i * 360 / pixels, 1.0, 0.5);
+        }
+    }
+
+    transition_blend(np->channel[0].leds, fade_from, fade_to, pixels, frame & 0xff);
+}
+
+// One sample of the noise field per pixel
+static void helper_noise2(ws2811_t* np, int frame)
+{
+    int pixels = num_pixels(np);
+    int32_t step = (8 << (2 * NOISE_SHIFT)) / pixels;
+
+    for (int i = 0; i < pixels; i++)
+        np->channel[0].leds[i] = noise2((i * step) >> NOISE_SHIFT, frame * 16, 8) + NOISE_ONE;
+}
+
+static const bench_helper_t helpers[] = {
+    { "hsv2rgb",        helper_hsv2rgb },
+    { "set_all_pixels", helper_set_all_pixels },
+    { "fire_update",    helper_fire },
+    { "crossfade",      helper_crossfade },
+    { "noise2",         helper_noise2 },
+};
+
+#define BENCH_HELPERS ((int) (sizeof(helpers) / sizeof(helpers[0])))
+
+static void run_helper(const bench_helper_t* helper, int frames)
+{
+    for (int f = 0; f < frames; f++)
+    {
+        frame_begin();
+        helper->run(&strip, f);
+        frame_end();
+    }
+}
+
+static const char* kind_name(int index)
+{
+    const effect_info_t* info = registry_info(index);
+
+    if (info->timeline != NULL)
+        return "timeline";
+
+    switch (info->kind)
+    {
+        case EFFECT_KIND_SWEEP:
+            return "sweep";
+        case EFFECT_KIND_STROBE:
+            return "strobe";
+        default:
+            return "twinkle";
+    }
+}
+
+static int budget_for(const char* name)
+{
+    for (int i = 0; i < BENCH_BUDGETS; i++)
+    {
+        if (strcmp(budgets[i].name, name) == 0)
+            return budgets[i].cycles;
+    }
+
+    return 0;
+}
+
+static double cycles_per_pixel(int pixels)
+{
+    if (perf_fd >= 0)
+        return (double) stats.counters[BENCH_CYCLES] / stats.frames / pixels;
+
+    if (cycles_per_ns == 0)
+        calibrate();
+
+    return (double) stats.busy_ns * cycles_per_ns / stats.frames / pixels;
+}
+
+static void report(const char* name, const char* kind, int pixels)
+{
+    if (stats.frames == 0)
+        return;
+
+    stats_read();
+
+    double per_frame = (double) stats.busy_ns / stats.frames;
+    int budget = budget_for(name);
+    double cycles = budget > 0 ? cycles_per_pixel(pixels) : 0;
+
+    if (cycles > budget)
+        over_budget = true;
+
+    if (!json)
+    {
+        printf("%-24s %6d %8lld %12.1f %10.2f %12lld", name, pixels, (long long) stats.frames, per_frame,
+               per_frame / pixels, (long long) stats.worst_ns);
+
+        if (budget > 0)
+            printf("  %.0f/%d cycles/pixel%s", cycles, budget, cycles > budget ? " OVER BUDGET" : "");
+
+        printf("\n");
+        return;
+    }
+
+    printf("%s\n    { \"name\": \"%s\", \"kind\": \"%s\", \"pixels\": %d, \"frames\": %lld, "
+           "\"ns_per_frame\": %.1f, \"ns_per_pixel\": %.2f, \"worst_ns\": %lld",
+           first_result ? "" : ",", name, kind, pixels, (long long) stats.frames, per_frame,
+           per_frame / pixels, (long long) stats.worst_ns);
+
+    if (perf_fd >= 0)
+        printf(", \"instructions_per_frame\": %.0f, \"cycles_per_frame\": %.0f, \"cache_misses_per_frame\": %.2f",
+               (double) stats.counters[BENCH_INSTRUCTIONS] / stats.frames,
+               (double) stats.counters[BENCH_CYCLES] / stats.frames,
+               (double) stats.counters[BENCH_CACHE_MISSES] / stats.frames);
+
+    if (budget > 0)
+        printf(", \"cycles_per_pixel\": %.1f, \"budget_cycles_per_pixel\": %d", cycles, budget);
+
+    printf(" }");
+    first_result = false;
+}
+
+static bool is_wanted(const char* name, char** names, int count)
+{
+    if (count == 0)
+        return true;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (strcmp(names[i], name) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+// Replay the dials in a journal, oldest first, and report per effect.
+// Effect indexes are only meaningful with the same timelines loaded as on
+// the badge.
+static int replay(const char* path, int pixels)
+{
+    FILE* f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        printf("Unable to open %s\n", path);
+        return 1;
+    }
+
+    static journal_record_t records[JOURNAL_RECORDS];
+    int count = 0;
+
+    if (fseek(f, JOURNAL_HEADER_SIZE, SEEK_SET) == 0)
+    {
+        while (count < JOURNAL_RECORDS && fread(&records[count], sizeof(journal_record_t), 1, f) == 1)
+        {
+            if (journal_valid(&records[count]))
+                count++;
+        }
+    }
+    fclose(f);
+
+    // Oldest first, the ring wraps
+    for (int i = 1; i < count; i++)
+    {
+        journal_record_t r = records[i];
+        int j = i;
+
+        for (; j > 0 && records[j - 1].seq > r.seq; j--)
+            records[j] = records[j - 1];
+        records[j] = r;
+    }
+
+    int replayed = 0;
+    for (int index = 0; index < registry_count(); index++)
+    {
+        stats_reset();
+
+        for (int i = 0; i < count; i++)
+        {
+            const journal_record_t* r = &records[i];
+            if (r->type != JOURNAL_DIAL || r->effect != index)
+                continue;
+
+            effects_seed(r->seq);
+            run_effect(index, (int64_t) r->pulses * BENCH_PULSE_US);
+            replayed++;
+        }
+
+        report(registry_info(index)->name, kind_name(index), pixels);
+    }
+
+    if (replayed == 0)
+    {
+        printf("No dials to replay in %s\n", path);
+        return 1;
+    }
+
+    return 0;
+}
+
+static void run_all(int frames, int pixels, char** names, int count)
+{
+    for (int index = 0; index < registry_count(); index++)
+    {
+        const char* name = registry_info(index)->name;
+        if (!is_wanted(name, names, count))
+            continue;
+
+        // The same show every time, so builds can be compared
+        stats_reset();
+        effects_seed(1);
+
+        while (stats.frames < frames)
+            run_effect(index, BENCH_WIND_US);
+
+        report(name, kind_name(index), pixels);
+    }
+
+    for (int i = 0; i < BENCH_HELPERS; i++)
+    {
+        if (!is_wanted(helpers[i].name, names, count))
+            continue;
+
+        stats_reset();
+        run_helper(&helpers[i], frames);
+        report(helpers[i].name, "helper", pixels);
+    }
+}
+
+static int parse_sizes(char* list, int* sizes)
+{
+    int count = 0;
+
+    for (char* s = strtok(list, ","); s != NULL; s = strtok(NULL, ","))
+    {
+        int pixels = atoi(s);
+        if (count == BENCH_MAX_SIZES || pixels <= 0 || pixels > GEOMETRY_MAX_PIXELS)
+        {
+            printf("Strip sizes must be 1 to %d pixels, at most %d of them\n", GEOMETRY_MAX_PIXELS, BENCH_MAX_SIZES);
+            return -1;
+        }
+
+        sizes[count++] = pixels;
+    }
+
+    return count;
+}
+
+int main(int argc, char** argv)
+{
+    const char* effects_dir = NULL;
+    const char* journal_file = NULL;
+    int frames = BENCH_DEFAULT_FRAMES;
+    int sizes[BENCH_MAX_SIZES] = { BENCH_DEFAULT_PIXELS };
+    int num_sizes = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "e:f:s:j:Jh")) != -1)
+    {
+        switch (opt)
+        {
+            case 'e':
+                effects_dir = optarg;
+                break;
+            case 'f':
+                frames = atoi(optarg);
+                break;
+            case 's':
+                num_sizes = parse_sizes(optarg, sizes);
+                if (num_sizes <= 0)
+                    return 1;
+                break;
+            case 'j':
+                journal_file = optarg;
+                break;
+            case 'J':
+                json = true;
+                break;
+            default:
+                printf("Usage: %s [-e effects] [-f frames] [-s sizes] [-j journal] [-J] [name...]\n", argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (effects_dir != NULL)
+        registry_load_timelines(effects_dir);
+    registry_init();
+
+    // Particle pools are carved once, big enough for the largest strip
+    int largest = 0;
+    for (int i = 0; i < num_sizes; i++)
+        largest = sizes[i] > largest ? sizes[i] : largest;
+
+    static arena_t arena;
+    if (effects_init(largest) != 0 || arena_init(&arena, particles_size(largest)) != 0
+        || particles_init(&fire, &arena, largest) != 0)
+        return 1;
+
+    effects_set_clock(virtual_clock);
+    effects_bind_zone(NULL, bench_sync, NULL);
+    perf_init();
+
+    if (json)
+        printf("{\n  \"compiler\": \"%s\",\n  \"frames\": %d,\n  \"counters\": %s,\n  \"results\": [",
+               __VERSION__, frames, perf_fd >= 0 ? "true" : "false");
+    else
+        printf("# %-22s %6s %8s %12s %10s %12s\n", "name", "pixels", "frames", "ns_frame", "ns_pixel", "worst_ns");
+
+    for (int s = 0; s < num_sizes; s++)
+    {
+        if (geometry_uniform(sizes[s]) != 0)
+            return 1;
+
+        strip.channel[0] = (ws2811_channel_t) {
+            .count = sizes[s],
+            .leds = leds,
+            .brightness = 255,
+            .strip_type = WS2811_STRIP_GRB,
+        };
+        power_init(&strip);
+
+        if (journal_file != NULL)
+        {
+            if (replay(journal_file, sizes[s]) != 0)
+                return 1;
+        }
+        else
+        {
+            run_all(frames, sizes[s], argv + optind, argc - optind);
+        }
+    }
+
+    if (json)
+        printf("\n  ]\n}\n");
+
+    return over_budget ? 1 : 0;
+}
@@ -0,0 +1,308 @@
+// Compares the two ways the badge can read the dial on synthetic dials with
+// contact bounce: edge interrupts decoded the way the dialer does it, and
+// sampling at SAMPLER_HZ through the integrator. Prints how many digits
+// each got right, how often each woke the input loop and what the decoding
+// cost, then what a bare timer at SAMPLER_HZ costs this machine in CPU.
+//
+//   dialbench [-n dials] [-b bounces] [-s seed]
+//
+// -b is the most extra contact bounces on any one transition, each is a
+// brief flip back and forth.
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dialstats.h"
+#include "rng.h"
+#include "sampler.h"
+
+#define MAX_TRANSITIONS 4096
+
+// Dial timing, a healthy dial is close to 10 pulses per second at 60%
+#define MIN_PPS 8.0
+#define MAX_PPS 12.0
+#define MIN_BREAK 0.55
+#define MAX_BREAK 0.70
+
+// Bounce flips last this long at most, ns
+#define BOUNCE_NS 400000
+
+// Interrupt events that arrive within this of the first one pending are
+// handled in the same wakeup, as the input loop would
+#define WAKE_LATENCY_NS 100000
+
+// Time between the gate opening and the first pulse, and after the last
+#define GATE_NS 50000000
+
+#define PIN_CONTROL 0
+#define PIN_SIGNAL 1
+
+typedef struct {
+    int64_t t;
+    int pin;
+    int level;
+} transition_t;
+
+typedef struct {
+    int correct;
+    int64_t wakeups;
+    int64_t busy_ns;
+} result_t;
+
+static transition_t transitions[MAX_TRANSITIONS];
+static int num_transitions;
+static int max_bounces = 2;
+static rng_t rng;
+
+static int64_t monotonic_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static double uniform(double lo, double hi)
+{
+    return lo + rng_float(&rng) * (hi - lo);
+}
+
+static void add(int64_t t, int pin, int level)
+{
+    if (num_transitions < MAX_TRANSITIONS)
+        transitions[num_transitions++] = (transition_t) { t, pin, level };
+}
+
+// A clean transition followed by however many bounces it gets
+static void transition(int64_t t, int pin, int level)
+{
+    add(t, pin, level);
+
+    int bounces = rng_next(&rng) % (max_bounces + 1);
+    for (int i = 0; i < bounces; i++)
+    {
+        t += 20000 + rng_next(&rng) % (BOUNCE_NS / 2);
+        add(t, pin, !level);
+        t += 20000 + rng_next(&rng) % (BOUNCE_NS / 2);
+        add(t, pin, level);
+    }
+}
+
+static int by_time(const void* a, const void* b)
+{
+    int64_t x = ((const transition_t*) a)->t;
+    int64_t y = ((const transition_t*) b)->t;
+    return x < y ? -1 : x > y;
+}
+
+// One dial: the gate opens (control low), the signal contact breaks and
+// makes once per pulse, then the gate closes. Returns the dial's length.
+static int64_t make_dial(int pulses)
+{
+    double period = 1e9 / uniform(MIN_PPS, MAX_PPS);
+    double ratio = uniform(MIN_BREAK, MAX_BREAK);
+    int64_t t = 1000000;
+
+    num_transitions = 0;
+    transition(t, PIN_CONTROL, 0);
+    t += GATE_NS;
+
+    for (int p = 0; p < pulses; p++)
+    {
+        transition(t, PIN_SIGNAL, 0);
+        transition(t + (int64_t) (period * ratio), PIN_SIGNAL, 1);
+        t += (int64_t) period;
+    }
+
+    transition(t + GATE_NS, PIN_CONTROL, 1);
+    qsort(transitions, num_transitions, sizeof(transition_t), by_time);
+
+    return t + 2 * GATE_NS;
+}
+
+// The interrupt path as the dialer runs it: every edge is an event, a
+// control edge that moves the gate is taken unless it comes within the
+// bounce time of the last one taken, and the digit is the rising signal
+// edges halved
+static int decode_edges(result_t* r)
+{
+    bool dialing = false;
+    int64_t control_edge = 0;
+    int rising = 0;
+    int digit = -1;
+
+    for (int i = 0; i < num_transitions;)
+    {
+        int64_t start = monotonic_ns();
+        int64_t wake = transitions[i].t + WAKE_LATENCY_NS;
+
+        for (; i < num_transitions && transitions[i].t <= wake; i++)
+        {
+            const transition_t* t = &transitions[i];
+
+            if (t->pin == PIN_SIGNAL)
+            {
+                rising += t->level;
+                continue;
+            }
+
+            if (t->level != dialing || (control_edge != 0 && t->t - control_edge < DIALSTATS_BOUNCE_NS))
+                continue;
+
+            control_edge = t->t;
+            dialing = !dialing;
+
+            if (dialing)
+                rising = 0;
+            else if (rising / 2 > 0)
+                digit = (rising / 2) % 10;
+        }
+
+        r->wakeups++;
+        r->busy_ns += monotonic_ns() - start;
+    }
+
+    return digit;
+}
+
+// The sampled path: both pins read every period through the integrator,
+// one clean edge per transition
+static int decode_sampled(result_t* r, int64_t length)
+{
+    sampler_t s;
+    uint8_t levels[2] = { 1, 1 };
+    sampler_init(&s, 2, levels);
+
+    bool dialing = false;
+    int pulses = 0;
+    int digit = -1;
+    int next = 0;
+
+    // Ticks don't line up with the dial
+    int64_t t = rng_next(&rng) % SAMPLER_PERIOD_NS;
+
+    for (; t < length; t += SAMPLER_PERIOD_NS)
+    {
+        for (; next < num_transitions && transitions[next].t <= t; next++)
+            levels[transitions[next].pin] = transitions[next].level;
+
+        int64_t start = monotonic_ns();
+        uint32_t changed = sampler_update(&s, levels);
+
+        if (changed & (1u << PIN_SIGNAL))
+            pulses += sampler_level(&s, PIN_SIGNAL);
+
+        if (changed & (1u << PIN_CONTROL))
+        {
+            if (!sampler_level(&s, PIN_CONTROL) && !dialing)
+            {
+                dialing = true;
+                pulses = 0;
+            }
+            else if (sampler_level(&s, PIN_CONTROL) && dialing)
+            {
+                dialing = false;
+                if (pulses > 0)
+                    digit = pulses % 10;
+            }
+        }
+
+        r->wakeups++;
+        r->busy_ns += monotonic_ns() - start;
+    }
+
+    return digit;
+}
+
+// CPU time a bare timerfd at SAMPLER_HZ takes over a second, as a share of
+// one core
+static double timer_cpu()
+{
+    int fd = timerfd_create(CLOCK_MONOTONIC, 0);
+    struct itimerspec spec = {
+        .it_interval.tv_nsec = SAMPLER_PERIOD_NS,
+        .it_value.tv_nsec = SAMPLER_PERIOD_NS,
+    };
+
+    if (fd < 0 || timerfd_settime(fd, 0, &spec, NULL) != 0)
+        return -1;
+
+    struct timespec cpu0, cpu1;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu0);
+    int64_t start = monotonic_ns();
+
+    uint64_t expirations;
+    for (int i = 0; i < SAMPLER_HZ; i++)
+    {
+        if (read(fd, &expirations, sizeof(expirations)) < 0)
+            break;
+    }
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu1);
+    int64_t wall = monotonic_ns() - start;
+    close(fd);
+
+    int64_t used = (cpu1.tv_sec - cpu0.tv_sec) * 1000000000LL + (cpu1.tv_nsec - cpu0.tv_nsec);
+    return 100.0 * used / wall;
+}
+
+static void print(const char* name, const result_t* r, int dials, int64_t signal_ns)
+{
+    printf("%-8s %5.1f%% correct  %8.1f wakeups/s  %8.1f ns/wakeup\n", name, 100.0 * r->correct / dials,
+           r->wakeups * 1e9 / signal_ns, (double) r->busy_ns / r->wakeups);
+}
+
+int main(int argc, char** argv)
+{
+    int dials = 1000;
+    uint32_t seed = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:b:s:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                dials = atoi(optarg);
+                break;
+            case 'b':
+                max_bounces = atoi(optarg);
+                break;
+            case 's':
+                seed = atoi(optarg);
+                break;
+            default:
+                printf("Usage: %s [-n dials] [-b bounces] [-s seed]\n", argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    rng_seed(&rng, seed);
+
+    result_t edges = { 0 };
+    result_t sampled = { 0 };
+    int64_t signal_ns = 0;
+
+    for (int d = 0; d < dials; d++)
+    {
+        int pulses = 1 + rng_next(&rng) % 10;
+        int64_t length = make_dial(pulses);
+        signal_ns += length;
+
+        edges.correct += decode_edges(&edges) == pulses % 10;
+        sampled.correct += decode_sampled(&sampled, length) == pulses % 10;
+    }
+
+    printf("%d dials, up to %d bounces per transition\n", dials, max_bounces);
+    print("edges", &edges, dials, signal_ns);
+    print("sampled", &sampled, dials, signal_ns);
+
+    double cpu = timer_cpu();
+    if (cpu >= 0)
+        printf("a bare %d Hz timer costs %.2f%% of a core here\n", SAMPLER_HZ, cpu);
+
+    return 0;
+}
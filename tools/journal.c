@@ -0,0 +1,221 @@
+// Reads a dial journal offline and summarises it: how many digits were
+// dialed and when, which digits and sweeps came up, and how each digit's
+// dial timing held up. Records that fail their checksum, e.g. one torn by
+// a crash, are counted and skipped.
+//
+//   journal [-l] /var/lib/badge/journal
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "journal.h"
+
+// Effect indexes are stored in a signed byte
+#define MAX_EFFECTS 128
+
+static journal_record_t records[JOURNAL_RECORDS];
+
+static uint32_t get_u32(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static int by_seq(const void* a, const void* b)
+{
+    uint64_t x = ((const journal_record_t*) a)->seq;
+    uint64_t y = ((const journal_record_t*) b)->seq;
+    return x < y ? -1 : x > y;
+}
+
+static void format_time(int64_t timestamp_us, char* out, size_t size)
+{
+    time_t t = timestamp_us / 1000000;
+    struct tm tm;
+    localtime_r(&t, &tm);
+    strftime(out, size, "%Y-%m-%d %H:%M:%S", &tm);
+}
+
+static void list(const journal_record_t* r, int count)
+{
+    printf("     seq  time                 type      digit  pulses  effect    pps  break  jitter\n");
+
+    for (int i = 0; i < count; i++)
+    {
+        char when[32];
+        format_time(r[i].timestamp_us, when, sizeof(when));
+
+        printf("%8llu  %s  %-8s  %5d  %6d  %6d", (unsigned long long) r[i].seq, when,
+               r[i].type == JOURNAL_DIAL ? "dial" : "injected", r[i].digit, r[i].pulses, r[i].effect);
+
+        if (r[i].rate_cpps > 0)
+            printf("  %5.2f  %4d%%  %4uus\n", r[i].rate_cpps / 100.0, r[i].break_pct, r[i].jitter_us);
+        else
+            printf("      -      -       -\n");
+    }
+}
+
+static void summarise(const journal_record_t* r, int count)
+{
+    int dials = 0;
+    int injected = 0;
+    int digits[10] = { 0 };
+    int effects[MAX_EFFECTS] = { 0 };
+    int zoned = 0;
+    int hours[24] = { 0 };
+
+    // Timing per digit, only over dials that were measured
+    int timed[10] = { 0 };
+    double rate[10] = { 0 };
+    double breaks[10] = { 0 };
+    double jitter[10] = { 0 };
+
+    for (int i = 0; i < count; i++)
+    {
+        if (r[i].type != JOURNAL_DIAL)
+        {
+            injected++;
+            continue;
+        }
+
+        dials++;
+        int digit = r[i].digit % 10;
+        digits[digit]++;
+
+        if (r[i].effect < 0)
+            zoned++;
+        else
+            effects[r[i].effect]++;
+
+        time_t t = r[i].timestamp_us / 1000000;
+        struct tm tm;
+        localtime_r(&t, &tm);
+        hours[tm.tm_hour]++;
+
+        if (r[i].rate_cpps > 0)
+        {
+            timed[digit]++;
+            rate[digit] += r[i].rate_cpps / 100.0;
+            breaks[digit] += r[i].break_pct;
+            jitter[digit] += r[i].jitter_us;
+        }
+    }
+
+    char first[32], last[32];
+    format_time(r[0].timestamp_us, first, sizeof(first));
+    format_time(r[count - 1].timestamp_us, last, sizeof(last));
+
+    printf("%d dials, %d injected digits, %s to %s\n", dials, injected, first, last);
+    if (dials == 0)
+        return;
+
+    printf("\ndigit  dials    pps  break  jitter\n");
+    for (int d = 1; d <= 10; d++)
+    {
+        int digit = d % 10;
+        printf("%5d  %5d", digit, digits[digit]);
+
+        if (timed[digit] > 0)
+            printf("  %5.2f  %4.0f%%  %4.0fus\n", rate[digit] / timed[digit], breaks[digit] / timed[digit],
+                   jitter[digit] / timed[digit]);
+        else
+            printf("      -      -       -\n");
+    }
+
+    printf("\neffect  dials\n");
+    if (zoned > 0)
+        printf(" zones  %5d\n", zoned);
+    for (int e = 0; e < MAX_EFFECTS; e++)
+    {
+        if (effects[e] > 0)
+            printf("%6d  %5d\n", e, effects[e]);
+    }
+
+    printf("\nhour  dials\n");
+    for (int h = 0; h < 24; h++)
+    {
+        if (hours[h] > 0)
+            printf("  %02d  %5d\n", h, hours[h]);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int listing = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "l")) != -1)
+    {
+        if (opt != 'l')
+        {
+            printf("Usage: %s [-l] journal\n", argv[0]);
+            return 1;
+        }
+        listing = 1;
+    }
+
+    if (optind != argc - 1)
+    {
+        printf("Usage: %s [-l] journal\n", argv[0]);
+        return 1;
+    }
+
+    const char* path = argv[optind];
+    FILE* f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        printf("Unable to open %s\n", path);
+        return 1;
+    }
+
+    uint8_t header[JOURNAL_HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), f) != sizeof(header) || get_u32(header) != JOURNAL_MAGIC)
+    {
+        printf("%s is not a dial journal\n", path);
+        fclose(f);
+        return 1;
+    }
+
+    if (get_u32(header + 4) != JOURNAL_VERSION || get_u32(header + 8) != sizeof(journal_record_t)
+        || get_u32(header + 12) != JOURNAL_RECORDS)
+    {
+        printf("%s is journal version %u, this reader only knows version %d\n", path, get_u32(header + 4),
+               JOURNAL_VERSION);
+        fclose(f);
+        return 1;
+    }
+
+    // Keep the valid records, anything else is an empty slot or torn
+    int count = 0;
+    int torn = 0;
+    journal_record_t r;
+
+    while (fread(&r, sizeof(r), 1, f) == 1)
+    {
+        if (journal_valid(&r))
+            records[count++] = r;
+        else if (r.seq != 0 || r.checksum != 0)
+            torn++;
+    }
+    fclose(f);
+
+    if (torn > 0)
+        printf("%d damaged records skipped\n", torn);
+
+    if (count == 0)
+    {
+        printf("No dials recorded\n");
+        return 0;
+    }
+
+    qsort(records, count, sizeof(journal_record_t), by_seq);
+
+    if (listing)
+        list(records, count);
+    else
+        summarise(records, count);
+
+    return 0;
+}
@@ -0,0 +1,59 @@
+#!/bin/sh
+# Builds the bench under each optimisation variant and prints the mean
+# nanoseconds of work per frame for every effect and helper side by side,
+# with how each variant compares to -O2. Arguments go to every bench run.
+#
+#   STRIP=host tools/report.sh [-e effects] [-s sizes] [name...]
+set -e
+cd "$(dirname "$0")/.."
+
+STRIP=${STRIP:-pi}
+FRAMES=${FRAMES:-5000}
+OUT=build/report
+VARIANTS="O2 O3 LTO PGO"
+
+rm -rf $OUT
+mkdir -p $OUT
+
+make -s STRIP=$STRIP OUT=$OUT/O2 OPT="-O2" $OUT/O2/bench
+make -s STRIP=$STRIP OUT=$OUT/O3 OPT="-O3" $OUT/O3/bench
+make -s STRIP=$STRIP OUT=$OUT/LTO OPT="-O3 -flto=auto" $OUT/LTO/bench
+make -s STRIP=$STRIP pgo
+mkdir -p $OUT/PGO
+cp build/pgo/bench $OUT/PGO/bench
+
+for v in $VARIANTS; do
+    $OUT/$v/bench -f $FRAMES "$@" | grep -v '^#' > $OUT/$v.txt
+done
+
+# Columns are name, pixels, frames, ns per frame, ...; join on name and size
+awk -v variants="$VARIANTS" '
+    BEGIN { n = split(variants, names, " ") }
+    FNR == 1 { file++ }
+    {
+        key = $1 "@" $2
+        if (file == 1)
+            order[++effects] = key
+        mean[file, key] = $4
+    }
+    END {
+        printf "%-28s", "ns/frame"
+        for (v = 1; v <= n; v++)
+            printf " %14s", names[v]
+        printf "\n"
+
+        for (e = 1; e <= effects; e++)
+        {
+            name = order[e]
+            base = mean[1, name]
+            printf "%-28s %14.1f", name, base
+            for (v = 2; v <= n; v++)
+            {
+                if (base > 0)
+                    printf " %7.1f %+5.0f%%", mean[v, name], (mean[v, name] - base) * 100 / base
+                else
+                    printf " %14.1f", mean[v, name]
+            }
+            printf "\n"
+        }
+    }' $(for v in $VARIANTS; do echo $OUT/$v.txt; done)
@@ -0,0 +1,935 @@
+// Host checks, run against the stand-in strip by make check. Prints a line
+// per check and exits with 1 if any of them failed.
+//
+//   test [-g golden] [-u] [name...]
+//
+// golden runs every registered effect headless with a fixed seed, the way
+// the bench does, and hashes the frames it draws. The hashes have to match
+// the ones in the golden file, tools/golden.txt by default, so a change
+// meant only to make effects faster can be shown to draw the same pixels.
+// After a change that is meant to alter them, -u writes the file instead.
+// Two effects drawing the same frames at a size fail too, as the hashes
+// couldn't then tell a change to one of them from the other.
+// Floating point effects can round differently on another architecture or
+// compiler, the checked in hashes are for gcc on x86-64.
+//
+// delta runs every effect the same way and checks the delta that comes
+// with each sparse frame against a copy of the frame before: every pixel
+// that changed has to be listed, with what it showed. The power estimate
+// kept up from the deltas has to match a full count on every frame.
+//
+// geometry loads a calibration for a strip wired backwards round the ring
+// with one pixel moved and brought in, and checks the radius each pixel
+// ends up with and that every whole degree, wrapped either way, looks up
+// the ring position nearest to it.
+//
+// audio runs a tone in the middle of each band through the analysis and
+// checks it comes out loudest in that band, then that a tone starting out
+// of silence counts as one onset and no more.
+//
+// journal writes more dials than the ring holds to a scratch journal, then
+// checks every slot reads back valid with the newest where it belongs. It
+// reopens the journal to see it carry on from there, and again after
+// tearing the newest record, which has to cost that record alone. None of
+// the closes may start a shutdown.
+//
+// sampler feeds the dial debouncer two pins of synthetic contacts that
+// chatter after every transition and glitch for a sample now and then. It
+// has to give exactly one edge per transition, at the new level and soon
+// enough after it, and none for the glitches.
+//
+// allocs is only built into the alloc-check variant, which counts heap
+// allocations. It starts the lighting worker the way the badge does, runs
+// a few dials through it and fails if any of them allocated.
+//
+// shutdown stops the lighting worker with a dial's sweep going round. It
+// fails if the stop takes longer than the shutdown budget or leaves a
+// thread behind. It then stops it again, as more than one exit path does,
+// and the host strip aborts if that finishes the strip a second time.
+//
+// Naming checks runs only those.
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <ws2811.h>
+
+#include "audio.h"
+#include "delta.h"
+#include "effects.h"
+#include "geometry.h"
+#include "journal.h"
+#include "lighting.h"
+#include "power.h"
+#include "registry.h"
+#include "rng.h"
+#include "sampler.h"
+#include "shutdown.h"
+#include "telemetry.h"
+
+#define TEST_GOLDEN_FILE "tools/golden.txt"
+
+// Frames hashed per effect and the strip sizes they are drawn at. Each
+// dial stays active long enough for a sweep to go round the longest strip
+// twice, so colours that only change from lap to lap are hashed.
+#define TEST_GOLDEN_FRAMES 1000
+#define TEST_GOLDEN_SEED 1
+#define TEST_WIND_US 5000000
+
+// Most effects, built in and loaded, the golden check keeps hashes for
+#define TEST_MAX_EFFECTS 64
+
+#define TEST_ONSET_BLOCKS 8
+
+// The calibration geometry loads, and the pixel it moves and brings in
+#define TEST_GEOMETRY_PIXELS 12
+#define TEST_GEOMETRY_RADIUS 0.8
+#define TEST_GEOMETRY_MOVED 4
+#define TEST_GEOMETRY_MOVED_ANGLE 100.0
+#define TEST_GEOMETRY_MOVED_RADIUS 0.5
+
+// Enough dials to go round the journal's ring and then some
+#define TEST_JOURNAL_DIALS (JOURNAL_RECORDS + 3)
+
+// Transitions per pin, the shortest a contact holds a level in samples, and
+// how many times it may chatter back after a transition
+#define TEST_SAMPLER_TRANSITIONS 500
+#define TEST_SAMPLER_HOLD 40
+#define TEST_SAMPLER_BOUNCES 3
+#define TEST_SAMPLER_PINS 2
+
+// Longest an edge may take to come out after a transition, in samples
+#define TEST_SAMPLER_LATENCY (2 * TEST_SAMPLER_BOUNCES + SAMPLER_INTEGRATOR)
+
+// Dials run through the lighting worker by allocs, after one to warm up
+#define TEST_ALLOC_DIALS 3
+
+// Longest a dial's highlight may take to finish
+#define TEST_IDLE_WAIT_US 5000000
+
+// How long shutdown lets the sweep run before stopping it
+#define TEST_SWEEP_US 300000
+
+static const int golden_sizes[] = { 43, 300 };
+
+#define TEST_GOLDEN_SIZES ((int) (sizeof(golden_sizes) / sizeof(golden_sizes[0])))
+
+typedef int (*check_func)();
+
+// A synthetic dial contact for the sampler check
+typedef struct {
+    uint8_t level;
+    int transitions;
+    int64_t changed;
+    int64_t next;
+    int chatter;
+} test_contact_t;
+
+typedef struct {
+    const char* name;
+    check_func run;
+} test_check_t;
+
+static ws2811_t strip;
+static ws2811_led_t leds[GEOMETRY_MAX_PIXELS];
+
+static const char* golden_file = TEST_GOLDEN_FILE;
+static bool update = false;
+
+// The clock the effects see, moved on by the tick of every frame
+static int64_t virtual_us = 0;
+static int64_t active_until = 0;
+
+// The effects can't be started again once stopped, so the checks that need
+// the worker share one start, and whatever runs last stops it
+static bool lighting_running = false;
+
+// The frame before the one being checked by delta, and the first problem
+static ws2811_led_t shadow[GEOMETRY_MAX_PIXELS];
+static const char* delta_effect = NULL;
+static int delta_frames = 0;
+static bool delta_failed = false;
+
+// FNV-1a over every frame drawn since the last reset
+static uint64_t frame_hash = 0;
+static int frames = 0;
+
+static int64_t virtual_clock()
+{
+    return virtual_us;
+}
+
+static int64_t now_us()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static bool is_active()
+{
+    return virtual_us < active_until;
+}
+
+static void hash_reset()
+{
+    frame_hash = 0xcbf29ce484222325ULL;
+    frames = 0;
+}
+
+static void hash_frame(const ws2811_t* np)
+{
+    const ws2811_channel_t* channel = &np->channel[0];
+
+    for (int i = 0; i < channel->count; i++)
+    {
+        frame_hash ^= channel->leds[i];
+        frame_hash *= 0x100000001b3ULL;
+    }
+
+    frames++;
+}
+
+// Stands in for the strip: hash the frame and skip ahead by the tick
+static void test_sync(ws2811_t* np, int tick)
+{
+    if (np != NULL)
+        hash_frame(np);
+
+    virtual_us += tick;
+}
+
+static void delta_fail(const char* what, int pixel)
+{
+    if (!delta_failed)
+        printf("delta: %s at %d pixels, frame %d: %s %d\n", delta_effect, strip.channel[0].count, frames, what, pixel);
+
+    delta_failed = true;
+}
+
+// Stands in for the strip like test_sync, checking each frame's delta first
+static void delta_sync(ws2811_t* np, int tick)
+{
+    virtual_us += tick;
+    if (np == NULL)
+        return;
+
+    const ws2811_channel_t* channel = &np->channel[0];
+    const pixel_delta_t* delta = frame_delta();
+
+    if (delta != NULL)
+    {
+        delta_frames++;
+
+        for (int i = 0; i < delta->count; i++)
+        {
+            if (delta->was[i] != shadow[delta->pixel[i]])
+                delta_fail("wrong previous value for pixel", delta->pixel[i]);
+        }
+
+        for (int p = 0; p < channel->count; p++)
+        {
+            if (channel->leds[p] != shadow[p] && !delta->marked[p])
+                delta_fail("unlisted change to pixel", p);
+        }
+    }
+
+    // With no budget the estimate is reported as it is
+    power_limit_delta(np, delta);
+    if (telemetry_get(TELEMETRY_POWER_MA) != power_estimate_ua(np) / 1000)
+        delta_fail("power estimate off, pixels", channel->count);
+
+    memcpy(shadow, channel->leds, channel->count * sizeof(ws2811_led_t));
+    frames++;
+}
+
+static void strip_init(int pixels)
+{
+    geometry_uniform(pixels);
+    memset(leds, 0, sizeof(leds));
+
+    strip.channel[0] = (ws2811_channel_t) {
+        .count = pixels,
+        .leds = leds,
+        .brightness = 255,
+        .strip_type = WS2811_STRIP_GRB,
+    };
+    power_init(&strip);
+}
+
+// Run the effect over and over from a fixed seed until it has drawn enough
+static uint64_t effect_hash(int index)
+{
+    hash_reset();
+    effects_seed(TEST_GOLDEN_SEED);
+
+    while (frames < TEST_GOLDEN_FRAMES)
+    {
+        active_until = virtual_us + TEST_WIND_US;
+        registry_call(index, &strip, is_active);
+    }
+
+    return frame_hash;
+}
+
+// Returns 1 if the hash for name at this size is missing or different
+static int golden_compare(FILE* f, const char* name, int pixels, uint64_t hash)
+{
+    char line[128];
+    char want_name[64];
+    int want_pixels;
+    uint64_t want;
+
+    rewind(f);
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        if (line[0] == '#' || sscanf(line, "%63s %d %" SCNx64, want_name, &want_pixels, &want) != 3)
+            continue;
+
+        if (strcmp(want_name, name) == 0 && want_pixels == pixels)
+        {
+            if (want == hash)
+                return 0;
+
+            printf("golden: %s at %d pixels drew %016" PRIx64 ", expected %016" PRIx64 "\n", name, pixels, hash, want);
+            return 1;
+        }
+    }
+
+    printf("golden: no hash for %s at %d pixels\n", name, pixels);
+    return 1;
+}
+
+// Returns 1 if an effect before index drew the same frames at this size
+static int golden_unique(const uint64_t* hashes, int index, int pixels)
+{
+    for (int i = 0; i < index; i++)
+    {
+        if (hashes[i] == hashes[index])
+        {
+            printf("golden: %s and %s at %d pixels drew the same frames\n",
+                   registry_info(i)->name, registry_info(index)->name, pixels);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int check_golden()
+{
+    static uint64_t hashes[TEST_MAX_EFFECTS];
+
+    if (registry_count() > TEST_MAX_EFFECTS)
+    {
+        printf("golden: %d effects, only room for %d\n", registry_count(), TEST_MAX_EFFECTS);
+        return 1;
+    }
+
+    FILE* f = fopen(golden_file, update ? "w" : "r");
+    if (f == NULL)
+    {
+        printf("Unable to open %s\n", golden_file);
+        return 1;
+    }
+
+    if (update)
+        fprintf(f, "# effect pixels hash, %d frames each from seed %d, written by test -u\n",
+                TEST_GOLDEN_FRAMES, TEST_GOLDEN_SEED);
+
+    int failed = 0;
+    for (int s = 0; s < TEST_GOLDEN_SIZES; s++)
+    {
+        strip_init(golden_sizes[s]);
+
+        for (int index = 0; index < registry_count(); index++)
+        {
+            const char* name = registry_info(index)->name;
+            uint64_t hash = effect_hash(index);
+
+            hashes[index] = hash;
+            failed |= golden_unique(hashes, index, golden_sizes[s]);
+
+            if (update)
+                fprintf(f, "%s %d %016" PRIx64 "\n", name, golden_sizes[s], hash);
+            else
+                failed |= golden_compare(f, name, golden_sizes[s], hash);
+        }
+    }
+
+    fclose(f);
+    return failed;
+}
+
+// A sine that goes round bin times a block
+static void tone(float* block, int bin, float amplitude)
+{
+    for (int i = 0; i < AUDIO_BLOCK; i++)
+        block[i] = amplitude * sinf(2 * M_PI * bin * i / AUDIO_BLOCK);
+}
+
+static int loudest_band(const audio_levels_t* levels)
+{
+    int loudest = 0;
+    for (int b = 1; b < AUDIO_BANDS; b++)
+    {
+        if (levels->band[b] > levels->band[loudest])
+            loudest = b;
+    }
+
+    return loudest;
+}
+
+static int check_audio()
+{
+    static float block[AUDIO_BLOCK];
+    audio_levels_t levels;
+    int failed = 0;
+
+    // Band b covers bins 2^b up to 2^(b + 1)
+    for (int b = 0; b < AUDIO_BANDS; b++)
+    {
+        audio_init();
+
+        // An impulse has a flat spectrum, 16 / AUDIO_BLOCK^2 in every bin,
+        // so every band's peak starts out the same per bin
+        memset(block, 0, sizeof(block));
+        block[AUDIO_BLOCK / 2] = 1;
+        audio_analyse(block, &levels);
+
+        // A sine puts about its amplitude squared in its bin, aim for half
+        // of what the impulse left in the band
+        int bin = (3 << b) / 2;
+        tone(block, bin, sqrtf(8.0f * (1 << b)) / AUDIO_BLOCK);
+        audio_analyse(block, &levels);
+
+        if (loudest_band(&levels) != b)
+        {
+            printf("audio: a tone at bin %d came out loudest in band %d, not %d\n", bin, loudest_band(&levels), b);
+            failed = 1;
+        }
+    }
+
+    audio_init();
+    memset(block, 0, sizeof(block));
+    for (int i = 0; i < TEST_ONSET_BLOCKS; i++)
+        audio_analyse(block, &levels);
+
+    uint32_t before = levels.onsets;
+
+    tone(block, AUDIO_BINS / 4, 0.5f);
+    for (int i = 0; i < TEST_ONSET_BLOCKS; i++)
+        audio_analyse(block, &levels);
+
+    if (levels.onsets - before != 1)
+    {
+        printf("audio: silence then a steady tone made %u onsets, not 1\n", (unsigned) (levels.onsets - before));
+        failed = 1;
+    }
+
+    return failed;
+}
+
+// The contact's reading at sample t. Chatter flips it back and forth after
+// a transition, glitches are lone samples at the other level mid-hold.
+static uint8_t contact_sample(test_contact_t* c, int64_t t, rng_t* rng)
+{
+    if (t == c->next)
+    {
+        c->level = !c->level;
+        c->changed = t;
+        c->chatter = 2 * (rng_next(rng) % (TEST_SAMPLER_BOUNCES + 1));
+        c->next = ++c->transitions < TEST_SAMPLER_TRANSITIONS
+            ? t + TEST_SAMPLER_HOLD + rng_next(rng) % TEST_SAMPLER_HOLD : -1;
+    }
+
+    if (c->chatter > 0)
+    {
+        c->chatter--;
+        return c->chatter % 2 ? !c->level : c->level;
+    }
+
+    bool settled = t - c->changed > TEST_SAMPLER_LATENCY && (c->next < 0 || c->next - t > SAMPLER_INTEGRATOR);
+    if (settled && rng_next(rng) % 16 == 0)
+        return !c->level;
+
+    return c->level;
+}
+
+static int check_sampler()
+{
+    test_contact_t contacts[TEST_SAMPLER_PINS];
+    uint8_t levels[TEST_SAMPLER_PINS];
+    int edges[TEST_SAMPLER_PINS];
+    sampler_t sampler;
+    rng_t rng;
+
+    rng_seed(&rng, TEST_GOLDEN_SEED);
+    for (int p = 0; p < TEST_SAMPLER_PINS; p++)
+    {
+        contacts[p] = (test_contact_t) { .level = p, .next = TEST_SAMPLER_HOLD * (p + 1) };
+        levels[p] = p;
+        edges[p] = 0;
+    }
+    sampler_init(&sampler, TEST_SAMPLER_PINS, levels);
+
+    // Until every contact is done and has had time to settle
+    int64_t quiet = 0;
+    for (int64_t t = 0; quiet < TEST_SAMPLER_HOLD; t++)
+    {
+        quiet++;
+        for (int p = 0; p < TEST_SAMPLER_PINS; p++)
+        {
+            levels[p] = contact_sample(&contacts[p], t, &rng);
+            if (contacts[p].next >= 0 || t - contacts[p].changed <= TEST_SAMPLER_LATENCY)
+                quiet = 0;
+        }
+
+        uint32_t changed = sampler_update(&sampler, levels);
+
+        for (int p = 0; p < TEST_SAMPLER_PINS; p++)
+        {
+            if (!(changed & (1u << p)))
+                continue;
+
+            edges[p]++;
+            int64_t latency = t - contacts[p].changed;
+            if (sampler_level(&sampler, p) != contacts[p].level || latency > TEST_SAMPLER_LATENCY)
+            {
+                printf("sampler: pin %d went to %d at sample %lld, %lld after the contact went to %d\n", p,
+                       sampler_level(&sampler, p), (long long) t, (long long) latency, contacts[p].level);
+                return 1;
+            }
+        }
+    }
+
+    for (int p = 0; p < TEST_SAMPLER_PINS; p++)
+    {
+        if (edges[p] != contacts[p].transitions)
+        {
+            printf("sampler: pin %d gave %d edges for %d transitions\n", p, edges[p], contacts[p].transitions);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void journal_dials(int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        journal_record_t record = {
+            .type = JOURNAL_DIAL,
+            .digit = i % 10,
+            .pulses = i % 10 == 0 ? 10 : i % 10,
+            .effect = -1,
+        };
+        journal_append(&record);
+    }
+}
+
+// Highest valid seq in the journal file, 0 if there are none. Fails with -1
+// if any slot holds an invalid record or one that's in the wrong slot.
+static int64_t journal_newest(const char* path)
+{
+    static journal_record_t ring[JOURNAL_RECORDS];
+
+    FILE* f = fopen(path, "rb");
+    if (f == NULL)
+        return -1;
+
+    bool read = fseek(f, JOURNAL_HEADER_SIZE, SEEK_SET) == 0
+        && fread(ring, sizeof(journal_record_t), JOURNAL_RECORDS, f) == JOURNAL_RECORDS;
+    fclose(f);
+
+    if (!read)
+        return -1;
+
+    int64_t newest = 0;
+    for (int i = 0; i < JOURNAL_RECORDS; i++)
+    {
+        if (ring[i].seq == 0)
+            continue;
+
+        if (!journal_valid(&ring[i]) || (ring[i].seq - 1) % JOURNAL_RECORDS != (uint64_t) i)
+            return -1;
+
+        if ((int64_t) ring[i].seq > newest)
+            newest = ring[i].seq;
+    }
+
+    return newest;
+}
+
+// Flip a byte of the newest record, as a crash in the middle of writing it
+// would leave it
+static int journal_tear(const char* path, int64_t seq)
+{
+    FILE* f = fopen(path, "r+b");
+    if (f == NULL)
+        return 1;
+
+    long offset = JOURNAL_HEADER_SIZE + (long) ((seq - 1) % JOURNAL_RECORDS) * sizeof(journal_record_t);
+    int torn = fseek(f, offset + offsetof(journal_record_t, digit), SEEK_SET) == 0 && fputc(0xff, f) != EOF;
+    fclose(f);
+
+    return torn ? 0 : 1;
+}
+
+static int journal_run(const char* path)
+{
+    if (journal_open(path) != 0)
+        return 1;
+    journal_dials(TEST_JOURNAL_DIALS);
+    journal_close();
+
+    int64_t newest = journal_newest(path);
+    if (newest != TEST_JOURNAL_DIALS)
+    {
+        printf("journal: newest record is %lld after %d dials, -1 for a bad one\n", (long long) newest,
+               TEST_JOURNAL_DIALS);
+        return 1;
+    }
+
+    if (journal_open(path) != 0)
+        return 1;
+    journal_dials(1);
+    journal_close();
+
+    newest = journal_newest(path);
+    if (newest != TEST_JOURNAL_DIALS + 1)
+    {
+        printf("journal: reopened journal wrote record %lld, not %d\n", (long long) newest, TEST_JOURNAL_DIALS + 1);
+        return 1;
+    }
+
+    // The torn record doesn't count, so the next one takes its place
+    if (journal_tear(path, newest) != 0 || journal_open(path) != 0)
+        return 1;
+    journal_dials(1);
+    journal_close();
+
+    if (journal_newest(path) != newest)
+    {
+        printf("journal: the record after a torn one didn't take its place\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+static int check_journal()
+{
+    char path[] = "/tmp/badge-journal-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0)
+        return 1;
+    close(fd);
+
+    int ret = journal_run(path);
+    unlink(path);
+
+    // Closing joined the syncer, which is no reason to shut down
+    if (shutdown_requested())
+    {
+        printf("journal: closing the journal started a shutdown\n");
+        return 1;
+    }
+
+    return ret;
+}
+
+static int check_delta()
+{
+    int budget = power_budget();
+    power_set_budget(0);
+    effects_bind_zone(NULL, delta_sync, NULL);
+    delta_frames = 0;
+    delta_failed = false;
+
+    for (int s = 0; s < TEST_GOLDEN_SIZES; s++)
+    {
+        strip_init(golden_sizes[s]);
+        memcpy(shadow, leds, sizeof(shadow));
+
+        for (int index = 0; index < registry_count() && !delta_failed; index++)
+        {
+            delta_effect = registry_info(index)->name;
+            frames = 0;
+            effects_seed(TEST_GOLDEN_SEED);
+
+            while (frames < TEST_GOLDEN_FRAMES)
+            {
+                active_until = virtual_us + TEST_WIND_US;
+                registry_call(index, &strip, is_active);
+            }
+        }
+    }
+
+    effects_bind_zone(NULL, test_sync, NULL);
+    power_set_budget(budget);
+
+    // Nothing checked if no effect drew a sparse frame
+    if (delta_frames == 0)
+    {
+        printf("delta: no effect drew a frame with a delta\n");
+        return 1;
+    }
+
+    return delta_failed ? 1 : 0;
+}
+
+static double angle_distance(double a, double b)
+{
+    double d = fabs(fmod(a - b, 360.0));
+    return d > 180.0 ? 360.0 - d : d;
+}
+
+static int geometry_write(const char* path)
+{
+    FILE* f = fopen(path, "w");
+    if (f == NULL)
+        return 1;
+
+    fprintf(f, "pixels %d\n", TEST_GEOMETRY_PIXELS);
+    fprintf(f, "start %f\n", 360.0 - 360.0 / TEST_GEOMETRY_PIXELS);
+    fprintf(f, "spacing %f\n", -360.0 / TEST_GEOMETRY_PIXELS);
+    fprintf(f, "radius %f\n", TEST_GEOMETRY_RADIUS);
+    fprintf(f, "pixel %d %f %f\n", TEST_GEOMETRY_MOVED, TEST_GEOMETRY_MOVED_ANGLE, TEST_GEOMETRY_MOVED_RADIUS);
+
+    return fclose(f) == 0 ? 0 : 1;
+}
+
+static int check_geometry()
+{
+    char path[] = "/tmp/badge-geometry-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0)
+        return 1;
+    close(fd);
+
+    int loaded = geometry_write(path) == 0 ? geometry_load(path) : 1;
+    unlink(path);
+    if (loaded != 0)
+        return 1;
+
+    const geometry_t* geo = geometry();
+
+    for (int i = 0; i < geo->pixels; i++)
+    {
+        double want = i == TEST_GEOMETRY_MOVED ? TEST_GEOMETRY_MOVED_RADIUS : TEST_GEOMETRY_RADIUS;
+        if (fabs(geo->radius[i] - want) > 1e-6)
+        {
+            printf("geometry: pixel %d has radius %f, expected %f\n", i, geo->radius[i], want);
+            return 1;
+        }
+    }
+
+    for (int d = -360; d < 720; d++)
+    {
+        int pos = geometry_angle_pos(d);
+        double got = angle_distance(geo->angle[geometry_ring_pixel(pos)], d);
+
+        for (int p = 0; p < geo->pixels; p++)
+        {
+            if (angle_distance(geo->angle[geometry_ring_pixel(p)], d) < got - 1e-6)
+            {
+                printf("geometry: %d degrees looks up position %d, %d is nearer\n", d, pos, p);
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+// The real clock and strip from here on, golden has to run before
+static int start_lighting()
+{
+    if (lighting_running)
+        return 0;
+
+    effects_set_clock(NULL);
+    effects_bind_zone(NULL, NULL, NULL);
+
+    if (geometry_load(NULL) != 0 || lighting_start() != 0)
+        return 1;
+
+    lighting_running = true;
+    return 0;
+}
+
+static void stop_lighting()
+{
+    if (!lighting_running)
+        return;
+
+    shutdown_begin();
+    lighting_stop();
+    lighting_running = false;
+}
+
+#ifdef ALLOC_HOOKS
+
+// stdio only allocates stdout's buffer on its first write, which in the
+// allocs check can be a deadline warning from the middle of a measured
+// dial. The badge has printed plenty before its first dial, the test hasn't.
+static char stdout_buffer[BUFSIZ];
+
+// One dial the way the input loop posts it, then wait for the highlight
+static void dial_cycle(int pulses)
+{
+    lighting_dial_begin();
+    usleep(400000);
+    lighting_dial_pulses(pulses);
+    usleep(100000);
+    lighting_dial_end();
+
+    for (int waited = 0; lighting_current() != LIGHTING_IDLE && waited < TEST_IDLE_WAIT_US; waited += 20000)
+        usleep(20000);
+}
+
+static int check_allocs()
+{
+    if (start_lighting() != 0)
+        return 1;
+
+    // Allocations libc makes on our behalf have to be seen too
+    int64_t before = telemetry_get(TELEMETRY_HEAP_ALLOCS);
+    free(strdup("allocs"));
+    if (telemetry_get(TELEMETRY_HEAP_ALLOCS) == before)
+    {
+        printf("allocs: an allocation made inside libc wasn't counted\n");
+        return 1;
+    }
+
+    // The first dial is allowed to set up whatever it keeps for the next
+    dial_cycle(3);
+
+    before = telemetry_get(TELEMETRY_HEAP_ALLOCS);
+    for (int i = 0; i < TEST_ALLOC_DIALS; i++)
+        dial_cycle(1 + i);
+    int64_t made = telemetry_get(TELEMETRY_HEAP_ALLOCS) - before;
+
+    if (made != 0)
+    {
+        printf("allocs: %d dial cycles made %lld heap allocations\n", TEST_ALLOC_DIALS, (long long) made);
+        return 1;
+    }
+
+    return 0;
+}
+
+#endif
+
+// Stops the effects for good, so it has to run last
+static int check_shutdown()
+{
+    if (start_lighting() != 0)
+        return 1;
+
+    lighting_dial_begin();
+    usleep(TEST_SWEEP_US);
+
+    if (lighting_current() != LIGHTING_DIALING)
+    {
+        printf("shutdown: the sweep never started\n");
+        return 1;
+    }
+
+    int64_t start = now_us();
+    stop_lighting();
+    int64_t took = now_us() - start;
+
+    lighting_stop();
+
+    if (took > SHUTDOWN_BUDGET_MS * 1000 || shutdown_abandoned() > 0)
+    {
+        printf("shutdown: took %lld us, %d threads left running\n", (long long) took, shutdown_abandoned());
+        return 1;
+    }
+
+    return 0;
+}
+
+static const test_check_t checks[] = {
+    { "golden", check_golden },
+    { "delta", check_delta },
+    { "geometry", check_geometry },
+    { "audio", check_audio },
+    { "journal", check_journal },
+    { "sampler", check_sampler },
+#ifdef ALLOC_HOOKS
+    { "allocs", check_allocs },
+#endif
+    { "shutdown", check_shutdown },
+};
+
+#define TEST_CHECKS ((int) (sizeof(checks) / sizeof(checks[0])))
+
+static bool is_wanted(const char* name, char** names, int count)
+{
+    if (count == 0)
+        return true;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (strcmp(names[i], name) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+int main(int argc, char** argv)
+{
+#ifdef ALLOC_HOOKS
+    setvbuf(stdout, stdout_buffer, _IOLBF, sizeof(stdout_buffer));
+#endif
+
+    int opt;
+    while ((opt = getopt(argc, argv, "g:uh")) != -1)
+    {
+        switch (opt)
+        {
+            case 'g':
+                golden_file = optarg;
+                break;
+            case 'u':
+                update = true;
+                break;
+            default:
+                printf("Usage: %s [-g golden] [-u] [name...]\n", argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    registry_init();
+
+    if (effects_init(GEOMETRY_MAX_PIXELS) != 0)
+        return 1;
+
+    effects_set_clock(virtual_clock);
+    effects_bind_zone(NULL, test_sync, NULL);
+
+    int failed = 0;
+    for (int i = 0; i < TEST_CHECKS; i++)
+    {
+        if (!is_wanted(checks[i].name, argv + optind, argc - optind))
+            continue;
+
+        int ret = checks[i].run();
+        printf("%-12s %s\n", checks[i].name, ret == 0 ? "ok" : "FAILED");
+        failed |= ret;
+    }
+
+    stop_lighting();
+    return failed;
+}
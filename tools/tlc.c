@@ -0,0 +1,182 @@
+// Timeline compiler: turns a text timeline into the binary program the badge
+// loads from /etc/badge/effects. See src/timeline.h for the binary format
+// and conf/effects/comet.tl for the text one.
+//
+//   tlc input.tl output.btl
+//   tlc -d program.btl          dump a compiled program
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "timeline.h"
+
+static int fixed_degrees(double degrees)
+{
+    return (int) lround(degrees * (1 << TIMELINE_DEGREE_SHIFT));
+}
+
+static int parse(const char* path, timeline_t* t)
+{
+    FILE* f = fopen(path, "r");
+    if (f == NULL)
+    {
+        printf("Unable to open %s\n", path);
+        return 1;
+    }
+
+    memset(t, 0, sizeof(*t));
+    t->weight = 1;
+    t->loop = true;
+    t->tick = 7500;
+    t->tracks = 0;
+
+    char line[256];
+    int lineno = 0;
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        lineno++;
+
+        // Strip comments, skip blanks
+        char* hash = strchr(line, '#');
+        if (hash != NULL)
+            *hash = '\0';
+
+        char key[32];
+        if (sscanf(line, "%31s", key) != 1)
+            continue;
+
+        char word[32];
+        bool ok = true;
+
+        if (strcmp(key, "name") == 0)
+            ok = sscanf(line, "%*s %23s", t->name) == 1;
+        else if (strcmp(key, "tick") == 0)
+            ok = sscanf(line, "%*s %d", &t->tick) == 1;
+        else if (strcmp(key, "frames") == 0)
+            ok = sscanf(line, "%*s %d", &t->frames) == 1;
+        else if (strcmp(key, "weight") == 0)
+            ok = sscanf(line, "%*s %d", &t->weight) == 1;
+        else if (strcmp(key, "loop") == 0)
+        {
+            ok = sscanf(line, "%*s %31s", word) == 1
+                 && (strcmp(word, "yes") == 0 || strcmp(word, "no") == 0);
+            t->loop = ok && strcmp(word, "yes") == 0;
+        }
+        else if (strcmp(key, "track") == 0)
+        {
+            ok = t->tracks < TIMELINE_MAX_TRACKS;
+            if (ok)
+                t->tracks++;
+        }
+        else if (strcmp(key, "key") == 0 && t->tracks > 0)
+        {
+            timeline_track_t* track = &t->track[t->tracks - 1];
+            int frame;
+            double pos;
+            double width;
+            int hue;
+            int value;
+
+            strcpy(word, "linear");
+            int found = sscanf(line, "%*s %d %lf %d %d %lf %31s", &frame, &pos, &hue, &value, &width, word);
+
+            ok = track->keys < TIMELINE_MAX_KEYS && found >= 5;
+            if (ok)
+            {
+                timeline_key_t* k = &track->key[track->keys++];
+                k->frame = frame;
+                k->pos = fixed_degrees(pos);
+                k->hue = hue;
+                k->value = value;
+                k->width = fixed_degrees(width);
+                k->ease = timeline_ease_find(word);
+                ok = k->ease >= 0;
+            }
+        }
+        else
+            ok = false;
+
+        if (!ok)
+        {
+            printf("%s:%d: bad entry\n", path, lineno);
+            fclose(f);
+            return 1;
+        }
+    }
+
+    fclose(f);
+
+    if (t->name[0] == '\0')
+    {
+        printf("%s: needs a name\n", path);
+        return 1;
+    }
+
+    char err[128];
+    if (timeline_validate(t, err, sizeof(err)) != 0)
+    {
+        printf("%s: %s\n", path, err);
+        return 1;
+    }
+
+    return 0;
+}
+
+static void dump(const timeline_t* t)
+{
+    printf("name %s\ntick %d\nframes %d\nloop %s\nweight %d\n",
+           t->name, t->tick, t->frames, t->loop ? "yes" : "no", t->weight);
+
+    double scale = 1 << TIMELINE_DEGREE_SHIFT;
+    for (int i = 0; i < t->tracks; i++)
+    {
+        printf("\ntrack\n");
+        for (int k = 0; k < t->track[i].keys; k++)
+        {
+            const timeline_key_t* key = &t->track[i].key[k];
+            printf("key %d %g %d %d %g %s\n", key->frame, key->pos / scale, key->hue, key->value,
+                   key->width / scale, timeline_ease_name(key->ease));
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    static timeline_t t;
+    static uint8_t buf[TIMELINE_MAX_SIZE];
+
+    if (argc == 3 && strcmp(argv[1], "-d") == 0)
+    {
+        if (timeline_load(argv[2], &t) != 0)
+            return 1;
+
+        dump(&t);
+        return 0;
+    }
+
+    if (argc != 3)
+    {
+        printf("Usage: %s input.tl output.btl\n       %s -d program.btl\n", argv[0], argv[0]);
+        return 1;
+    }
+
+    if (parse(argv[1], &t) != 0)
+        return 1;
+
+    size_t size = timeline_encode(&t, buf, sizeof(buf));
+
+    FILE* f = fopen(argv[2], "wb");
+    if (f == NULL || fwrite(buf, 1, size, f) != size)
+    {
+        printf("Unable to write %s\n", argv[2]);
+        if (f != NULL)
+            fclose(f);
+        return 1;
+    }
+    fclose(f);
+
+    printf("%s: %d tracks, %d frames, %zu bytes\n", t.name, t.tracks, t.frames, size);
+    return 0;
+}